@@ -117,6 +117,7 @@ int l2cap_send_prepared_connectionless(uint16_t handle, uint16_t cid, uint16_t l
 
     if (!hci_can_send_prepared_acl_packet_now(handle)){
         log_info("l2cap_send_prepared_connectionless handle %u,, cid %u, cannot send", handle, cid);
+        hci_statistics_count_acl_buffers_full(handle);
         return BTSTACK_ACL_BUFFERS_FULL;
     }
     
@@ -142,6 +143,7 @@ int l2cap_send_connectionless(uint16_t handle, uint16_t cid, uint8_t *data, uint
 
     if (!hci_can_send_acl_packet_now(handle)){
         log_info("l2cap_send_connectionless cid %u, cannot send", cid);
+        hci_statistics_count_acl_buffers_full(handle);
         return BTSTACK_ACL_BUFFERS_FULL;
     }
 
@@ -39,7 +39,7 @@
  *
  *  Adapter to use cc256x-based chipsets with BTstack
  *  
- *  Handles init script (a.k.a. Service Patch)
+ *  Handles init script (a.k.a. Service Patch), commands are pipelined if controller accepts more than one
  *  Allows for non-standard UART baud rate
  *  Allows to configure transmit power
  *  Allows to activate eHCILL deep sleep mode
@@ -260,7 +260,14 @@ static int bt_control_cc256x_next_cmd(void *config, uint8_t *hci_cmd_buffer){
         init_script_offset = current_offset;
     }
 
-    return 1; 
+    // sleep mode configuration might activate eHCILL, wait for its completion
+    uint16_t opcode = hci_cmd_buffer[0] | (hci_cmd_buffer[1] << 8);
+    if (opcode == 0xFD0C){
+        return 1;
+    }
+
+    // controller processes init script commands in order, next one can be sent right away
+    return 3; 
 }
 
 // MARK: const structs 
@@ -325,6 +325,29 @@ extern "C" {
 // data: discoverable enabled (bool)
 #define BTSTACK_EVENT_DISCOVERABLE_ENABLED                 0x66
 
+/**
+ * @format 1H4444444444444222
+ * @param status
+ * @param handle
+ * @param acl_packets_sent
+ * @param acl_fragments_sent
+ * @param acl_bytes_sent
+ * @param acl_packets_received
+ * @param acl_bytes_received
+ * @param acl_recombination_drops
+ * @param acl_buffers_full
+ * @param acl_no_free_slots_ms
+ * @param sco_packets_sent
+ * @param sco_bytes_sent
+ * @param sco_packets_received
+ * @param sco_bytes_received
+ * @param cmd_packets_sent
+ * @param acl_packets_queued
+ * @param cmd_packets_pending
+ * @param cmd_packets_pending_max
+ */
+#define BTSTACK_EVENT_HCI_STATISTICS                       0x67
+
 // Daemon Events used internally
 
 // data: event(8)
@@ -668,10 +691,18 @@ extern "C" {
 //
 
 // from Bluetooth Core Specification
+#define ERROR_CODE_UNKNOWN_HCI_COMMAND                     0x01
 #define ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER           0x02
+#define ERROR_CODE_PAGE_TIMEOUT                            0x04
 #define ERROR_CODE_AUTHENTICATION_FAILURE				   0x05
+#define ERROR_CODE_PIN_OR_KEY_MISSING                      0x06
 #define ERROR_CODE_MEMORY_CAPACITY_EXCEEDED	    		   0x07
+#define ERROR_CODE_CONNECTION_TIMEOUT                      0x08
+#define ERROR_CODE_ACL_CONNECTION_ALREADY_EXISTS           0x0B
 #define ERROR_CODE_COMMAND_DISALLOWED                      0x0C
+#define ERROR_CODE_CONNECTION_REJECTED_DUE_TO_LIMITED_RESOURCES 0x0D
+#define ERROR_CODE_REMOTE_USER_TERMINATED_CONNECTION       0x13
+#define ERROR_CODE_CONNECTION_TERMINATED_BY_LOCAL_HOST     0x16
 #define ERROR_CODE_PAIRING_NOT_ALLOWED                     0x18
 #define ERROR_CODE_INSUFFICIENT_SECURITY                   0x2F
  
@@ -818,6 +849,7 @@ extern const hci_cmd_t btstack_get_system_bluetooth_enabled;
 extern const hci_cmd_t btstack_set_system_bluetooth_enabled;
 extern const hci_cmd_t btstack_set_discoverable;
 extern const hci_cmd_t btstack_set_bluetooth_enabled;    // only used by btstack config
+extern const hci_cmd_t btstack_get_hci_statistics;
     
 extern const hci_cmd_t hci_accept_connection_request;
 extern const hci_cmd_t hci_accept_synchronous_connection;
@@ -831,6 +863,7 @@ extern const hci_cmd_t hci_enhanced_setup_synchronous_connection;
 extern const hci_cmd_t hci_enhanced_accept_synchronous_connection;
 extern const hci_cmd_t hci_disconnect;
 extern const hci_cmd_t hci_host_buffer_size;
+extern const hci_cmd_t hci_host_number_of_completed_packets;
 extern const hci_cmd_t hci_inquiry;
 extern const hci_cmd_t hci_io_capability_request_reply;
 extern const hci_cmd_t hci_io_capability_request_negative_reply;
@@ -859,6 +892,7 @@ extern const hci_cmd_t hci_reset;
 extern const hci_cmd_t hci_role_discovery;
 extern const hci_cmd_t hci_set_event_mask;
 extern const hci_cmd_t hci_set_connection_encryption;
+extern const hci_cmd_t hci_set_controller_to_host_flow_control;
 extern const hci_cmd_t hci_setup_synchronous_connection;
 extern const hci_cmd_t hci_sniff_mode;
 extern const hci_cmd_t hci_switch_role_command;
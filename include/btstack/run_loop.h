@@ -61,13 +61,15 @@ extern "C" {
 typedef enum {
 	RUN_LOOP_POSIX = 1,
 	RUN_LOOP_COCOA,
-	RUN_LOOP_EMBEDDED
+	RUN_LOOP_EMBEDDED,
+	RUN_LOOP_EPOLL
 } RUN_LOOP_TYPE;
 
 typedef struct data_source {
     linked_item_t item;
     int  fd;                                 // <-- file descriptor to watch or 0
     int  (*process)(struct data_source *ds); // <-- do processing
+    int  write_enabled;                      // <-- also call process when fd is writable
 } data_source_t;
 
 typedef struct timer {
@@ -79,8 +81,54 @@ typedef struct timer {
     uint32_t timeout;                       // timeout in system ticks (HAVE_TICK) or millis (HAVE_TIME_MS)
 #endif
     void  (*process)(struct timer *ts);      // <-- do processing
+    int   heap_index;                        // <-- position in timer heap of run loop
+    uint32_t heap_seq;                       // <-- insertion order, timers with same timeout expire in order
 } timer_source_t;
 
+#ifdef ENABLE_RUN_LOOP_PROFILING
+// bucket 0: 0 us, bucket i: 2^(i-1) to 2^i - 1 us, last bucket: everything above
+#define RUN_LOOP_PROFILING_HISTOGRAM_BUCKETS 20
+
+typedef struct {
+    uint32_t count;
+    uint32_t sum_us;
+    uint32_t max_us;
+    uint32_t buckets[RUN_LOOP_PROFILING_HISTOGRAM_BUCKETS];
+} run_loop_histogram_t;
+
+// statistics for all data sources or timers with the same process function
+typedef struct {
+    void     (*handler)(void);              // <-- process function
+    int      is_timer;
+    uint32_t slow_count;                    // <-- executions that took longer than slow handler threshold
+    run_loop_histogram_t execution;         // <-- execution time of process function
+    run_loop_histogram_t lateness;          // <-- timers only: from timeout until process function is called
+} run_loop_handler_profile_t;
+#endif
+
+typedef struct run_loop_callback {
+    struct run_loop_callback * next;         // <-- used by run loop, must be first
+    void  (*callback)(void * context);       // <-- called on run loop thread
+    void  * context;
+} run_loop_callback_t;
+
+#ifdef USE_POSIX_RUN_LOOP
+typedef struct run_loop_posix_queue_item {
+    struct run_loop_posix_queue_item * next;
+} run_loop_posix_queue_item_t;
+
+// intrusive multi-producer single-consumer queue with wakeup file descriptor
+typedef struct run_loop_posix_queue {
+    data_source_t ds;                                // read end of wakeup fd
+    int  wakeup_fd;                                  // write end of wakeup fd
+    int  wakeup_pending;                             // set by producers, cleared by run loop
+    run_loop_posix_queue_item_t * head;              // last added item, updated by producers
+    run_loop_posix_queue_item_t * tail;              // next item to process, only used by run loop
+    run_loop_posix_queue_item_t   stub;
+    void (*process)(struct run_loop_posix_queue * queue, run_loop_posix_queue_item_t * item);
+} run_loop_posix_queue_t;
+#endif
+
 /* API_START */
 
 /**
@@ -94,19 +142,22 @@ void run_loop_set_timer(timer_source_t *a, uint32_t timeout_in_ms);
 void run_loop_set_timer_handler(timer_source_t *ts, void (*process)(timer_source_t *_ts));
 
 /**
- * @brief Add/Remove timer source.
+ * @brief Add/Remove timer source. Add returns 0 on success and -1 if the timer is already active or the timer heap is full.
  */
-void run_loop_add_timer(timer_source_t *timer); 
+int  run_loop_add_timer(timer_source_t *timer); 
 int  run_loop_remove_timer(timer_source_t *timer);
 
 /**
  * @brief Get current time in ms
  * @note 32-bit ms counter will overflow after approx. 52 days
+ * @note The POSIX run loop uses a monotonic clock and reads it once per iteration, i.e. the time
+ *       doesn't advance while handlers are executed. Timers are set relative to this time as well.
  */
 uint32_t run_loop_get_time_ms(void);
 
 /**
  * @brief Init must be called before any other run_loop call. Use RUN_LOOP_EMBEDDED for embedded devices.
+ *        On Linux, RUN_LOOP_EPOLL can be used instead of RUN_LOOP_POSIX if USE_EPOLL_RUN_LOOP is defined.
  */
 void run_loop_init(RUN_LOOP_TYPE type);
 
@@ -116,16 +167,28 @@ void run_loop_init(RUN_LOOP_TYPE type);
 void run_loop_set_data_source_handler(data_source_t *ds, int (*process)(data_source_t *_ds));
 
 /**
- * @brief Add/Remove data source.
+ * @brief Add/Remove data source. Add returns 0 on success and -1 if the run loop cannot watch the data source.
  */
-void run_loop_add_data_source(data_source_t *dataSource);
+int  run_loop_add_data_source(data_source_t *dataSource);
 int  run_loop_remove_data_source(data_source_t *dataSource);
 
+/**
+ * @brief Enable/Disable calling the data source handler when its fd is writable. Disabled when data source is added.
+ */
+void run_loop_enable_data_source_write(data_source_t *dataSource, int enabled);
+
 /**
  * @brief Execute configured run loop. This function does not return.
  */
 void run_loop_execute(void);
 
+/**
+ * @brief Execute callback with context on the run loop thread. Can be called from other threads
+ *        without locks, on embedded systems from interrupt handlers. Callbacks are executed in order.
+ * @note callback_registration must stay valid and must not be used again until the callback was called
+ */
+void run_loop_execute_on_main_thread(run_loop_callback_t * callback_registration);
+
 
 // hack to fix HCI timer handling
 #ifdef HAVE_TICK
@@ -152,6 +215,44 @@ void embedded_trigger(void);
  */
 void embedded_execute_once(void);
 #endif
+#ifdef ENABLE_RUN_LOOP_PROFILING
+/**
+ * @brief Set execution time of a data source or timer handler that is logged as error, default: 10 ms
+ */
+void run_loop_profiling_set_slow_handler_threshold_us(uint32_t threshold_us);
+/**
+ * @brief Get profiles of all handlers executed since start or last reset
+ * @param profiles set to array of profiles
+ * @returns number of profiles
+ */
+int  run_loop_profiling_get_handler_profiles(const run_loop_handler_profile_t ** profiles);
+/**
+ * @brief Reset all handler profiles
+ */
+void run_loop_profiling_reset(void);
+/**
+ * @brief Log all handler profiles
+ */
+void run_loop_profiling_dump(void);
+#endif
+#ifdef USE_POSIX_RUN_LOOP
+/**
+ * @brief Opens a lock-free queue that hands items from other threads over to the run loop thread.
+ *        Items are passed to the process callback on the run loop thread in the order they were added.
+ * @note Must be called on the run loop thread. Items embed a run_loop_posix_queue_item_t as first member.
+ * @returns 0 if ok, -1 if the wakeup file descriptor could not be created
+ */
+int  run_loop_posix_queue_open(run_loop_posix_queue_t * queue, void (*process)(run_loop_posix_queue_t * queue, run_loop_posix_queue_item_t * item));
+/**
+ * @brief Adds item to queue and wakes up the run loop. Can be called from any thread, does not block.
+ */
+void run_loop_posix_queue_add(run_loop_posix_queue_t * queue, run_loop_posix_queue_item_t * item);
+/**
+ * @brief Closes queue. Must be called on the run loop thread after all producer threads stopped adding items.
+ *        Items still in the queue are passed to the process callback before.
+ */
+void run_loop_posix_queue_close(run_loop_posix_queue_t * queue);
+#endif
 /* API_END */
 
 #if defined __cplusplus
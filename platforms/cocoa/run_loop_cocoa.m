@@ -53,6 +53,7 @@
 #include <stdlib.h>
 
 static struct timeval init_tv;
+static CFRunLoopRef     cocoa_run_loop;
 
 static void theCFRunLoopTimerCallBack (CFRunLoopTimerRef timer,void *info){
     timer_source_t * ts = (timer_source_t*)info;
@@ -71,9 +72,17 @@ static void socketDataCallback (
         // printf("cocoa_data_source %x - fd %u, CFSocket %x, CFRunLoopSource %x\n", (int) dataSource, dataSource->fd, (int) s, (int) dataSource->item.next);
         dataSource->process(dataSource);
     }
+    if (callbackType == kCFSocketWriteCallBack && info){
+        data_source_t *dataSource = (data_source_t *) info;
+        dataSource->process(dataSource);
+        // write callback is disabled after it fired, re-enable if still requested
+        if (dataSource->write_enabled){
+            CFSocketEnableCallBacks(s, kCFSocketWriteCallBack);
+        }
+    }
 }
 
-void cocoa_add_data_source(data_source_t *dataSource){
+int cocoa_add_data_source(data_source_t *dataSource){
 
 	// add fd as CFSocket
 	
@@ -86,13 +95,16 @@ void cocoa_add_data_source(data_source_t *dataSource){
 	CFSocketRef socket = CFSocketCreateWithNative (
 										  kCFAllocatorDefault,
 										  dataSource->fd,
-										  kCFSocketReadCallBack,
+										  kCFSocketReadCallBack | kCFSocketWriteCallBack,
 										  socketDataCallback,
 										  &socketContext
     );
     
     // don't close native fd on CFSocketInvalidate
     CFSocketSetSocketFlags(socket, CFSocketGetSocketFlags(socket) & ~kCFSocketCloseOnInvalidate);
+
+    // write callback only on request, see cocoa_enable_data_source_write
+    CFSocketDisableCallBacks(socket, kCFSocketWriteCallBack);
     
 	// create run loop source
 	CFRunLoopSourceRef socketRunLoop = CFSocketCreateRunLoopSource ( kCFAllocatorDefault, socket, 0);
@@ -104,7 +116,7 @@ void cocoa_add_data_source(data_source_t *dataSource){
     // add to run loop
 	CFRunLoopAddSource( CFRunLoopGetCurrent(), socketRunLoop, kCFRunLoopCommonModes);
     // printf("cocoa_add_data_source    %x - fd %u - CFSocket %x, CFRunLoopSource %x\n", (int) dataSource, dataSource->fd, (int) socket, (int) socketRunLoop);
-    
+    return 0;
 }
 
 int  cocoa_remove_data_source(data_source_t *dataSource){
@@ -116,7 +128,17 @@ int  cocoa_remove_data_source(data_source_t *dataSource){
 	return 0;
 }
 
-void  cocoa_add_timer(timer_source_t * ts)
+void cocoa_enable_data_source_write(data_source_t *dataSource, int enabled){
+    dataSource->write_enabled = enabled;
+    // CFSocketRef stored in "next" of linked_item_t
+    if (enabled){
+        CFSocketEnableCallBacks((CFSocketRef) dataSource->item.next, kCFSocketWriteCallBack);
+    } else {
+        CFSocketDisableCallBacks((CFSocketRef) dataSource->item.next, kCFSocketWriteCallBack);
+    }
+}
+
+int  cocoa_add_timer(timer_source_t * ts)
 {
     // note: ts uses unix time: seconds since Jan 1st 1970, CF uses Jan 1st 2001 as reference date
     // printf("kCFAbsoluteTimeIntervalSince1970 = %f\n", kCFAbsoluteTimeIntervalSince1970);
@@ -129,6 +151,7 @@ void  cocoa_add_timer(timer_source_t * ts)
     ts->item.next = (void *)timerRef;
     // printf("cocoa_add_timer %x -> %x now %f, then %f\n", (int) ts, (int) ts->item.next, CFAbsoluteTimeGetCurrent(),fireDate);
     CFRunLoopAddTimer(CFRunLoopGetCurrent(), timerRef, kCFRunLoopCommonModes);
+    return 0;
 }
 
 int  cocoa_remove_timer(timer_source_t * ts){
@@ -163,6 +186,14 @@ static uint32_t cocoa_get_time_ms(void){
 
 void cocoa_init(void){
     gettimeofday(&init_tv, NULL);
+    cocoa_run_loop = CFRunLoopGetCurrent();
+}
+
+static void cocoa_execute_on_main_thread(run_loop_callback_t * callback_registration){
+    CFRunLoopPerformBlock(cocoa_run_loop, kCFRunLoopCommonModes, ^{
+        callback_registration->callback(callback_registration->context);
+    });
+    CFRunLoopWakeUp(cocoa_run_loop);
 }
 
 void cocoa_execute(void)
@@ -185,5 +216,7 @@ run_loop_t run_loop_cocoa = {
     &cocoa_execute,
     &cocoa_dump_timer,
     &cocoa_get_time_ms,
+    &cocoa_enable_data_source_write,
+    &cocoa_execute_on_main_thread,
 };
 
@@ -751,6 +751,10 @@ static int btstack_command_handler(connection_t *connection, uint8_t *packet, ui
             log_info("BTSTACK_GET_VERSION");
             hci_emit_btstack_version();
             break;   
+        case BTSTACK_GET_HCI_STATISTICS:
+            log_info("BTSTACK_GET_HCI_STATISTICS handle 0x%04x", READ_BT_16(packet, 3));
+            hci_emit_hci_statistics(READ_BT_16(packet, 3));
+            break;
 #ifdef USE_BLUETOOL
         case BTSTACK_SET_SYSTEM_BLUETOOTH_ENABLED:
             log_info("BTSTACK_SET_SYSTEM_BLUETOOTH_ENABLED %u", packet[3]);
@@ -1774,7 +1778,11 @@ int main (int argc,  char * const * argv){
     remote_device_db = &REMOTE_DEVICE_DB;
 #endif
 
+#ifdef USE_EPOLL_RUN_LOOP
+    run_loop_init(RUN_LOOP_EPOLL);
+#else
     run_loop_init(RUN_LOOP_POSIX);
+#endif
     
     // init power management notifications
     if (control && control->register_for_power_notifications){
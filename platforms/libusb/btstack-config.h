@@ -18,6 +18,8 @@
 #define ENABLE_LOG_ERROR
 #define HCI_INCOMING_PRE_BUFFER_SIZE 14 // sizeof benep heade, avoid memcpy
 #define HCI_ACL_PAYLOAD_SIZE (1691 + 4)
+#define HCI_OUTGOING_ACL_BUFFERS 4
+#define ENABLE_HCI_ACL_LATENCY_HISTOGRAMS
 #define HAVE_HCI_DUMP
 #define SDP_DES_DUMP
 
@@ -96,6 +96,7 @@ int main(int argc, const char * argv[]){
     remote_device_db_t * remote_db = (remote_device_db_t *) &remote_device_db_fs;
         
 	hci_init(transport, config, control, remote_db);
+    hci_set_controller_info_db(&controller_info_db_fs);
     
     // handle CTRL-c
     signal(SIGINT, sigint_handler);
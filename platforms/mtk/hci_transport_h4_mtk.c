@@ -171,6 +171,7 @@ hci_transport_t * hci_transport_h4_instance(void){
         hci_transport_h4->transport.get_transport_name            = h4_get_transport_name;
         hci_transport_h4->transport.set_baudrate                  = NULL;
         hci_transport_h4->transport.can_send_packet_now           = NULL;
+        hci_transport_h4->transport.get_packet_receive_timestamp_us = NULL;
     }
     return (hci_transport_t *) hci_transport_h4;
 }
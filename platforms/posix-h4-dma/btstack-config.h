@@ -0,0 +1,23 @@
+// config.h for the embedded H4 DMA transports on POSIX
+
+#ifndef __BTSTACK_CONFIG
+#define __BTSTACK_CONFIG
+
+#define EMBEDDED
+#define HAVE_TICK
+#define HAVE_BLE
+#define HAVE_SDP
+#define HAVE_RFCOMM
+#define HAVE_MALLOC
+#define HAVE_BZERO
+#define SDP_DES_DUMP
+#define ENABLE_LOG_INFO 
+#define ENABLE_LOG_ERROR
+#define HCI_INCOMING_PRE_BUFFER_SIZE 14 // sizeof benep heade, avoid memcpy
+#define HCI_ACL_PAYLOAD_SIZE (1691 + 4)
+#define HCI_OUTGOING_ACL_BUFFERS 4
+#define ENABLE_HCI_ACL_LATENCY_HISTOGRAMS
+#define HAVE_HCI_DUMP
+#define HAL_TICK_PERIOD_MS 10
+
+#endif
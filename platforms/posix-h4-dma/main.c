@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+// *****************************************************************************
+//
+// minimal setup for HCI code using the embedded H4 DMA transport and run loop
+//
+// *****************************************************************************
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#include "btstack-config.h"
+
+#include <btstack/run_loop.h>
+
+#include "debug.h"
+#include "btstack_memory.h"
+#include "hci.h"
+#include "hci_dump.h"
+#include "hal_uart_dma_posix.h"
+
+#ifdef HAVE_EHCILL
+#include "bt_control_cc256x.h"
+#endif
+
+int btstack_main(int argc, const char * argv[]);
+
+static hci_uart_config_t hci_uart_config_h4_dma = {
+    NULL,
+    115200,
+#ifdef HAVE_EHCILL
+    1000000,
+#endif
+};
+
+static void sigint_handler(int param){
+    log_info(" <= SIGINT received, shutting down..\n");   
+    hci_power_control(HCI_POWER_OFF);
+    hci_close();
+    log_info("Good bye, see you.\n");    
+    exit(0);
+}
+
+static int led_state = 0;
+void hal_led_toggle(void){
+    led_state = 1 - led_state;
+    printf("LED State %u\n", led_state);
+}
+
+int main(int argc, const char * argv[]){
+
+	/// GET STARTED with BTstack ///
+	btstack_memory_init();
+    run_loop_init(RUN_LOOP_EMBEDDED);
+
+    // logging to stdout affects timing, only use on request
+    if (getenv("BTSTACK_UART_DUMP")){
+        hci_dump_open(NULL, HCI_DUMP_STDOUT);
+    }
+
+    // pick serial port or pty
+    const char * device_name = getenv("BTSTACK_UART");
+    if (!device_name){
+        device_name = "/dev/ttyUSB0";
+    }
+    hal_uart_dma_posix_set_device(device_name);
+    printf("H4 DMA on %s\n", device_name);
+
+    // init HCI
+	hci_transport_t    * transport = hci_transport_h4_dma_instance();
+    remote_device_db_t * remote_db = (remote_device_db_t *) &remote_device_db_memory;
+#ifdef HAVE_EHCILL
+	bt_control_t       * control   = bt_control_cc256x_instance();
+    bt_control_cc256x_enable_ehcill(1);
+#else
+	bt_control_t       * control   = NULL;
+#endif
+        
+	hci_init(transport, (void*) &hci_uart_config_h4_dma, control, remote_db);
+    
+    // handle CTRL-c
+    signal(SIGINT, sigint_handler);
+
+    // setup app
+    btstack_main(argc, argv);
+
+    // go
+    run_loop_execute();    
+
+    return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+// *****************************************************************************
+//
+// minimal setup for HCI code with a virtual controller
+//
+// Start two examples in separate processes, their virtual controllers connect
+// via a UNIX socket. Configuration via environment variables:
+//
+// BTSTACK_VIRTUAL_PEER     socket path shared by both processes
+// BTSTACK_VIRTUAL_ADDR     public address, default derived from process id
+// BTSTACK_VIRTUAL_LATENCY  delay of ACL packets in ms
+// BTSTACK_VIRTUAL_LOSS     retransmissions per 1000 ACL packets
+// BTSTACK_VIRTUAL_ACL      ACL buffers as <size>:<count>, e.g. 1021:8
+// BTSTACK_VIRTUAL_LE_ACL   LE ACL buffers as <size>:<count>, e.g. 27:8
+// BTSTACK_VIRTUAL_DUMP     path for packet log
+//
+// *****************************************************************************
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "btstack-config.h"
+
+#include <btstack/run_loop.h>
+
+#include "debug.h"
+#include "btstack_memory.h"
+#include "hci.h"
+#include "hci_dump.h"
+#include "remote_device_db.h"
+#include "stdin_support.h"
+
+int btstack_main(int argc, const char * argv[]);
+
+static hci_transport_virtual_config_t hci_transport_virtual_config = {
+    "/tmp/btstack_virtual",
+};
+
+static void sigint_handler(int param){
+
+    // reset anyway
+    btstack_stdin_reset();
+
+    log_info(" <= SIGINT received, shutting down..\n");   
+    hci_power_control(HCI_POWER_OFF);
+    hci_close();
+    log_info("Good bye, see you.\n");    
+    exit(0);
+}
+
+static int led_state = 0;
+void hal_led_toggle(void){
+    led_state = 1 - led_state;
+    printf("LED State %u\n", led_state);
+}
+
+static void config_buffers(const char * value, uint16_t * size, uint16_t * count){
+    if (!value) return;
+    unsigned int buffer_size, buffer_count;
+    if (sscanf(value, "%u:%u", &buffer_size, &buffer_count) != 2) return;
+    *size  = buffer_size;
+    *count = buffer_count;
+}
+
+static void config_from_environment(hci_transport_virtual_config_t * config){
+    const char * value;
+    value = getenv("BTSTACK_VIRTUAL_PEER");
+    if (value){
+        config->peer_path = value;
+    }
+    value = getenv("BTSTACK_VIRTUAL_ADDR");
+    if (!value || !sscan_bd_addr((uint8_t *) value, config->bd_addr)){
+        // locally administered address
+        uint32_t pid = getpid();
+        bd_addr_t addr = { 0x02, 0x00, pid >> 24, pid >> 16, pid >> 8, pid };
+        BD_ADDR_COPY(config->bd_addr, addr);
+    }
+    value = getenv("BTSTACK_VIRTUAL_LATENCY");
+    if (value){
+        config->latency_ms = atoi(value);
+    }
+    value = getenv("BTSTACK_VIRTUAL_LOSS");
+    if (value){
+        config->loss_per_mille = atoi(value);
+    }
+    config_buffers(getenv("BTSTACK_VIRTUAL_ACL"), &config->acl_data_packet_length, &config->acl_packets_total_num);
+    uint16_t le_packets_total_num = 0;
+    config_buffers(getenv("BTSTACK_VIRTUAL_LE_ACL"), &config->le_data_packets_length, &le_packets_total_num);
+    config->le_acl_packets_total_num = le_packets_total_num;
+}
+
+int main(int argc, const char * argv[]){
+
+	/// GET STARTED with BTstack ///
+	btstack_memory_init();
+#ifdef USE_EPOLL_RUN_LOOP
+    run_loop_init(RUN_LOOP_EPOLL);
+#else
+    run_loop_init(RUN_LOOP_POSIX);
+#endif
+	    
+    // packet log slows down throughput tests, only use on request
+    const char * dump_path = getenv("BTSTACK_VIRTUAL_DUMP");
+    if (dump_path){
+        hci_dump_open(dump_path, HCI_DUMP_PACKETLOGGER);
+    }
+
+    config_from_environment(&hci_transport_virtual_config);
+    printf("Virtual controller %s, peer socket %s\n",
+        bd_addr_to_str(hci_transport_virtual_config.bd_addr), hci_transport_virtual_config.peer_path);
+
+    // init HCI
+	hci_transport_t    * transport = hci_transport_virtual_instance();
+    remote_device_db_t * remote_db = (remote_device_db_t *) &remote_device_db_memory;
+        
+	hci_init(transport, (void*) &hci_transport_virtual_config, NULL, remote_db);
+    
+    // handle CTRL-c
+    signal(SIGINT, sigint_handler);
+
+    // setup app
+    btstack_main(argc, argv);
+
+    // go
+    run_loop_execute();    
+
+    return 0;
+}
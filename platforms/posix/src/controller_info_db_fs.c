@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "controller_info_db.h"
+#include "debug.h"
+
+#define CONTROLLER_INFO_PATH "/tmp/btstack_controller_info.bin"
+
+static int get_controller_info(controller_info_t * controller_info){
+    if (access(CONTROLLER_INFO_PATH, R_OK)) return 0;
+
+    FILE * rFile = fopen(CONTROLLER_INFO_PATH, "r");
+    if (!rFile) return 0;
+    size_t objects_read = fread(controller_info, sizeof(controller_info_t), 1, rFile);
+    // file written by a different BTstack version
+    int trailing_data = fgetc(rFile) != EOF;
+    fclose(rFile);
+
+    if (objects_read != 1 || trailing_data) {
+        log_info("Ignoring invalid %s", CONTROLLER_INFO_PATH);
+        return 0;
+    }
+    return 1;
+}
+
+static void put_controller_info(controller_info_t * controller_info){
+    FILE * wFile = fopen(CONTROLLER_INFO_PATH, "w+");
+    if (!wFile) {
+        log_error("File %s could not be created.", CONTROLLER_INFO_PATH);
+        return;
+    }
+    fwrite(controller_info, sizeof(controller_info_t), 1, wFile);
+    fclose(wFile);
+}
+
+static void delete_controller_info(void){
+    if (access(CONTROLLER_INFO_PATH, R_OK)) return;
+
+    if(remove(CONTROLLER_INFO_PATH) != 0){
+        log_error("File %s could not be deleted.", CONTROLLER_INFO_PATH);
+    }
+}
+
+const controller_info_db_t controller_info_db_fs = {
+    get_controller_info,
+    put_controller_info,
+    delete_controller_info
+};
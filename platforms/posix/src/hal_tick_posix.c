@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  hal_tick_posix.c
+ *
+ *  hal_tick implementation based on CLOCK_MONOTONIC, tick handler is called from hal_cpu_posix.c
+ */
+
+#include "btstack-config.h"
+
+#include <stddef.h>
+#include <time.h>
+
+#include <btstack/hal_tick.h>
+
+#include "hal_uart_dma_posix.h"
+
+// tick period, can be defined in config.h
+#ifndef HAL_TICK_PERIOD_MS
+#define HAL_TICK_PERIOD_MS 10
+#endif
+
+static void dummy_handler(void){};
+
+static void (*tick_handler)(void) = &dummy_handler;
+
+static uint32_t next_tick_ms;
+
+// monotonic, not affected by changes of the wall clock
+static uint32_t hal_tick_posix_get_time_ms(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t) (now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+void hal_tick_init(void){
+    next_tick_ms = hal_tick_posix_get_time_ms() + HAL_TICK_PERIOD_MS;
+}
+
+void hal_tick_set_handler(void (*handler)(void)){
+    if (handler == NULL){
+        tick_handler = &dummy_handler;
+        return;
+    }
+    tick_handler = handler;
+}
+
+int  hal_tick_get_tick_period_in_ms(void){
+    return HAL_TICK_PERIOD_MS;
+}
+
+uint32_t hal_tick_posix_get_ms_to_next_tick(void){
+    int32_t delta = (int32_t) (next_tick_ms - hal_tick_posix_get_time_ms());
+    if (delta < 0) return 0;
+    return (uint32_t) delta;
+}
+
+void hal_tick_posix_process(void){
+    uint32_t now = hal_tick_posix_get_time_ms();
+    while ((int32_t) (now - next_tick_ms) >= 0){
+        next_tick_ms += HAL_TICK_PERIOD_MS;
+        (*tick_handler)();
+    }
+}
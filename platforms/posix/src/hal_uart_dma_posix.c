@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  hal_uart_dma_posix.c
+ *
+ *  hal_uart_dma implementation for a serial port, pty or socketpair
+ *
+ *  Blocks are transferred with non-blocking reads and writes when the run loop
+ *  enables IRQs or goes to sleep (see hal_cpu_posix.c), and the block handlers are
+ *  called from there, like the UART ISR of an embedded port would. While no receive
+ *  block is requested, data stays in the kernel buffer, which corresponds to RTS high.
+ *  If data arrives in this situation, e.g. while eHCILL deferred the receive request
+ *  during sleep, the CTS IRQ handler gets called once.
+ */
+
+#include "btstack-config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/select.h>
+
+#include <btstack/hal_uart_dma.h>
+
+#include "debug.h"
+#include "hal_uart_dma_posix.h"
+
+static void dummy_handler(void){};
+
+static const char * uart_device_name;
+static int uart_fd = -1;
+
+// rx state
+static uint8_t * rx_buffer_ptr;
+static uint16_t  bytes_to_read;
+static int       rx_active;
+
+// tx state
+static const uint8_t * tx_buffer_ptr;
+static uint16_t  bytes_to_write;
+static int       tx_active;
+
+// cts irq raised since last receive request
+static int       cts_irq_signalled;
+
+// handlers
+static void (*rx_done_handler)(void) = dummy_handler;
+static void (*tx_done_handler)(void) = dummy_handler;
+static void (*cts_irq_handler)(void) = dummy_handler;
+static int  cts_irq_enabled;
+
+void hal_uart_dma_posix_set_device(const char * device_name){
+    uart_device_name = device_name;
+}
+
+void hal_uart_dma_posix_set_fd(int fd){
+    uart_fd = fd;
+}
+
+void hal_uart_dma_init(void){
+
+    rx_active = 0;
+    tx_active = 0;
+    cts_irq_signalled = 0;
+
+    if (uart_fd < 0){
+        if (!uart_device_name){
+            log_error("hal_uart_dma_init: no device set");
+            return;
+        }
+        uart_fd = open(uart_device_name, O_RDWR | O_NOCTTY);
+        if (uart_fd < 0){
+            log_error("hal_uart_dma_init: cannot open %s, errno %d", uart_device_name, errno);
+            return;
+        }
+    }
+
+    fcntl(uart_fd, F_SETFL, fcntl(uart_fd, F_GETFL, 0) | O_NONBLOCK);
+
+    // socketpair: no line settings
+    if (!isatty(uart_fd)) return;
+
+    struct termios toptions;
+    if (tcgetattr(uart_fd, &toptions) < 0) {
+        log_error("hal_uart_dma_init: couldn't get term attributes");
+        return;
+    }
+
+    cfmakeraw(&toptions);   // make raw
+
+    // 8N1 with RTS/CTS flow control
+    toptions.c_cflag &= ~CSTOPB;
+    toptions.c_cflag |= CS8;
+    toptions.c_cflag |= CRTSCTS;
+    toptions.c_cflag |= CREAD | CLOCAL;  // turn on READ & ignore ctrl lines
+    toptions.c_iflag &= ~(IXON | IXOFF | IXANY); // turn off s/w flow ctrl
+
+    if (tcsetattr(uart_fd, TCSANOW, &toptions) < 0) {
+        log_error("hal_uart_dma_init: couldn't set term attributes");
+        return;
+    }
+
+    hal_uart_dma_set_baud(115200);
+}
+
+int hal_uart_dma_set_baud(uint32_t baud){
+
+    if (uart_fd < 0) return -1;
+    if (!isatty(uart_fd)) return 0;
+
+    speed_t brate;
+    switch (baud){
+        case 57600:   brate = B57600;   break;
+        case 115200:  brate = B115200;  break;
+#ifdef B230400
+        case 230400:  brate = B230400;  break;
+#endif
+#ifdef B460800
+        case 460800:  brate = B460800;  break;
+#endif
+#ifdef B921600
+        case 921600:  brate = B921600;  break;
+#endif
+#ifdef B1000000
+        case 1000000: brate = B1000000; break;
+#endif
+#ifdef B2000000
+        case 2000000: brate = B2000000; break;
+#endif
+#ifdef B3000000
+        case 3000000: brate = B3000000; break;
+#endif
+        default:
+            log_error("hal_uart_dma_set_baud: %u not supported", (unsigned int) baud);
+            return -1;
+    }
+
+    struct termios toptions;
+    if (tcgetattr(uart_fd, &toptions) < 0) return -1;
+    cfsetospeed(&toptions, brate);
+    cfsetispeed(&toptions, brate);
+    if (tcsetattr(uart_fd, TCSANOW, &toptions) < 0) return -1;
+    return 0;
+}
+
+void hal_uart_dma_set_block_received( void (*the_block_handler)(void)){
+    rx_done_handler = the_block_handler;
+}
+
+void hal_uart_dma_set_block_sent( void (*the_block_handler)(void)){
+    tx_done_handler = the_block_handler;
+}
+
+void hal_uart_dma_set_csr_irq_handler( void (*the_irq_handler)(void)){
+    if (the_irq_handler){
+        cts_irq_handler = the_irq_handler;
+        cts_irq_enabled = 1;
+        return;
+    }
+    cts_irq_handler = dummy_handler;
+    cts_irq_enabled = 0;
+}
+
+void hal_uart_dma_send_block(const uint8_t * data, uint16_t len){
+    tx_buffer_ptr = data;
+    bytes_to_write = len;
+    tx_active = 1;
+}
+
+void hal_uart_dma_receive_block(uint8_t *buffer, uint16_t len){
+    rx_buffer_ptr = buffer;
+    bytes_to_read = len;
+    rx_active = 1;
+    cts_irq_signalled = 0;
+}
+
+void hal_uart_dma_set_sleep(uint8_t sleep){
+    // UART keeps running, CTS IRQ is emulated also while awake
+}
+
+static void hal_uart_dma_posix_close(void){
+    close(uart_fd);
+    uart_fd = -1;
+    rx_active = 0;
+    tx_active = 0;
+}
+
+void hal_uart_dma_posix_process(uint32_t timeout_ms){
+    struct timeval timeout;
+
+    if (uart_fd < 0){
+        // just sleep
+        timeout.tv_sec  = timeout_ms / 1000;
+        timeout.tv_usec = (timeout_ms % 1000) * 1000;
+        select(0, NULL, NULL, NULL, &timeout);
+        return;
+    }
+
+    while (uart_fd >= 0){
+
+        int cts_irq_armed = cts_irq_enabled && !rx_active && !cts_irq_signalled;
+
+        fd_set read_fds;
+        fd_set write_fds;
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        if (rx_active || cts_irq_armed){
+            FD_SET(uart_fd, &read_fds);
+        }
+        if (tx_active){
+            FD_SET(uart_fd, &write_fds);
+        }
+
+        timeout.tv_sec  = timeout_ms / 1000;
+        timeout.tv_usec = (timeout_ms % 1000) * 1000;
+        int res = select(uart_fd + 1, &read_fds, &write_fds, NULL, &timeout);
+        if (res <= 0) return;
+
+        // handle transfers that are ready right away from now on
+        timeout_ms = 0;
+
+        if (FD_ISSET(uart_fd, &write_fds)){
+            ssize_t bytes_written = write(uart_fd, tx_buffer_ptr, bytes_to_write);
+            if (bytes_written < 0 && errno != EAGAIN && errno != EINTR){
+                log_error("hal_uart_dma_posix_process: write failed, errno %d", errno);
+                hal_uart_dma_posix_close();
+                return;
+            }
+            if (bytes_written > 0){
+                tx_buffer_ptr  += bytes_written;
+                bytes_to_write -= bytes_written;
+            }
+            if (bytes_to_write == 0){
+                tx_active = 0;
+                (*tx_done_handler)();
+            }
+        }
+
+        if (!FD_ISSET(uart_fd, &read_fds)) continue;
+
+        if (!rx_active){
+            // data available but no receive block: raise CTS IRQ once
+            if (!cts_irq_armed) continue;
+            cts_irq_signalled = 1;
+            (*cts_irq_handler)();
+            continue;
+        }
+
+        ssize_t bytes_read = read(uart_fd, rx_buffer_ptr, bytes_to_read);
+        if (bytes_read == 0 || (bytes_read < 0 && errno != EAGAIN && errno != EINTR)){
+            log_error("hal_uart_dma_posix_process: read failed, errno %d", bytes_read ? errno : 0);
+            hal_uart_dma_posix_close();
+            return;
+        }
+        if (bytes_read < 0) continue;
+        rx_buffer_ptr += bytes_read;
+        bytes_to_read -= bytes_read;
+        if (bytes_to_read) continue;
+        rx_active = 0;
+        (*rx_done_handler)();
+    }
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  hal_uart_dma_posix.h
+ *
+ *  POSIX emulation of the hal_uart_dma, hal_tick and hal_cpu interfaces, which
+ *  allows to run the embedded H4 DMA transports with run_loop_embedded
+ */
+
+#ifndef __HAL_UART_DMA_POSIX_H
+#define __HAL_UART_DMA_POSIX_H
+
+#include <stdint.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Use serial port or pty, opened by hal_uart_dma_init
+ */
+void hal_uart_dma_posix_set_device(const char * device_name);
+
+/**
+ * @brief Use already open file descriptor, e.g. one end of a socketpair or a pty master
+ */
+void hal_uart_dma_posix_set_fd(int fd);
+
+/**
+ * @brief Transfer data and call block received/sent and CTS handlers like the UART ISR would
+ * @param timeout_ms to wait for first transfer, 0 = only handle transfers that complete right away
+ */
+void hal_uart_dma_posix_process(uint32_t timeout_ms);
+
+/**
+ * @brief Call tick handler for all tick periods elapsed since last call
+ */
+void hal_tick_posix_process(void);
+
+/**
+ * @brief Get time until next tick
+ */
+uint32_t hal_tick_posix_get_ms_to_next_tick(void);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif // __HAL_UART_DMA_POSIX_H
@@ -52,10 +52,15 @@
 // SCO Data     0 0 0x03 Isochronous (Out)
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <strings.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>   /* UNIX standard function definitions */
 #include <sys/types.h>
+#ifndef _WIN32
+#include <poll.h>     /* POLLOUT */
+#endif
 
 #include <libusb.h>
 
@@ -103,15 +108,32 @@ static libusb_device        * dev;
 #endif
 static libusb_device_handle * handle;
 
-#define ASYNC_BUFFERS 2
+// number of concurrent transfers for each incoming endpoint, can be defined in config.h
+#ifndef HCI_TRANSPORT_USB_IN_TRANSFERS
+#define HCI_TRANSPORT_USB_IN_TRANSFERS 4
+#endif
+
+// number of concurrent transfers for ACL and SCO out, can be defined in config.h
+#ifndef HCI_TRANSPORT_USB_OUT_TRANSFERS
+#define HCI_TRANSPORT_USB_OUT_TRANSFERS 4
+#endif
+
 #define AYSNC_POLLING_INTERVAL_MS 1
 #define NUM_ISO_PACKETS 4
 #define SCO_PACKET_SIZE 49
 
+static int num_in_transfers  = HCI_TRANSPORT_USB_IN_TRANSFERS;
+static int num_out_transfers = HCI_TRANSPORT_USB_OUT_TRANSFERS;
+
 static struct libusb_transfer *command_out_transfer;
-static struct libusb_transfer *acl_out_transfer;
-static struct libusb_transfer *event_in_transfer[ASYNC_BUFFERS];
-static struct libusb_transfer *acl_in_transfer[ASYNC_BUFFERS];
+static struct libusb_transfer **event_in_transfer;
+static struct libusb_transfer **acl_in_transfer;
+
+// outgoing ACL packets are copied into the buffer of a free transfer
+static struct libusb_transfer **acl_out_transfer;
+static struct libusb_transfer **acl_out_transfer_free;
+static int acl_out_transfers_free;
+static uint8_t * hci_acl_out_buffer;    // num_out_transfers * HCI_ACL_BUFFER_SIZE
 
 static H2_SCO_STATE sco_state;
 static uint8_t  sco_buffer[255+3 + SCO_PACKET_SIZE];
@@ -119,26 +141,31 @@ static uint16_t sco_read_pos;
 static uint16_t sco_bytes_to_read;
 
 #ifdef HAVE_SCO
-static struct  libusb_transfer *sco_out_transfer;
-static struct  libusb_transfer *sco_in_transfer[ASYNC_BUFFERS];
-static uint8_t hci_sco_in_buffer[ASYNC_BUFFERS][NUM_ISO_PACKETS * SCO_PACKET_SIZE]; 
+static struct  libusb_transfer **sco_out_transfer;
+static struct  libusb_transfer **sco_out_transfer_free;
+static int     sco_out_transfers_free;
+static uint8_t * hci_sco_out_buffer;    // num_out_transfers * (255 + 3)
+static struct  libusb_transfer **sco_in_transfer;
+static uint8_t * hci_sco_in_buffer;     // num_in_transfers * NUM_ISO_PACKETS * SCO_PACKET_SIZE
 #endif
 
 static uint8_t hci_cmd_buffer[3 + 256 + LIBUSB_CONTROL_SETUP_SIZE];
-static uint8_t hci_event_in_buffer[ASYNC_BUFFERS][HCI_ACL_BUFFER_SIZE]; // bigger than largest packet
-static uint8_t hci_acl_in_buffer[ASYNC_BUFFERS][HCI_INCOMING_PRE_BUFFER_SIZE + HCI_ACL_BUFFER_SIZE]; 
+static uint8_t * hci_event_in_buffer;   // num_in_transfers * HCI_ACL_BUFFER_SIZE, bigger than largest packet
+static uint8_t * hci_acl_in_buffer;     // num_in_transfers * (HCI_INCOMING_PRE_BUFFER_SIZE + HCI_ACL_BUFFER_SIZE)
 
-// For (ab)use as a linked list of received packets
+// For (ab)use as a linked list of received packets, new transfers are appended at tail
 static struct libusb_transfer *handle_packet;
+static struct libusb_transfer *handle_packet_tail;
+
+// time transfers were reaped from libusb, used for all packets handled afterwards
+static uint32_t usb_receive_timestamp_us;
 
 static int doing_pollfds;
 static int num_pollfds;
-static data_source_t * pollfd_data_sources;
+static data_source_t ** pollfd_data_sources;
 static timer_source_t usb_timer;
 static int usb_timer_active;
 
-static int usb_acl_out_active = 0;
-static int usb_sco_out_active = 0;
 static int usb_command_active = 0;
 
 // endpoint addresses
@@ -149,6 +176,16 @@ static int sco_in_addr;
 static int sco_out_addr;
 
 
+static uint32_t usb_get_time_us(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t) (now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
+
+static uint32_t usb_get_packet_receive_timestamp_us(void){
+    return usb_receive_timestamp_us;
+}
+
 static void queue_transfer(struct libusb_transfer *transfer){
 
     // log_info("queue_transfer %p, endpoint %x size %u", transfer, transfer->endpoint, transfer->actual_length);
@@ -158,15 +195,10 @@ static void queue_transfer(struct libusb_transfer *transfer){
     // insert first element
     if (handle_packet == NULL) {
         handle_packet = transfer;
-        return;
-    }
-
-    // Walk to end of list and add current packet there
-    struct libusb_transfer *temp = handle_packet;
-    while (temp->user_data) {
-        temp = (struct libusb_transfer*)temp->user_data;
+    } else {
+        handle_packet_tail->user_data = transfer;
     }
-    temp->user_data = transfer;
+    handle_packet_tail = transfer;
 }
 
 static void async_callback(struct libusb_transfer *transfer)
@@ -268,13 +300,15 @@ static void handle_completed_transfer(struct libusb_transfer *transfer){
         signal_done = 1;
     } else if (transfer->endpoint == acl_out_addr){
         // log_info("acl out done, size %u", transfer->actual_length);
-        usb_acl_out_active = 0;
+        acl_out_transfer_free[acl_out_transfers_free++] = transfer;
         signal_done = 1;
+#ifdef HAVE_SCO
     } else if (transfer->endpoint == sco_out_addr){
         log_info("sco out done, size %u/%u - status %x", transfer->actual_length, 
             transfer->iso_packet_desc[0].actual_length, transfer->iso_packet_desc[0].status);
-        usb_sco_out_active = 0;
+        sco_out_transfer_free[sco_out_transfers_free++] = transfer;
         signal_done = 1;
+#endif
     } else {
         log_info("usb_process_ds endpoint unknown %x", transfer->endpoint);
     }
@@ -297,6 +331,31 @@ static void handle_completed_transfer(struct libusb_transfer *transfer){
     }   
 }
 
+static void usb_process_ts(timer_source_t *timer);
+
+// with pollfds, the timer is only used for libusb timeouts, if libusb cannot handle them itself
+static void usb_update_timer(void){
+    if(usb_timer_active) {
+        run_loop_remove_timer(&usb_timer);
+        usb_timer_active = 0;
+    }
+
+    // Get the amount of time until next event is due
+    long msec = AYSNC_POLLING_INTERVAL_MS;
+    if (doing_pollfds){
+        if (libusb_pollfds_handle_timeouts(NULL)) return;
+        struct timeval tv;
+        if (libusb_get_next_timeout(NULL, &tv) != 1) return;
+        msec = tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
+    }
+
+    // Activate timer
+    usb_timer.process = usb_process_ts;
+    run_loop_set_timer(&usb_timer, msec);
+    run_loop_add_timer(&usb_timer);
+    usb_timer_active = 1;
+}
+
 static int usb_process_ds(struct data_source *ds) {
     if (libusb_state != LIB_USB_TRANSFERS_ALLOCATED) return -1;
 
@@ -305,23 +364,25 @@ static int usb_process_ds(struct data_source *ds) {
     struct timeval tv;
     memset(&tv, 0, sizeof(struct timeval));
     libusb_handle_events_timeout(NULL, &tv);
+    if (handle_packet){
+        usb_receive_timestamp_us = usb_get_time_us();
+    }
 
     // Handle any packet in the order that they were received
     while (handle_packet) {
         // log_info("handle packet %p, endpoint %x, status %x", handle_packet, handle_packet->endpoint, handle_packet->status);
-        void * next = handle_packet->user_data;
-        handle_completed_transfer(handle_packet);
+        struct libusb_transfer * transfer = handle_packet;
+        handle_packet = (struct libusb_transfer*) transfer->user_data;
+        handle_completed_transfer(transfer);
         // handle case where libusb_close might be called by hci packet handler        
         if (libusb_state != LIB_USB_TRANSFERS_ALLOCATED) return -1;
-
-        // Move to next in the list of packets to handle
-        if (next) {
-            handle_packet = (struct libusb_transfer*)next;
-        } else {
-            handle_packet = NULL;
-        }
     }
     // log_info("end usb_process_ds");
+
+    // submitted transfers might have changed next timeout
+    if (doing_pollfds){
+        usb_update_timer();
+    }
     return 0;
 }
 
@@ -336,15 +397,47 @@ static void usb_process_ts(timer_source_t *timer) {
     // actually handled the packet in the pollfds function
     usb_process_ds((struct data_source *) NULL);
 
-    // Get the amount of time until next event is due
-    long msec = AYSNC_POLLING_INTERVAL_MS;
+    // keep polling without pollfds
+    if (!doing_pollfds){
+        usb_update_timer();
+    }
+}
 
-    // Activate timer
-    run_loop_set_timer(&usb_timer, msec);
-    run_loop_add_timer(&usb_timer);
-    usb_timer_active = 1;
+static void usb_pollfd_added(int fd, short events, void * user_data){
+    data_source_t ** data_sources = realloc(pollfd_data_sources, sizeof(data_source_t *) * (num_pollfds + 1));
+    data_source_t * ds = malloc(sizeof(data_source_t));
+    if (data_sources) {
+        pollfd_data_sources = data_sources;
+    }
+    if (!data_sources || !ds){
+        log_error("Cannot allocate data source for pollfd %u", fd);
+        free(ds);
+        return;
+    }
+    ds->fd = fd;
+    ds->process = usb_process_ds;
+    run_loop_add_data_source(ds);
+#ifdef POLLOUT
+    // e.g. Linux usbfs signals completed transfers with POLLOUT
+    if (events & POLLOUT){
+        run_loop_enable_data_source_write(ds, 1);
+    }
+#endif
+    pollfd_data_sources[num_pollfds++] = ds;
+    log_info("pollfd added: fd %u, events %x", fd, events);
+}
 
-    return;
+static void usb_pollfd_removed(int fd, void * user_data){
+    int i;
+    for (i = 0 ; i < num_pollfds ; i++) {
+        data_source_t * ds = pollfd_data_sources[i];
+        if (ds->fd != fd) continue;
+        run_loop_remove_data_source(ds);
+        free(ds);
+        pollfd_data_sources[i] = pollfd_data_sources[--num_pollfds];
+        log_info("pollfd removed: fd %u", fd);
+        return;
+    }
 }
 
 #ifndef HAVE_USB_VENDOR_ID_AND_PRODUCT_ID
@@ -538,11 +631,107 @@ static int prepare_device(libusb_device_handle * aHandle){
     return 0;
 }
 
+static void usb_free_transfer_array(struct libusb_transfer *** transfers, int num_transfers){
+    if (!*transfers) return;
+    int c;
+    for (c = 0 ; c < num_transfers ; c++) {
+        if ((*transfers)[c]) libusb_free_transfer((*transfers)[c]);
+    }
+    free(*transfers);
+    *transfers = NULL;
+}
+
+static void usb_free_buffer(void * buffer){
+    void ** ptr = (void **) buffer;
+    free(*ptr);
+    *ptr = NULL;
+}
+
+static void usb_free_transfers(void){
+    usb_free_transfer_array(&event_in_transfer, num_in_transfers);
+    usb_free_transfer_array(&acl_in_transfer,   num_in_transfers);
+    usb_free_transfer_array(&acl_out_transfer,  num_out_transfers);
+    usb_free_buffer(&acl_out_transfer_free);
+    usb_free_buffer(&hci_event_in_buffer);
+    usb_free_buffer(&hci_acl_in_buffer);
+    usb_free_buffer(&hci_acl_out_buffer);
+#ifdef HAVE_SCO
+    usb_free_transfer_array(&sco_in_transfer,  num_in_transfers);
+    usb_free_transfer_array(&sco_out_transfer, num_out_transfers);
+    usb_free_buffer(&sco_out_transfer_free);
+    usb_free_buffer(&hci_sco_in_buffer);
+    usb_free_buffer(&hci_sco_out_buffer);
+#endif
+    if (command_out_transfer) {
+        libusb_free_transfer(command_out_transfer);
+        command_out_transfer = NULL;
+    }
+}
+
+static struct libusb_transfer ** usb_alloc_transfer_array(int num_transfers, int iso_packets){
+    struct libusb_transfer ** transfers = calloc(num_transfers, sizeof(struct libusb_transfer *));
+    if (!transfers) return NULL;
+    int c;
+    for (c = 0 ; c < num_transfers ; c++) {
+        transfers[c] = libusb_alloc_transfer(iso_packets);
+        if (!transfers[c]) {
+            usb_free_transfer_array(&transfers, num_transfers);
+            return NULL;
+        }
+    }
+    return transfers;
+}
+
+// returns 0 on success
+static int usb_alloc_transfers(void){
+    int c;
+    event_in_transfer   = usb_alloc_transfer_array(num_in_transfers, 0);  // 0 isochronous transfers Events
+    acl_in_transfer     = usb_alloc_transfer_array(num_in_transfers, 0);  // 0 isochronous transfers ACL in
+    acl_out_transfer    = usb_alloc_transfer_array(num_out_transfers, 0);
+    acl_out_transfer_free = calloc(num_out_transfers, sizeof(struct libusb_transfer *));
+    hci_event_in_buffer = malloc(num_in_transfers  * HCI_ACL_BUFFER_SIZE);
+    hci_acl_in_buffer   = malloc(num_in_transfers  * (HCI_INCOMING_PRE_BUFFER_SIZE + HCI_ACL_BUFFER_SIZE));
+    hci_acl_out_buffer  = malloc(num_out_transfers * HCI_ACL_BUFFER_SIZE);
+    command_out_transfer = libusb_alloc_transfer(0);
+    if (!event_in_transfer || !acl_in_transfer || !acl_out_transfer || !acl_out_transfer_free
+    ||  !hci_event_in_buffer || !hci_acl_in_buffer || !hci_acl_out_buffer || !command_out_transfer) {
+        usb_free_transfers();
+        return -1;
+    }
+
+    // all out transfers are free, each one with its own buffer
+    for (c = 0 ; c < num_out_transfers ; c++) {
+        libusb_fill_bulk_transfer(acl_out_transfer[c], handle, acl_out_addr, &hci_acl_out_buffer[c * HCI_ACL_BUFFER_SIZE], 0,
+            async_callback, NULL, 0);
+        acl_out_transfer_free[c] = acl_out_transfer[c];
+    }
+    acl_out_transfers_free = num_out_transfers;
+
+#ifdef HAVE_SCO
+    sco_in_transfer     = usb_alloc_transfer_array(num_in_transfers, NUM_ISO_PACKETS); // isochronous transfers SCO in
+    sco_out_transfer    = usb_alloc_transfer_array(num_out_transfers, 1);              // 1 isochronous transfers SCO out
+    sco_out_transfer_free = calloc(num_out_transfers, sizeof(struct libusb_transfer *));
+    hci_sco_in_buffer   = malloc(num_in_transfers  * NUM_ISO_PACKETS * SCO_PACKET_SIZE);
+    hci_sco_out_buffer  = malloc(num_out_transfers * (255 + 3));
+    if (!sco_in_transfer || !sco_out_transfer || !sco_out_transfer_free || !hci_sco_in_buffer || !hci_sco_out_buffer){
+        usb_free_transfers();
+        return -1;
+    }
+    for (c = 0 ; c < num_out_transfers ; c++) {
+        sco_out_transfer[c]->buffer = &hci_sco_out_buffer[c * (255 + 3)];
+        sco_out_transfer_free[c] = sco_out_transfer[c];
+    }
+    sco_out_transfers_free = num_out_transfers;
+#endif
+    return 0;
+}
+
 static int usb_open(void *transport_config){
     int r;
 
     sco_state_machine_init();
     handle_packet = NULL;
+    handle_packet_tail = NULL;
 
     // default endpoint addresses
     event_in_addr = 0x81; // EP1, IN interrupt
@@ -647,35 +836,19 @@ static int usb_open(void *transport_config){
 #endif
     
     // allocate transfer handlers
-    int c;
-    for (c = 0 ; c < ASYNC_BUFFERS ; c++) {
-        event_in_transfer[c] = libusb_alloc_transfer(0); // 0 isochronous transfers Events
-        acl_in_transfer[c]  =  libusb_alloc_transfer(0); // 0 isochronous transfers ACL in
-        if ( !event_in_transfer[c] || !acl_in_transfer[c]) {
-            usb_close(handle);
-            return LIBUSB_ERROR_NO_MEM;
-        }
+    if (usb_alloc_transfers()){
+        usb_close(handle);
+        return LIBUSB_ERROR_NO_MEM;
     }
 
-    command_out_transfer = libusb_alloc_transfer(0);
-    acl_out_transfer     = libusb_alloc_transfer(0);
-
-    // TODO check for error
-
     libusb_state = LIB_USB_TRANSFERS_ALLOCATED;
 
+    int c;
 #ifdef HAVE_SCO
-
-    for (c = 0 ; c < ASYNC_BUFFERS ; c++) {
-        sco_in_transfer[c] = libusb_alloc_transfer(NUM_ISO_PACKETS); // isochronous transfers SCO in
-        log_info("Alloc iso transfer");
-        if (!sco_in_transfer[c]) {
-            usb_close(handle);
-            return LIBUSB_ERROR_NO_MEM;
-        }
+    for (c = 0 ; c < num_in_transfers ; c++) {
        // configure sco_in handlers
         libusb_fill_iso_transfer(sco_in_transfer[c], handle, sco_in_addr, 
-                hci_sco_in_buffer[c], NUM_ISO_PACKETS * SCO_PACKET_SIZE, NUM_ISO_PACKETS, async_callback, NULL, 0) ;
+                &hci_sco_in_buffer[c * NUM_ISO_PACKETS * SCO_PACKET_SIZE], NUM_ISO_PACKETS * SCO_PACKET_SIZE, NUM_ISO_PACKETS, async_callback, NULL, 0) ;
         libusb_set_iso_packet_lengths(sco_in_transfer[c], SCO_PACKET_SIZE);
         // one of the following is relevant! find out which one
         sco_in_transfer[c]->type = LIBUSB_TRANSFER_TYPE_ISOCHRONOUS;
@@ -689,13 +862,12 @@ static int usb_open(void *transport_config){
             return r;
         }
     }
-    sco_out_transfer = libusb_alloc_transfer(1); // 1 isochronous transfers SCO out
 #endif
 
-    for (c = 0 ; c < ASYNC_BUFFERS ; c++) {
+    for (c = 0 ; c < num_in_transfers ; c++) {
         // configure event_in handlers
         libusb_fill_interrupt_transfer(event_in_transfer[c], handle, event_in_addr, 
-                hci_event_in_buffer[c], HCI_ACL_BUFFER_SIZE, async_callback, NULL, 0) ;
+                &hci_event_in_buffer[c * HCI_ACL_BUFFER_SIZE], HCI_ACL_BUFFER_SIZE, async_callback, NULL, 0) ;
         r = libusb_submit_transfer(event_in_transfer[c]);
         if (r) {
             log_error("Error submitting interrupt transfer %d", r);
@@ -705,7 +877,7 @@ static int usb_open(void *transport_config){
  
         // configure acl_in handlers
         libusb_fill_bulk_transfer(acl_in_transfer[c], handle, acl_in_addr, 
-                hci_acl_in_buffer[c] + HCI_INCOMING_PRE_BUFFER_SIZE, HCI_ACL_BUFFER_SIZE, async_callback, NULL, 0) ;
+                &hci_acl_in_buffer[c * (HCI_INCOMING_PRE_BUFFER_SIZE + HCI_ACL_BUFFER_SIZE) + HCI_INCOMING_PRE_BUFFER_SIZE], HCI_ACL_BUFFER_SIZE, async_callback, NULL, 0) ;
         r = libusb_submit_transfer(acl_in_transfer[c]);
         if (r) {
             log_error("Error submitting bulk in transfer %d", r);
@@ -715,39 +887,26 @@ static int usb_open(void *transport_config){
  
      }
 
-    // Check for pollfds functionality
-    doing_pollfds = libusb_pollfds_handle_timeouts(NULL);
-    
-    // NOTE: using pollfds doesn't work on Linux, so it is disable until further investigation here
-    doing_pollfds = 0;
+    log_info("using %u in and %u out transfers", num_in_transfers, num_out_transfers);
+
+    // Use libusb file descriptors in run loop if available, otherwise poll
+    const struct libusb_pollfd ** pollfd = libusb_get_pollfds(NULL);
+    doing_pollfds = pollfd != NULL;
 
     if (doing_pollfds) {
         log_info("Async using pollfds:");
-
-        const struct libusb_pollfd ** pollfd = libusb_get_pollfds(NULL);
-        for (num_pollfds = 0 ; pollfd[num_pollfds] ; num_pollfds++);
-        pollfd_data_sources = malloc(sizeof(data_source_t) * num_pollfds);
-        if (!pollfd_data_sources){
-            log_error("Cannot allocate data sources for pollfds");
-            usb_close(handle);
-            return 1;            
-        }
-        for (r = 0 ; r < num_pollfds ; r++) {
-            data_source_t *ds = &pollfd_data_sources[r];
-            ds->fd = pollfd[r]->fd;
-            ds->process = usb_process_ds;
-            run_loop_add_data_source(ds);
-            log_info("%u: %p fd: %u, events %x", r, pollfd[r], pollfd[r]->fd, pollfd[r]->events);
+        num_pollfds = 0;
+        pollfd_data_sources = NULL;
+        int i;
+        for (i = 0 ; pollfd[i] ; i++) {
+            usb_pollfd_added(pollfd[i]->fd, pollfd[i]->events, NULL);
         }
         free(pollfd);
+        libusb_set_pollfd_notifiers(NULL, usb_pollfd_added, usb_pollfd_removed, NULL);
     } else {
         log_info("Async using timers:");
-
-        usb_timer.process = usb_process_ts;
-        run_loop_set_timer(&usb_timer, AYSNC_POLLING_INTERVAL_MS);
-        run_loop_add_timer(&usb_timer);
-        usb_timer_active = 1;
     }
+    usb_update_timer();
 
     return 0;
 }
@@ -770,13 +929,19 @@ static int usb_close(void *transport_config){
             }
 
             // Cancel any asynchronous transfers
-            for (c = 0 ; c < ASYNC_BUFFERS ; c++) {
+            for (c = 0 ; c < num_in_transfers ; c++) {
                 libusb_cancel_transfer(event_in_transfer[c]);
                 libusb_cancel_transfer(acl_in_transfer[c]);
 #ifdef HAVE_SCO
                 libusb_cancel_transfer(sco_in_transfer[c]);
 #endif
             }
+            for (c = 0 ; c < num_out_transfers ; c++) {
+                libusb_cancel_transfer(acl_out_transfer[c]);
+#ifdef HAVE_SCO
+                libusb_cancel_transfer(sco_out_transfer[c]);
+#endif
+            }
 
             /* TODO - find a better way to ensure that all transfers have completed */
             struct timeval tv;
@@ -784,10 +949,12 @@ static int usb_close(void *transport_config){
             libusb_handle_events_timeout(NULL, &tv);
 
             if (doing_pollfds){
+                libusb_set_pollfd_notifiers(NULL, NULL, NULL, NULL);
                 int r;
                 for (r = 0 ; r < num_pollfds ; r++) {
-                    data_source_t *ds = &pollfd_data_sources[r];
+                    data_source_t *ds = pollfd_data_sources[r];
                     run_loop_remove_data_source(ds);
+                    free(ds);
                 }
                 free(pollfd_data_sources);
                 pollfd_data_sources = NULL;
@@ -796,15 +963,7 @@ static int usb_close(void *transport_config){
             }
 
         case LIB_USB_INTERFACE_CLAIMED:
-            for (c = 0 ; c < ASYNC_BUFFERS ; c++) {
-                if (event_in_transfer[c]) libusb_free_transfer(event_in_transfer[c]);
-                if (acl_in_transfer[c])   libusb_free_transfer(acl_in_transfer[c]);
-#ifdef HAVE_SCO
-                if (sco_in_transfer[c])   libusb_free_transfer(sco_in_transfer[c]);
-#endif
-            }
-
-            // TODO free control and acl out transfers
+            usb_free_transfers();
 
             libusb_release_interface(handle, 0);
 
@@ -833,7 +992,6 @@ static int usb_send_cmd_packet(uint8_t *packet, int size){
     // prepare transfer
     int completed = 0;
     libusb_fill_control_transfer(command_out_transfer, handle, hci_cmd_buffer, async_callback, &completed, 0);
-    command_out_transfer->flags = LIBUSB_TRANSFER_FREE_BUFFER;
 
     // update stata before submitting transfer
     usb_command_active = 1;
@@ -854,21 +1012,21 @@ static int usb_send_acl_packet(uint8_t *packet, int size){
     int r;
 
     if (libusb_state != LIB_USB_TRANSFERS_ALLOCATED) return -1;
+    if (!acl_out_transfers_free) return -1;
+    if (size > HCI_ACL_BUFFER_SIZE) return -1;
 
     // log_info("usb_send_acl_packet enter, size %u", size);
     
-    // prepare transfer
-    int completed = 0;
-    libusb_fill_bulk_transfer(acl_out_transfer, handle, acl_out_addr, packet, size,
-        async_callback, &completed, 0);
-    acl_out_transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
-
-    // update stata before submitting transfer
-    usb_acl_out_active = 1;
-
-    r = libusb_submit_transfer(acl_out_transfer);
+    // prepare transfer, packet is copied so that hci can reuse its buffer while the transfer is queued
+    struct libusb_transfer * transfer = acl_out_transfer_free[--acl_out_transfers_free];
+    memcpy(transfer->buffer, packet, size);
+    libusb_fill_bulk_transfer(transfer, handle, acl_out_addr, transfer->buffer, size,
+        async_callback, NULL, 0);
+    transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
+
+    r = libusb_submit_transfer(transfer);
     if (r < 0) {
-        usb_acl_out_active = 0;
+        acl_out_transfer_free[acl_out_transfers_free++] = transfer;
         log_error("Error submitting acl transfer, %d", r);
         return -1;
     }
@@ -881,23 +1039,23 @@ static int usb_send_sco_packet(uint8_t *packet, int size){
     int r;
 
     if (libusb_state != LIB_USB_TRANSFERS_ALLOCATED) return -1;
+    if (!sco_out_transfers_free) return -1;
+    if (size > 255 + 3) return -1;
 
     // log_info("usb_send_acl_packet enter, size %u", size);
     
-    // prepare transfer
-    int completed = 0;
-    libusb_fill_iso_transfer(sco_out_transfer, handle, sco_out_addr, packet, size, 1,
-        async_callback, &completed, 0);
-    libusb_set_iso_packet_lengths(sco_out_transfer, size);
-    sco_out_transfer->type = LIBUSB_TRANSFER_TYPE_ISOCHRONOUS;
-    sco_out_transfer->iso_packet_desc[0].length = size;
-
-    // update state before submitting transfer
-    usb_sco_out_active = 1;
-
-    r = libusb_submit_transfer(sco_out_transfer);
+    // prepare transfer, packet is copied so that hci can reuse its buffer while the transfer is queued
+    struct libusb_transfer * transfer = sco_out_transfer_free[--sco_out_transfers_free];
+    memcpy(transfer->buffer, packet, size);
+    libusb_fill_iso_transfer(transfer, handle, sco_out_addr, transfer->buffer, size, 1,
+        async_callback, NULL, 0);
+    libusb_set_iso_packet_lengths(transfer, size);
+    transfer->type = LIBUSB_TRANSFER_TYPE_ISOCHRONOUS;
+    transfer->iso_packet_desc[0].length = size;
+
+    r = libusb_submit_transfer(transfer);
     if (r < 0) {
-        usb_sco_out_active = 0;
+        sco_out_transfer_free[sco_out_transfers_free++] = transfer;
         log_error("Error submitting sco transfer, %d", r);
         return -1;
     }
@@ -910,9 +1068,13 @@ static int usb_can_send_packet_now(uint8_t packet_type){
         case HCI_COMMAND_DATA_PACKET:
             return !usb_command_active;
         case HCI_ACL_DATA_PACKET:
-            return !usb_acl_out_active;
+            return acl_out_transfers_free > 0;
         case HCI_SCO_DATA_PACKET:
-            return !usb_sco_out_active;
+#ifdef HAVE_SCO
+            return sco_out_transfers_free > 0;
+#else
+            return 1;
+#endif
         default:
             return 0;
     }
@@ -943,6 +1105,16 @@ static const char * usb_get_transport_name(void){
 static void dummy_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
 }
 
+// set number of concurrent transfers, call before transport is opened
+void hci_transport_usb_set_num_transfers(int in_transfers, int out_transfers){
+    if (libusb_state != LIB_USB_CLOSED){
+        log_error("hci_transport_usb_set_num_transfers called while transport is open");
+        return;
+    }
+    if (in_transfers  > 0) num_in_transfers  = in_transfers;
+    if (out_transfers > 0) num_out_transfers = out_transfers;
+}
+
 // get usb singleton
 hci_transport_t * hci_transport_usb_instance() {
     if (!hci_transport_usb) {
@@ -954,6 +1126,7 @@ hci_transport_t * hci_transport_usb_instance() {
         hci_transport_usb->get_transport_name            = usb_get_transport_name;
         hci_transport_usb->set_baudrate                  = NULL;
         hci_transport_usb->can_send_packet_now           = usb_can_send_packet_now;
+        hci_transport_usb->get_packet_receive_timestamp_us = usb_get_packet_receive_timestamp_us;
     }
     return hci_transport_usb;
 }
@@ -48,25 +48,43 @@
 #include <termios.h>  /* POSIX terminal control definitions */
 #include <fcntl.h>    /* File control definitions */
 #include <unistd.h>   /* UNIX standard function definitions */
+#include <sys/uio.h>  /* writev */
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h> 
+#include <time.h>
 
 #include "debug.h"
 #include "hci.h"
 #include "hci_transport.h"
 
+// size of chunk read from UART at once, can be defined in config.h
+#ifndef HCI_TRANSPORT_H4_READ_BUFFER_SIZE
+#define HCI_TRANSPORT_H4_READ_BUFFER_SIZE 1024
+#endif
+
+// receive buffer holds at least one complete packet
+#if HCI_TRANSPORT_H4_READ_BUFFER_SIZE > 1 + HCI_PACKET_BUFFER_SIZE
+#define H4_RX_BUFFER_SIZE HCI_TRANSPORT_H4_READ_BUFFER_SIZE
+#else
+#define H4_RX_BUFFER_SIZE (1 + HCI_PACKET_BUFFER_SIZE)
+#endif
+
+// at most one packet per packet type (command, acl, sco) is owned by the transport
+#define H4_TX_QUEUE_SIZE 3
+
 static int  h4_process(struct data_source *ds);
+static void h4_tx_report_timer_handler(timer_source_t * ts);
 static void dummy_handler(uint8_t packet_type, uint8_t *packet, uint16_t size); 
 static      hci_uart_config_t *hci_uart_config;
 
-typedef enum {
-    H4_W4_PACKET_TYPE,
-    H4_W4_EVENT_HEADER,
-    H4_W4_ACL_HEADER,
-    H4_W4_SCO_HEADER,
-    H4_W4_PAYLOAD,
-} H4_STATE;
+typedef struct {
+    uint8_t   packet_type;
+    uint8_t * packet;
+    int       size;
+    int       pos;      // bytes written, including packet type
+} h4_tx_packet_t;
 
 typedef struct hci_transport_h4 {
     hci_transport_t transport;
@@ -82,13 +100,38 @@ static hci_transport_h4_t * hci_transport_h4 = NULL;
 
 static  void (*packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size) = dummy_handler;
 
-// packet reader state machine
-static  H4_STATE h4_state;
-static int bytes_to_read;
-static int read_pos;
+// data read from UART. complete packets are passed to the packet handler in place, the data before them can be
+// used as pre buffer. a partial packet at the end is moved to the start of the buffer before the next read
+static uint8_t h4_rx_buffer_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + H4_RX_BUFFER_SIZE];
+static uint8_t * h4_rx_buffer = &h4_rx_buffer_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE];
+static int h4_rx_len;
 
-static uint8_t hci_packet_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 1 + HCI_PACKET_BUFFER_SIZE]; // packet type + max(acl header + acl payload, event header + event data)
-static uint8_t * hci_packet = &hci_packet_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE];
+// incremented on open and close, detects close and re-open by the packet handler
+static int h4_generation;
+
+// time of last read, used for all packets completed by it
+static uint32_t h4_receive_timestamp_us;
+
+// packets to send in order, the first h4_tx_written ones are complete but not reported yet
+static h4_tx_packet_t h4_tx_queue[H4_TX_QUEUE_SIZE];
+static int h4_tx_queue_len;
+static int h4_tx_written;
+
+// reports packets written by h4_send_packet in the current run loop iteration
+static timer_source_t h4_tx_report_timer;
+
+// commands are copied as they might be provided by daemon clients
+static uint8_t h4_tx_cmd_buffer[HCI_CMD_HEADER_SIZE + 255];
+
+static uint32_t h4_get_time_us(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t) (now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
+
+static uint32_t h4_get_packet_receive_timestamp_us(void){
+    return h4_receive_timestamp_us;
+}
 
 static int    h4_set_baudrate(uint32_t baudrate){
 
@@ -182,129 +225,222 @@ static int    h4_open(void *transport_config){
         return -1;
     }
 
-    // init state machine
-    bytes_to_read = 1;
-    h4_state = H4_W4_PACKET_TYPE;
-    read_pos = 0;    
+    // empty rx buffer
+    h4_rx_len = 0;
+    h4_generation++;
+
+    // empty tx queue
+    h4_tx_queue_len = 0;
+    h4_tx_written = 0;
+    run_loop_set_timer_handler(&h4_tx_report_timer, &h4_tx_report_timer_handler);
     return 0;
 }
 
 static int h4_close(void *transport_config){
+    // already closed, e.g. after UART was removed
+    if (hci_transport_h4->ds == NULL) return 0;
+
     // first remove run loop handler
 	run_loop_remove_data_source(hci_transport_h4->ds);
     
     // close device 
     close(hci_transport_h4->ds->fd);
 
+    run_loop_remove_timer(&h4_tx_report_timer);
+
     // free struct
     free(hci_transport_h4->ds);
     hci_transport_h4->ds = NULL;
+    h4_generation++;
     return 0;
 }
 
+static int h4_can_send_packet_now(uint8_t packet_type){
+    int i;
+    for (i = 0; i < h4_tx_queue_len; i++){
+        if (h4_tx_queue[i].packet_type == packet_type) return 0;
+    }
+    return 1;
+}
+
+// write as much of the queued packets as the UART accepts without blocking
+static void h4_tx_write(void){
+    struct iovec iov[2 * H4_TX_QUEUE_SIZE];
+    int iovcnt = 0;
+    int i;
+    for (i = h4_tx_written; i < h4_tx_queue_len; i++){
+        h4_tx_packet_t * tx_packet = &h4_tx_queue[i];
+        int offset = 0;
+        if (tx_packet->pos == 0){
+            iov[iovcnt].iov_base = &tx_packet->packet_type;
+            iov[iovcnt].iov_len  = 1;
+            iovcnt++;
+        } else {
+            offset = tx_packet->pos - 1;
+        }
+        iov[iovcnt].iov_base = &tx_packet->packet[offset];
+        iov[iovcnt].iov_len  = tx_packet->size - offset;
+        iovcnt++;
+    }
+    if (iovcnt == 0) return;
+
+    ssize_t bytes_written = writev(hci_transport_h4->uart_fd, iov, iovcnt);
+    if (bytes_written < 0) {
+        if (errno != EAGAIN && errno != EINTR){
+            log_error("h4_tx_write: writev failed, errno %u", errno);
+        }
+        return;
+    }
+
+    while (bytes_written > 0 && h4_tx_written < h4_tx_queue_len){
+        h4_tx_packet_t * tx_packet = &h4_tx_queue[h4_tx_written];
+        int bytes_remaining = 1 + tx_packet->size - tx_packet->pos;
+        if (bytes_written < bytes_remaining){
+            tx_packet->pos += bytes_written;
+            break;
+        }
+        tx_packet->pos += bytes_remaining;
+        bytes_written  -= bytes_remaining;
+        h4_tx_written++;
+    }
+}
+
+// drop completely written packets and notify upper layers
+static void h4_tx_report(void){
+    if (h4_tx_written == 0) return;
+    h4_tx_queue_len -= h4_tx_written;
+    memmove(&h4_tx_queue[0], &h4_tx_queue[h4_tx_written], h4_tx_queue_len * sizeof(h4_tx_packet_t));
+    h4_tx_written = 0;
+
+    uint8_t event[] = { DAEMON_EVENT_HCI_PACKET_SENT, 0 };
+    packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
+}
+
 static int h4_send_packet(uint8_t packet_type, uint8_t * packet, int size){
     if (hci_transport_h4->ds == NULL) return -1;
     if (hci_transport_h4->uart_fd == 0) return -1;
 
-    char *data = (char*) packet;
-    int bytes_written = write(hci_transport_h4->uart_fd, &packet_type, 1);
-    while (bytes_written < 1) {
-        usleep(5000);
-        bytes_written = write(hci_transport_h4->uart_fd, &packet_type, 1);
-    };
-    while (size > 0) {
-        bytes_written = write(hci_transport_h4->uart_fd, data, size);
-        if (bytes_written < 0) {
-            usleep(5000);
-            continue;
-        }
-        data += bytes_written;
-        size -= bytes_written;
+    if (!h4_can_send_packet_now(packet_type)){
+        log_error("h4_send_packet: packet type 0x%02x already queued", packet_type);
+        return -1;
+    }
+
+    if (packet_type == HCI_COMMAND_DATA_PACKET){
+        if (size > sizeof(h4_tx_cmd_buffer)) return -1;
+        memcpy(h4_tx_cmd_buffer, packet, size);
+        packet = h4_tx_cmd_buffer;
     }
+
+    h4_tx_packet_t * tx_packet = &h4_tx_queue[h4_tx_queue_len++];
+    tx_packet->packet_type = packet_type;
+    tx_packet->packet      = packet;
+    tx_packet->size        = size;
+    tx_packet->pos         = 0;
+
+    // try to send right away, remaining data is sent by h4_process when UART is writable
+    h4_tx_write();
+    if (h4_tx_written < h4_tx_queue_len){
+        run_loop_enable_data_source_write(hci_transport_h4->ds, 1);
+        return 0;
+    }
+
+    // all written: report with timer that expires in this run loop iteration, as HCI doesn't expect
+    // DAEMON_EVENT_HCI_PACKET_SENT before send_packet returns
+    run_loop_remove_timer(&h4_tx_report_timer);
+    run_loop_set_timer(&h4_tx_report_timer, 0);
+    run_loop_add_timer(&h4_tx_report_timer);
     return 0;
 }
 
-static void   h4_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
-    packet_handler = handler;
+static void h4_tx_report_timer_handler(timer_source_t * ts){
+    h4_tx_report();
 }
 
-static void   h4_deliver_packet(void){
-    if (read_pos < 3) return; // sanity check
-    packet_handler(hci_packet[0], &hci_packet[1], read_pos-1);
-    
-    h4_state = H4_W4_PACKET_TYPE;
-    read_pos = 0;
-    bytes_to_read = 1;
+static void   h4_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    packet_handler = handler;
 }
 
-static void h4_statemachine(void){
-    switch (h4_state) {
-            
-        case H4_W4_PACKET_TYPE:
-            switch (hci_packet[0]){
-                case HCI_EVENT_PACKET:
-                    bytes_to_read = HCI_EVENT_HEADER_SIZE;
-                    h4_state = H4_W4_EVENT_HEADER;
-                    break;
-                case HCI_ACL_DATA_PACKET:
-                    bytes_to_read = HCI_ACL_HEADER_SIZE;
-                    h4_state = H4_W4_ACL_HEADER;
-                    break;
-                case HCI_SCO_DATA_PACKET:
-                    bytes_to_read = HCI_SCO_HEADER_SIZE;
-                    h4_state = H4_W4_SCO_HEADER;
-                    break;
-                default:
-                    log_error("h4_process: invalid packet type 0x%02x", hci_packet[0]);
-                    read_pos = 0;
-                    bytes_to_read = 1;
-                    break;
-            }
-            break;
-            
-        case H4_W4_EVENT_HEADER:
-            bytes_to_read = hci_packet[2];
-            h4_state = H4_W4_PAYLOAD;
-            break;
-            
-        case H4_W4_ACL_HEADER:
-            bytes_to_read = READ_BT_16( hci_packet, 3);
-            h4_state = H4_W4_PAYLOAD;
-            break;
-            
-        case H4_W4_SCO_HEADER:
-            bytes_to_read = hci_packet[3];
-            h4_state = H4_W4_PAYLOAD;
-            break;
-
-        case H4_W4_PAYLOAD:
-            h4_deliver_packet();
-            break;
-
+// size of packet at start of data including packet type, 0 if header is incomplete, -1 if packet type is invalid
+static int h4_packet_size(const uint8_t * data, int len){
+    switch (data[0]){
+        case HCI_EVENT_PACKET:
+            if (len < 1 + HCI_EVENT_HEADER_SIZE) return 0;
+            return 1 + HCI_EVENT_HEADER_SIZE + data[2];
+        case HCI_ACL_DATA_PACKET:
+            if (len < 1 + HCI_ACL_HEADER_SIZE) return 0;
+            return 1 + HCI_ACL_HEADER_SIZE + READ_BT_16(data, 3);
+        case HCI_SCO_DATA_PACKET:
+            if (len < 1 + HCI_SCO_HEADER_SIZE) return 0;
+            return 1 + HCI_SCO_HEADER_SIZE + data[3];
         default:
-            break;
+            return -1;
     }
 }
 
+static void h4_emit_hardware_error(void){
+    uint8_t event[] = { HCI_EVENT_HARDWARE_ERROR, 1, 0 };
+    packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
+}
+
 static int h4_process(struct data_source *ds) {
     if (hci_transport_h4->uart_fd == 0) return -1;
 
-    int read_now = bytes_to_read;
-    
-    // read up to bytes_to_read data in
-    ssize_t bytes_read = read(hci_transport_h4->uart_fd, &hci_packet[read_pos], read_now);
-    // log_info("h4_process: bytes read %u", bytes_read);
-    if (bytes_read < 0) {
-        return bytes_read;
+    // the new data source of a re-opened transport might get the address of the old one
+    int generation = h4_generation;
+
+    // continue sending
+    if (ds->write_enabled){
+        h4_tx_write();
+        if (h4_tx_written == h4_tx_queue_len){
+            run_loop_enable_data_source_write(ds, 0);
+        }
+        // packet handler might send next packet or close the transport
+        h4_tx_report();
+        if (h4_generation != generation) return 0;
     }
-    
-    bytes_to_read -= bytes_read;
-    read_pos      += bytes_read;
-    if (bytes_to_read > 0) {
+
+    // read as much as available behind partial packet, which can contain several packets
+    ssize_t bytes_read = read(hci_transport_h4->uart_fd, &h4_rx_buffer[h4_rx_len], H4_RX_BUFFER_SIZE - h4_rx_len);
+    // log_info("h4_process: bytes read %u", bytes_read);
+    if (bytes_read < 0 && (errno == EAGAIN || errno == EINTR)) {
         return 0;
     }
-    
-    h4_statemachine();
+    // end of file or read error, e.g. USB serial adapter was removed
+    if (bytes_read <= 0){
+        log_error("h4_process: UART closed, errno %u", bytes_read < 0 ? errno : 0);
+        h4_close(hci_uart_config);
+        h4_emit_hardware_error();
+        return -1;
+    }
+    h4_receive_timestamp_us = h4_get_time_us();
+    h4_rx_len += bytes_read;
+
+    // deliver complete packets
+    int pos = 0;
+    while (pos < h4_rx_len){
+        int packet_size = h4_packet_size(&h4_rx_buffer[pos], h4_rx_len - pos);
+        if (packet_size == 0) break;
+        if (packet_size < 0){
+            log_error("h4_process: invalid packet type 0x%02x", h4_rx_buffer[pos]);
+            pos++;
+            continue;
+        }
+        if (packet_size > H4_RX_BUFFER_SIZE){
+            log_error("h4_process: packet of %u bytes too large, dropping received data", packet_size);
+            pos = h4_rx_len;
+            break;
+        }
+        if (pos + packet_size > h4_rx_len) break;
+        packet_handler(h4_rx_buffer[pos], &h4_rx_buffer[pos + 1], packet_size - 1);
+        pos += packet_size;
+
+        // packet handler might have closed or re-opened the transport
+        if (h4_generation != generation) return 0;
+    }
+
+    // keep partial packet for next read
+    h4_rx_len -= pos;
+    memmove(&h4_rx_buffer[0], &h4_rx_buffer[pos], h4_rx_len);
     return 0;
 }
 
@@ -326,7 +462,8 @@ hci_transport_t * hci_transport_h4_instance() {
         hci_transport_h4->transport.register_packet_handler       = h4_register_packet_handler;
         hci_transport_h4->transport.get_transport_name            = h4_get_transport_name;
         hci_transport_h4->transport.set_baudrate                  = h4_set_baudrate;
-        hci_transport_h4->transport.can_send_packet_now           = NULL;
+        hci_transport_h4->transport.can_send_packet_now           = h4_can_send_packet_now;
+        hci_transport_h4->transport.get_packet_receive_timestamp_us = h4_get_packet_receive_timestamp_us;
     }
     return (hci_transport_t *) hci_transport_h4;
 }
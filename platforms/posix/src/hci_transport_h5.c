@@ -38,70 +38,224 @@
 /*
  *  hci_transport_h5.c
  *
- *  HCI Transport API implementation for basic H5 protocol
+ *  HCI Transport API implementation for Three-Wire UART (H5) protocol over POSIX
  *
  *  Created by Matthias Ringwald on 4/29/09.
  */
 
+#include "btstack-config.h"
+
 #include <termios.h>  /* POSIX terminal control definitions */
 #include <fcntl.h>    /* File control definitions */
 #include <unistd.h>   /* UNIX standard function definitions */
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "debug.h"
 #include "hci.h"
 #include "hci_transport.h"
 
+// number of unacknowledged reliable packets, max 7. can be defined in config.h
+#ifndef HCI_TRANSPORT_H5_WINDOW_SIZE
+#define HCI_TRANSPORT_H5_WINDOW_SIZE 4
+#endif
+
+// resend unacknowledged packets after this timeout, can be defined in config.h
+#ifndef HCI_TRANSPORT_H5_RETRANSMIT_TIMEOUT_MS
+#define HCI_TRANSPORT_H5_RETRANSMIT_TIMEOUT_MS 250
+#endif
+
+// period for Sync and Config messages during link establishment
+#define H5_LINK_ESTABLISHMENT_PERIOD_MS 250
+
+#define H5_WINDOW_SIZE_MAX 7
+
+#if HCI_TRANSPORT_H5_WINDOW_SIZE > H5_WINDOW_SIZE_MAX
+#error "HCI_TRANSPORT_H5_WINDOW_SIZE must not be larger than 7"
+#endif
+
+// SLIP
+#define SLIP_DELIMITER      0xc0
+#define SLIP_ESCAPE         0xdb
+#define SLIP_ESCAPE_C0      0xdc
+#define SLIP_ESCAPE_DB      0xdd
+
+// H5 packet header
+#define H5_HEADER_SIZE      4
+#define H5_CRC_SIZE         2
+
+#define H5_PACKET_TYPE_ACK              0
+#define H5_PACKET_TYPE_LINK_CONTROL    15
+
+// config field: sliding window size in bits 0-2, data integrity check type in bit 4
+#define H5_CONFIG_WINDOW_SIZE_MASK  0x07
+#define H5_CONFIG_DATA_INTEGRITY    0x10
+
+// a frame with every byte escaped plus delimiters
+#define H5_MAX_ENCODED_FRAME_SIZE   (2 + 2 * (H5_HEADER_SIZE + HCI_PACKET_BUFFER_SIZE + H5_CRC_SIZE))
+
+// encoded data waiting for the UART, can hold at least two frames
+#define H5_TX_BUFFER_SIZE           (2 * H5_MAX_ENCODED_FRAME_SIZE)
+
+typedef enum {
+    H5_LINK_UNINITIALIZED,
+    H5_LINK_INITIALIZED,
+    H5_LINK_ACTIVE,
+} H5_LINK_STATE;
+
+typedef enum {
+    H5_SLIP_W4_DELIMITER,
+    H5_SLIP_DECODING,
+    H5_SLIP_ESCAPED,
+} H5_SLIP_STATE;
+
+// link control messages to send
+#define H5_LINK_CONTROL_SYNC             0x01
+#define H5_LINK_CONTROL_SYNC_RESPONSE    0x02
+#define H5_LINK_CONTROL_CONFIG           0x04
+#define H5_LINK_CONTROL_CONFIG_RESPONSE  0x08
+#define H5_LINK_CONTROL_WOKEN            0x10
+
+static const uint8_t h5_link_control_sync[]            = { 0x01, 0x7e };
+static const uint8_t h5_link_control_sync_response[]   = { 0x02, 0x7d };
+static const uint8_t h5_link_control_config[]          = { 0x03, 0xfc };
+static const uint8_t h5_link_control_config_response[] = { 0x04, 0x7b };
+static const uint8_t h5_link_control_wakeup[]          = { 0x05, 0xfa };
+static const uint8_t h5_link_control_woken[]           = { 0x06, 0xf9 };
+
+// CRC-CCITT, processed LSB first, one nibble at a time
+static const uint16_t h5_crc_table[] = {
+    0x0000, 0x1081, 0x2102, 0x3183, 0x4204, 0x5285, 0x6306, 0x7387,
+    0x8408, 0x9489, 0xa50a, 0xb58b, 0xc60c, 0xd68d, 0xe70e, 0xf78f
+};
+
+typedef struct {
+    uint8_t  packet_type;
+    uint8_t  seq;
+    uint16_t size;
+    uint8_t  data[HCI_PACKET_BUFFER_SIZE];
+} h5_tx_packet_t;
+
 typedef struct hci_transport_h5 {
     hci_transport_t transport;
     data_source_t *ds;
+    int uart_fd;
 } hci_transport_h5_t;
 
-// h5 slip state machine
-typedef enum {
-	unknown = 1,
-	decoding,
-	x_c0,
-	x_db
-} H5_STATE;
-
-typedef struct h5_slip {
-	state_t state;
-	uint16_t length;
-	uint8_t data[HCI_ACL_BUFFER_SIZE];
-} h5_slip_t;
-
-// Global State
-static h5_slip_t read_sm;
-static h5_slip_t write_sm;
-static int bt_filedesc = 0;
-
 // single instance
 static hci_transport_h5_t * hci_transport_h5 = NULL;
 
 static int  h5_process(struct data_source *ds);
-static void dummy_handler(uint8_t packet_type, uint8_t *packet, int size); 
+static void h5_tx_run(void);
+static void dummy_handler(uint8_t packet_type, uint8_t *packet, uint16_t size); 
 static      hci_uart_config_t *hci_uart_config;
 
-static  void (*packet_handler)(uint8_t packet_type, uint8_t *packet, int size) = dummy_handler;
+static  void (*packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size) = dummy_handler;
 
-// prototypes
-static int    h5_open(void *transport_config){
-    hci_uart_config = (hci_uart_config_t*) transport_config;
-    struct termios toptions;
-    int fd = open(hci_uart_config->device_name, O_RDWR | O_NOCTTY | O_NDELAY);
-    if (fd == -1)  {
-        perror("init_serialport: Unable to open port ");
-        perror(hci_uart_config->device_name);
-        return -1;
+// SLIP encoding: escape sequence second byte for SLIP_DELIMITER and SLIP_ESCAPE, 0 otherwise
+static uint8_t h5_slip_escape[256];
+
+// link state
+static H5_LINK_STATE h5_link_state;
+static uint8_t  h5_link_control_pending;
+static uint8_t  h5_window_size;
+static int      h5_data_integrity_check;
+static timer_source_t h5_link_timer;
+
+// receive state
+static H5_SLIP_STATE h5_slip_state;
+static uint16_t h5_frame_len;
+static uint8_t  h5_rx_ack;           // next expected sequence number
+static int      h5_ack_pending;
+static uint8_t  h5_frame_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + H5_HEADER_SIZE + HCI_PACKET_BUFFER_SIZE + H5_CRC_SIZE];
+static uint8_t * h5_frame = &h5_frame_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE];
+static uint8_t  h5_read_buffer[HCI_PACKET_BUFFER_SIZE];
+
+// time of last read, used for all packets completed by it
+static uint32_t h5_receive_timestamp_us;
+
+// sliding window: ring of reliable packets, the first h5_tx_window_sent ones have been sent
+static h5_tx_packet_t h5_tx_window[H5_WINDOW_SIZE_MAX];
+static int      h5_tx_window_start;
+static int      h5_tx_window_len;
+static int      h5_tx_window_sent;
+static uint8_t  h5_tx_seq;           // sequence number for next reliable packet
+static timer_source_t h5_retransmit_timer;
+static int      h5_retransmit_timer_active;
+
+// unreliable SCO packet
+static h5_tx_packet_t h5_tx_sco;
+static int      h5_tx_sco_pending;
+
+// encoded frames not accepted by the UART yet
+static uint8_t  h5_tx_buffer[H5_TX_BUFFER_SIZE];
+static int      h5_tx_buffer_pos;
+static int      h5_tx_buffer_len;
+
+// packets got copied or window opened up, emit DAEMON_EVENT_HCI_PACKET_SENT
+static int      h5_packet_sent_pending;
+
+static uint16_t h5_crc_update(uint16_t crc, uint8_t data){
+    crc = (crc >> 4) ^ h5_crc_table[(crc ^ data) & 0x0f];
+    crc = (crc >> 4) ^ h5_crc_table[(crc ^ (data >> 4)) & 0x0f];
+    return crc;
+}
+
+static uint16_t h5_crc_finalize(uint16_t crc){
+    // reverse bit order
+    uint16_t result = 0;
+    int i;
+    for (i = 0; i < 16; i++){
+        result = (result << 1) | (crc & 1);
+        crc >>= 1;
     }
-    
+    return result;
+}
+
+static uint16_t h5_crc(const uint8_t * data, uint16_t size){
+    uint16_t crc = 0xffff;
+    int i;
+    for (i = 0; i < size; i++){
+        crc = h5_crc_update(crc, data[i]);
+    }
+    return h5_crc_finalize(crc);
+}
+
+static uint8_t h5_config_field(void){
+    uint8_t config = HCI_TRANSPORT_H5_WINDOW_SIZE;
+#ifdef ENABLE_H5_DATA_INTEGRITY_CHECK
+    config |= H5_CONFIG_DATA_INTEGRITY;
+#endif
+    return config;
+}
+
+static uint32_t h5_get_time_us(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t) (now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
+
+static uint32_t h5_get_packet_receive_timestamp_us(void){
+    return h5_receive_timestamp_us;
+}
+
+static int    h5_set_baudrate(uint32_t baudrate){
+
+    log_info("h5_set_baudrate %u", baudrate);
+
+    struct termios toptions;
+    int fd = hci_transport_h5->uart_fd;
+
     if (tcgetattr(fd, &toptions) < 0) {
         perror("init_serialport: Couldn't get term attributes");
         return -1;
     }
-    speed_t brate = hci_uart_config->baudrate; // let you override switch below if needed
-    switch(hci_uart_config->baudrate) {
+    
+    speed_t brate = baudrate; // let you override switch below if needed
+    switch(baudrate) {
         case 57600:  brate=B57600;  break;
         case 115200: brate=B115200; break;
 #ifdef B230400
@@ -114,13 +268,428 @@ static int    h5_open(void *transport_config){
         case 921600: brate=B921600; break;
 #endif
     }
-    cfsetispeed(&toptions, brate);
     cfsetospeed(&toptions, brate);
+    cfsetispeed(&toptions, brate);
+
+    if( tcsetattr(fd, TCSANOW, &toptions) < 0) {
+        perror("init_serialport: Couldn't set term attributes");
+        return -1;
+    }
+
+    return 0;
+}
+
+// encode frame into tx buffer, returns 0 if there's not enough space
+static int h5_tx_frame(int reliable, uint8_t seq, uint8_t packet_type, const uint8_t * payload, uint16_t size){
+
+    // worst case size
+    int max_size = 2 + 2 * (H5_HEADER_SIZE + size + H5_CRC_SIZE);
+    if (h5_tx_buffer_len + max_size > H5_TX_BUFFER_SIZE){
+        // move remaining data to front
+        memmove(&h5_tx_buffer[0], &h5_tx_buffer[h5_tx_buffer_pos], h5_tx_buffer_len - h5_tx_buffer_pos);
+        h5_tx_buffer_len -= h5_tx_buffer_pos;
+        h5_tx_buffer_pos  = 0;
+        if (h5_tx_buffer_len + max_size > H5_TX_BUFFER_SIZE) return 0;
+    }
+
+    uint8_t header[H5_HEADER_SIZE];
+    header[0] = seq | (h5_rx_ack << 3) | (h5_data_integrity_check ? 0x40 : 0) | (reliable ? 0x80 : 0);
+    header[1] = packet_type | ((size & 0x0f) << 4);
+    header[2] = size >> 4;
+    header[3] = ~(header[0] + header[1] + header[2]);
+
+    uint8_t crc[H5_CRC_SIZE];
+    if (h5_data_integrity_check){
+        uint16_t value = 0xffff;
+        int i;
+        for (i = 0; i < H5_HEADER_SIZE; i++){
+            value = h5_crc_update(value, header[i]);
+        }
+        for (i = 0; i < size; i++){
+            value = h5_crc_update(value, payload[i]);
+        }
+        value = h5_crc_finalize(value);
+        // transmitted MSB first
+        crc[0] = value >> 8;
+        crc[1] = value & 0xff;
+    }
+
+    const uint8_t * parts[3]     = { header, payload, crc };
+    const uint16_t  part_size[3] = { H5_HEADER_SIZE, size, h5_data_integrity_check ? H5_CRC_SIZE : 0 };
+
+    uint8_t * buffer = h5_tx_buffer;
+    int pos = h5_tx_buffer_len;
+    buffer[pos++] = SLIP_DELIMITER;
+    int i;
+    for (i = 0; i < 3; i++){
+        const uint8_t * data = parts[i];
+        int j;
+        for (j = 0; j < part_size[i]; j++){
+            uint8_t escape = h5_slip_escape[data[j]];
+            if (escape){
+                buffer[pos++] = SLIP_ESCAPE;
+                buffer[pos++] = escape;
+            } else {
+                buffer[pos++] = data[j];
+            }
+        }
+    }
+    buffer[pos++] = SLIP_DELIMITER;
+    h5_tx_buffer_len = pos;
+
+    // every frame acknowledges received packets
+    h5_ack_pending = 0;
+    return 1;
+}
+
+static void h5_tx_flush(void){
+    if (h5_tx_buffer_pos < h5_tx_buffer_len){
+        ssize_t bytes_written = write(hci_transport_h5->uart_fd, &h5_tx_buffer[h5_tx_buffer_pos], h5_tx_buffer_len - h5_tx_buffer_pos);
+        if (bytes_written < 0){
+            if (errno != EAGAIN && errno != EINTR){
+                log_error("h5_tx_flush: write failed, errno %u", errno);
+            }
+        } else {
+            h5_tx_buffer_pos += bytes_written;
+        }
+        if (h5_tx_buffer_pos == h5_tx_buffer_len){
+            h5_tx_buffer_pos = 0;
+            h5_tx_buffer_len = 0;
+        }
+    }
+
+    // get called when UART is writable or to emit DAEMON_EVENT_HCI_PACKET_SENT
+    int write_enabled = h5_tx_buffer_len > 0 || h5_packet_sent_pending;
+    if (write_enabled != hci_transport_h5->ds->write_enabled){
+        run_loop_enable_data_source_write(hci_transport_h5->ds, write_enabled);
+    }
+}
+
+static void h5_retransmit_timer_start(void){
+    if (h5_retransmit_timer_active){
+        run_loop_remove_timer(&h5_retransmit_timer);
+    }
+    run_loop_set_timer(&h5_retransmit_timer, HCI_TRANSPORT_H5_RETRANSMIT_TIMEOUT_MS);
+    run_loop_add_timer(&h5_retransmit_timer);
+    h5_retransmit_timer_active = 1;
+}
+
+static void h5_retransmit_timer_stop(void){
+    if (!h5_retransmit_timer_active) return;
+    run_loop_remove_timer(&h5_retransmit_timer);
+    h5_retransmit_timer_active = 0;
+}
+
+static void h5_retransmit_timeout_handler(timer_source_t * ts){
+    h5_retransmit_timer_active = 0;
+    if (h5_tx_window_len == 0) return;
+    log_info("h5: retransmit %u packets, seq %u", h5_tx_window_len, h5_tx_window[h5_tx_window_start].seq);
+    // go back n
+    h5_tx_window_sent = 0;
+    h5_tx_run();
+}
+
+static void h5_tx_link_control(const uint8_t * message, uint16_t size, int with_config){
+    uint8_t payload[3];
+    memcpy(payload, message, size);
+    if (with_config){
+        payload[size++] = h5_config_field();
+    }
+    h5_tx_frame(0, 0, H5_PACKET_TYPE_LINK_CONTROL, payload, size);
+}
+
+static void h5_tx_run(void){
+    if (hci_transport_h5->ds == NULL) return;
+
+    // link control messages are small, tx buffer can always hold them
+    if (h5_link_control_pending){
+        if (h5_link_control_pending & H5_LINK_CONTROL_SYNC){
+            h5_tx_link_control(h5_link_control_sync, sizeof(h5_link_control_sync), 0);
+        }
+        if (h5_link_control_pending & H5_LINK_CONTROL_SYNC_RESPONSE){
+            h5_tx_link_control(h5_link_control_sync_response, sizeof(h5_link_control_sync_response), 0);
+        }
+        if (h5_link_control_pending & H5_LINK_CONTROL_CONFIG){
+            h5_tx_link_control(h5_link_control_config, sizeof(h5_link_control_config), 1);
+        }
+        if (h5_link_control_pending & H5_LINK_CONTROL_CONFIG_RESPONSE){
+            h5_tx_link_control(h5_link_control_config_response, sizeof(h5_link_control_config_response), 1);
+        }
+        if (h5_link_control_pending & H5_LINK_CONTROL_WOKEN){
+            h5_tx_link_control(h5_link_control_woken, sizeof(h5_link_control_woken), 0);
+        }
+        h5_link_control_pending = 0;
+    }
+
+    if (h5_link_state == H5_LINK_ACTIVE){
+        // reliable packets in window
+        while (h5_tx_window_sent < h5_tx_window_len){
+            h5_tx_packet_t * tx_packet = &h5_tx_window[(h5_tx_window_start + h5_tx_window_sent) % H5_WINDOW_SIZE_MAX];
+            if (!h5_tx_frame(1, tx_packet->seq, tx_packet->packet_type, tx_packet->data, tx_packet->size)) break;
+            h5_tx_window_sent++;
+            if (!h5_retransmit_timer_active){
+                h5_retransmit_timer_start();
+            }
+        }
+
+        // unreliable SCO packet
+        if (h5_tx_sco_pending){
+            if (h5_tx_frame(0, 0, h5_tx_sco.packet_type, h5_tx_sco.data, h5_tx_sco.size)){
+                h5_tx_sco_pending = 0;
+                h5_packet_sent_pending = 1;
+            }
+        }
+
+        // pure ack, if not sent with other packets
+        if (h5_ack_pending){
+            h5_tx_frame(0, 0, H5_PACKET_TYPE_ACK, NULL, 0);
+        }
+    }
+
+    h5_tx_flush();
+}
+
+static void h5_link_reset(void){
+    h5_link_state = H5_LINK_UNINITIALIZED;
+    h5_window_size = 1;
+    h5_data_integrity_check = 0;
+    h5_rx_ack = 0;
+    h5_ack_pending = 0;
+    h5_tx_seq = 0;
+    h5_tx_window_start = 0;
+    h5_tx_window_len = 0;
+    h5_tx_window_sent = 0;
+    h5_tx_sco_pending = 0;
+    h5_retransmit_timer_stop();
+}
+
+static void h5_link_timeout_handler(timer_source_t * ts){
+    switch (h5_link_state){
+        case H5_LINK_UNINITIALIZED:
+            h5_link_control_pending |= H5_LINK_CONTROL_SYNC;
+            break;
+        case H5_LINK_INITIALIZED:
+            h5_link_control_pending |= H5_LINK_CONTROL_CONFIG;
+            break;
+        default:
+            return;
+    }
+    run_loop_set_timer(&h5_link_timer, H5_LINK_ESTABLISHMENT_PERIOD_MS);
+    run_loop_add_timer(&h5_link_timer);
+    h5_tx_run();
+}
+
+static void h5_link_establishment_start(void){
+    h5_link_reset();
+    run_loop_remove_timer(&h5_link_timer);
+    h5_link_timeout_handler(&h5_link_timer);
+}
+
+static void h5_process_ack(uint8_t ack){
+    if (h5_tx_window_len == 0) return;
+    uint8_t num_acked = (ack - h5_tx_window[h5_tx_window_start].seq) & 0x07;
+    if (num_acked == 0) return;
+    if (num_acked > h5_tx_window_len){
+        log_error("h5: invalid ack %u, %u packets unacknowledged", ack, h5_tx_window_len);
+        return;
+    }
+    h5_tx_window_start  = (h5_tx_window_start + num_acked) % H5_WINDOW_SIZE_MAX;
+    h5_tx_window_len   -= num_acked;
+    // packets might have been acknowledged while being resent
+    h5_tx_window_sent  -= num_acked;
+    if (h5_tx_window_sent < 0){
+        h5_tx_window_sent = 0;
+    }
+    // space in window
+    h5_packet_sent_pending = 1;
+    if (h5_tx_window_len){
+        h5_retransmit_timer_start();
+    } else {
+        h5_retransmit_timer_stop();
+    }
+}
+
+static void h5_process_link_control(const uint8_t * payload, uint16_t size){
+    if (size < 2) return;
+    if (memcmp(payload, h5_link_control_sync, 2) == 0){
+        if (h5_link_state == H5_LINK_ACTIVE){
+            log_error("h5: peer reset, restart link establishment");
+            h5_link_establishment_start();
+        }
+        h5_link_control_pending |= H5_LINK_CONTROL_SYNC_RESPONSE;
+        return;
+    }
+    if (memcmp(payload, h5_link_control_sync_response, 2) == 0){
+        if (h5_link_state != H5_LINK_UNINITIALIZED) return;
+        h5_link_state = H5_LINK_INITIALIZED;
+        h5_link_control_pending |= H5_LINK_CONTROL_CONFIG;
+        return;
+    }
+    if (memcmp(payload, h5_link_control_config, 2) == 0){
+        if (h5_link_state == H5_LINK_UNINITIALIZED) return;
+        h5_link_control_pending |= H5_LINK_CONTROL_CONFIG_RESPONSE;
+        return;
+    }
+    if (memcmp(payload, h5_link_control_config_response, 2) == 0){
+        if (h5_link_state != H5_LINK_INITIALIZED) return;
+        uint8_t config = h5_config_field();
+        if (size > 2){
+            // use smaller window, data integrity check if both support it
+            uint8_t peer_window_size = payload[2] & H5_CONFIG_WINDOW_SIZE_MASK;
+            if (peer_window_size < (config & H5_CONFIG_WINDOW_SIZE_MASK)){
+                config = (config & ~H5_CONFIG_WINDOW_SIZE_MASK) | peer_window_size;
+            }
+            config &= payload[2] | ~H5_CONFIG_DATA_INTEGRITY;
+        }
+        h5_window_size = config & H5_CONFIG_WINDOW_SIZE_MASK;
+        if (h5_window_size == 0){
+            h5_window_size = 1;
+        }
+        h5_data_integrity_check = (config & H5_CONFIG_DATA_INTEGRITY) != 0;
+        h5_link_state = H5_LINK_ACTIVE;
+        run_loop_remove_timer(&h5_link_timer);
+        log_info("h5: link active, window size %u, data integrity check %u", h5_window_size, h5_data_integrity_check);
+        // notify hci that packets can be sent
+        h5_packet_sent_pending = 1;
+        return;
+    }
+    if (memcmp(payload, h5_link_control_wakeup, 2) == 0){
+        h5_link_control_pending |= H5_LINK_CONTROL_WOKEN;
+        return;
+    }
+    // ignore woken and sleep
+}
+
+static void h5_process_frame(void){
+    if (h5_frame_len < H5_HEADER_SIZE) return;
+
+    uint8_t * header = h5_frame;
+    if (((header[0] + header[1] + header[2] + header[3]) & 0xff) != 0xff){
+        log_error("h5: invalid header checksum");
+        return;
+    }
+
+    uint16_t payload_len = (header[1] >> 4) | (header[2] << 4);
+    int data_integrity_check = (header[0] & 0x40) != 0;
+    if (h5_frame_len != H5_HEADER_SIZE + payload_len + (data_integrity_check ? H5_CRC_SIZE : 0)){
+        log_error("h5: invalid frame len %u, payload len %u", h5_frame_len, payload_len);
+        return;
+    }
+    if (data_integrity_check){
+        uint16_t crc = READ_NET_16(h5_frame, H5_HEADER_SIZE + payload_len);
+        if (crc != h5_crc(h5_frame, H5_HEADER_SIZE + payload_len)){
+            log_error("h5: invalid data integrity check");
+            return;
+        }
+    }
+
+    uint8_t seq         = header[0] & 0x07;
+    uint8_t ack         = (header[0] >> 3) & 0x07;
+    int     reliable    = (header[0] & 0x80) != 0;
+    uint8_t packet_type = header[1] & 0x0f;
+    uint8_t * payload   = &h5_frame[H5_HEADER_SIZE];
+
+    if (packet_type == H5_PACKET_TYPE_LINK_CONTROL){
+        h5_process_link_control(payload, payload_len);
+        return;
+    }
+
+    if (h5_link_state != H5_LINK_ACTIVE) return;
+
+    h5_process_ack(ack);
+
+    if (reliable){
+        // acknowledge also duplicates or out of order packets
+        h5_ack_pending = 1;
+        if (seq != h5_rx_ack){
+            log_info("h5: drop packet with seq %u, expected %u", seq, h5_rx_ack);
+            return;
+        }
+        h5_rx_ack = (h5_rx_ack + 1) & 0x07;
+    }
+
+    switch (packet_type){
+        case HCI_EVENT_PACKET:
+        case HCI_ACL_DATA_PACKET:
+        case HCI_SCO_DATA_PACKET:
+            packet_handler(packet_type, payload, payload_len);
+            break;
+        default:
+            break;
+    }
+}
+
+static void h5_slip_process(uint8_t data){
+    switch (h5_slip_state){
+        case H5_SLIP_W4_DELIMITER:
+            if (data == SLIP_DELIMITER){
+                h5_frame_len = 0;
+                h5_slip_state = H5_SLIP_DECODING;
+            }
+            return;
+        case H5_SLIP_DECODING:
+            switch (data){
+                case SLIP_DELIMITER:
+                    // empty frames are used for synchronization
+                    if (h5_frame_len > 0){
+                        h5_process_frame();
+                        h5_frame_len = 0;
+                    }
+                    return;
+                case SLIP_ESCAPE:
+                    h5_slip_state = H5_SLIP_ESCAPED;
+                    return;
+                default:
+                    break;
+            }
+            break;
+        case H5_SLIP_ESCAPED:
+            switch (data){
+                case SLIP_ESCAPE_C0:
+                    data = SLIP_DELIMITER;
+                    break;
+                case SLIP_ESCAPE_DB:
+                    data = SLIP_ESCAPE;
+                    break;
+                default:
+                    log_error("h5: invalid escape sequence 0x%02x", data);
+                    h5_slip_state = H5_SLIP_W4_DELIMITER;
+                    return;
+            }
+            h5_slip_state = H5_SLIP_DECODING;
+            break;
+        default:
+            return;
+    }
+
+    if (h5_frame_len >= sizeof(h5_frame_with_pre_buffer) - HCI_INCOMING_PRE_BUFFER_SIZE){
+        log_error("h5: frame too large");
+        h5_slip_state = H5_SLIP_W4_DELIMITER;
+        return;
+    }
+    h5_frame[h5_frame_len++] = data;
+}
+
+static int    h5_open(void *transport_config){
+    hci_uart_config = (hci_uart_config_t*) transport_config;
+    struct termios toptions;
+    int flags = O_RDWR | O_NOCTTY | O_NONBLOCK;
+    int fd = open(hci_uart_config->device_name, flags);
+    if (fd == -1)  {
+        perror("init_serialport: Unable to open port ");
+        perror(hci_uart_config->device_name);
+        return -1;
+    }
     
+    if (tcgetattr(fd, &toptions) < 0) {
+        perror("init_serialport: Couldn't get term attributes");
+        return -1;
+    }
+    
+    cfmakeraw(&toptions);   // make raw
+
     // 8N1
-    toptions.c_cflag &= ~PARENB;
     toptions.c_cflag &= ~CSTOPB;
-    toptions.c_cflag &= ~CSIZE;
     toptions.c_cflag |= CS8;
 
     if (hci_uart_config->flowcontrol) {
@@ -134,9 +703,6 @@ static int    h5_open(void *transport_config){
     toptions.c_cflag |= CREAD | CLOCAL;  // turn on READ & ignore ctrl lines
     toptions.c_iflag &= ~(IXON | IXOFF | IXANY); // turn off s/w flow ctrl
     
-    toptions.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG); // make raw
-    toptions.c_oflag &= ~OPOST; // make raw
-    
     // see: http://unixwiz.net/techtips/termios-vmin-vtime.html
     toptions.c_cc[VMIN]  = 1;
     toptions.c_cc[VTIME] = 0;
@@ -147,19 +713,35 @@ static int    h5_open(void *transport_config){
     }
     
     // set up data_source
-    hci_transport_h5->ds = malloc(sizeof(data_source_t));
-    if (!hci_transport_h5) return -1;
+    hci_transport_h5->ds = (data_source_t*) malloc(sizeof(data_source_t));
+    if (!hci_transport_h5->ds) return -1;
+    hci_transport_h5->uart_fd = fd;
     hci_transport_h5->ds->fd = fd;
     hci_transport_h5->ds->process = h5_process;
     run_loop_add_data_source(hci_transport_h5->ds);
     
+    // also set baudrate
+    if (h5_set_baudrate(hci_uart_config->baudrate_init) < 0){
+        return -1;
+    }
+
     // init state machine
-	h5_slip_init( &read_sm);
-	h5_slip_init( &write_sm);
+    h5_slip_state = H5_SLIP_W4_DELIMITER;
+    h5_tx_buffer_pos = 0;
+    h5_tx_buffer_len = 0;
+    h5_packet_sent_pending = 0;
+    h5_link_control_pending = 0;
+
+    // send Sync messages until controller responds
+    h5_link_establishment_start();
     return 0;
 }
 
 static int    h5_close(void *transport_config){
+    // stop timers
+    h5_retransmit_timer_stop();
+    run_loop_remove_timer(&h5_link_timer);
+
     // first remove run loop handler
 	run_loop_remove_data_source(hci_transport_h5->ds);
     
@@ -172,116 +754,71 @@ static int    h5_close(void *transport_config){
     return 0;
 }
 
+static int h5_can_send_packet_now(uint8_t packet_type){
+    if (h5_link_state != H5_LINK_ACTIVE) return 0;
+    if (packet_type == HCI_SCO_DATA_PACKET) return !h5_tx_sco_pending;
+    return h5_tx_window_len < h5_window_size;
+}
+
 static int    h5_send_packet(uint8_t packet_type, uint8_t *packet, int size){
     if (hci_transport_h5->ds == NULL) return -1;
-    if (hci_transport_h5->ds->fd == 0) return -1;
-    char *data = (char*) packet;
-    
-    write(hci_transport_h5->ds->fd, &packet_type, 1);
-    while (size > 0) {
-        int bytes_written = write(hci_transport_h5->ds->fd, data, size);
-        if (bytes_written < 0) {
-            usleep(5000);
-            continue;
-        }
-        data += bytes_written;
-        size -= bytes_written;
+    if (hci_transport_h5->uart_fd == 0) return -1;
+    if (size > HCI_PACKET_BUFFER_SIZE) return -1;
+
+    if (!h5_can_send_packet_now(packet_type)){
+        log_error("h5_send_packet: cannot send packet type 0x%02x now", packet_type);
+        return -1;
     }
+
+    // packets are copied, they might be resent after DAEMON_EVENT_HCI_PACKET_SENT
+    h5_tx_packet_t * tx_packet;
+    if (packet_type == HCI_SCO_DATA_PACKET){
+        tx_packet = &h5_tx_sco;
+        h5_tx_sco_pending = 1;
+    } else {
+        tx_packet = &h5_tx_window[(h5_tx_window_start + h5_tx_window_len) % H5_WINDOW_SIZE_MAX];
+        tx_packet->seq = h5_tx_seq;
+        h5_tx_seq = (h5_tx_seq + 1) & 0x07;
+        h5_tx_window_len++;
+        h5_packet_sent_pending = 1;
+    }
+    tx_packet->packet_type = packet_type;
+    tx_packet->size        = size;
+    memcpy(tx_packet->data, packet, size);
+
+    h5_tx_run();
     return 0;
 }
 
-static void   h5_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, int size)){
+static void   h5_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
     packet_handler = handler;
 }
 
-static void h5_slip_init( h5_slip_t * sm){
-	sm->state = unknown;
-}
+static int    h5_process(struct data_source *ds) {
+    if (hci_transport_h5->uart_fd == 0) return -1;
 
-static void h5_slip_process( h5_slip_t * sm, uint8_t input, uint8_t in){
-	uint8_t type;
-	switch (sm->state) {
-		case unknown:
-			if (input == 0xc0){
-				sm->length = 0;
-				sm->state  = x_c0;
-			}
-			break;
-		case x_c0:
-			switch (input ){
-				case 0xc0:
-					break;
-				case 0xdb:
-					sm->state = x_db;
-					break;
-				default:
-					sm->data[sm->length] = input;
-					++sm->length;
-					sm->state   = decoding;
-					break;
-			}
-			break;
-		case decoding:
-			switch (input ){
-				case 0xc0:
-					sm->state = unknown;
-					// packet done - check if valid HCI packet
-					if (sm->length < 6) break;
-					type = sm->data[1] & 0x0f;
-					if (type < 1 || type > 4) break;
-					switch (type) {
-						case HCI_ACL_DATA_PACKET:
-							acl_packet_handler( &sm->data[4], sm->length-4-2);
-							break;
-						case HCI_EVENT_PACKET:
-							event_packet_handler( &sm->data[4], sm->length-4-2);
-							break;
-						default:
-							break;
-					}
-					break;
-				case 0xdb:
-					sm->state = x_db;
-					break;
-				default:
-					sm->data[sm->length] = input;
-					++sm->length;
-					break;
-			}
-			break;
-		case x_db:
-			switch (input) {
-				case 0xdc:
-					sm->data[sm->length] = 0xc0;
-					++sm->length;
-					sm->state = decoding;
-					break;
-				case 0xdd:
-					sm->data[sm->length] = 0xdb;
-					++sm->length;
-					sm->state = decoding;
-					break;
-				default:
-					sm->state = unknown;
-					break;
-			}
-			break;
-		default:
-			break;
-	}
-}
+    // read as much as available, which can contain several frames
+    ssize_t bytes_read = read(hci_transport_h5->uart_fd, h5_read_buffer, sizeof(h5_read_buffer));
+    if (bytes_read > 0){
+        h5_receive_timestamp_us = h5_get_time_us();
+    }
+    int i;
+    for (i = 0; i < bytes_read; i++){
+        h5_slip_process(h5_read_buffer[i]);
+        // packet handler might have closed the transport
+        if (hci_transport_h5->ds == NULL) return 0;
+    }
 
+    // notify upper stack that it might be possible to send again
+    if (h5_packet_sent_pending){
+        h5_packet_sent_pending = 0;
+        uint8_t event[] = { DAEMON_EVENT_HCI_PACKET_SENT, 0 };
+        packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
+        if (hci_transport_h5->ds == NULL) return 0;
+    }
 
-static int    h5_process(struct data_source *ds) {
-    if (hci_transport_h5->ds->fd == 0) return -1;
-
-    // read up to bytes_to_read data in
-	uint8_t data;
-	while (1) {
-		int bytes_read = read(hci_transport_h5->ds->fd, &data, 1);
-		if (bytes_read < 1) break;
-		h5_slip_process( &read_sm, data, 1);
-	};
+    // send acks, link control messages, and remaining data
+    h5_tx_run();
     return 0;
 }
 
@@ -289,21 +826,29 @@ static const char * h5_get_transport_name(void){
     return "H5";
 }
 
-static void dummy_handler(uint8_t *packet, int size){
+static void dummy_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
 }
 
 // get h5 singleton
 hci_transport_t * hci_transport_h5_instance() {
     if (hci_transport_h5 == NULL) {
-        hci_transport_h5 = malloc( sizeof(hci_transport_h5_t));
+        hci_transport_h5 = (hci_transport_h5_t*) malloc( sizeof(hci_transport_h5_t));
         hci_transport_h5->ds                                      = NULL;
         hci_transport_h5->transport.open                          = h5_open;
         hci_transport_h5->transport.close                         = h5_close;
         hci_transport_h5->transport.send_packet                   = h5_send_packet;
-        hci_transport_h5->transport.register_packet_handler       = h5_register_event_packet_handler;
+        hci_transport_h5->transport.register_packet_handler       = h5_register_packet_handler;
         hci_transport_h5->transport.get_transport_name            = h5_get_transport_name;
-        hci_transport_h5->transport.set_baudrate                  = NULL;
-        hci_transport_h5->transport.can_send_packet_now           = NULL;
+        hci_transport_h5->transport.set_baudrate                  = h5_set_baudrate;
+        hci_transport_h5->transport.can_send_packet_now           = h5_can_send_packet_now;
+        hci_transport_h5->transport.get_packet_receive_timestamp_us = h5_get_packet_receive_timestamp_us;
+
+        memset(h5_slip_escape, 0, sizeof(h5_slip_escape));
+        h5_slip_escape[SLIP_DELIMITER] = SLIP_ESCAPE_C0;
+        h5_slip_escape[SLIP_ESCAPE]    = SLIP_ESCAPE_DB;
+
+        run_loop_set_timer_handler(&h5_link_timer, h5_link_timeout_handler);
+        run_loop_set_timer_handler(&h5_retransmit_timer, h5_retransmit_timeout_handler);
     }
     return (hci_transport_t *) hci_transport_h5;
 }
@@ -0,0 +1,1607 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  hci_transport_virtual.c
+ *
+ *  HCI Transport API implementation with an emulated Bluetooth controller
+ *
+ *  The virtual controller answers the HCI init sequence, models the ACL and LE
+ *  buffers of a real controller incl. Number Of Completed Packets events, and
+ *  connects to a single peer, which is another virtual controller in a different
+ *  process. Both controllers exchange their state, connection setup and ACL data
+ *  via a UNIX domain socket. ACL packets can be delayed and retransmitted to model
+ *  a lossy radio link, which allows to run throughput tests without hardware.
+ */
+
+#include "btstack-config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <btstack/utils.h>
+
+#include "debug.h"
+#include "hci.h"
+#include "hci_transport.h"
+#include "rijndael.h"
+
+#ifndef HCI_INCOMING_PRE_BUFFER_SIZE
+#define HCI_INCOMING_PRE_BUFFER_SIZE 0
+#endif
+
+// buffer model used if not set in config, similar to a typical USB dongle
+#define VIRTUAL_ACL_DATA_PACKET_LENGTH      1021
+#define VIRTUAL_ACL_PACKETS_TOTAL_NUM          8
+#define VIRTUAL_LE_DATA_PACKETS_LENGTH        27
+#define VIRTUAL_LE_ACL_PACKETS_TOTAL_NUM       8
+
+#define VIRTUAL_LE_WHITE_LIST_SIZE             8
+
+// connection handles for the single classic and LE link to the peer
+#define VIRTUAL_CLASSIC_HANDLE            0x0001
+#define VIRTUAL_LE_HANDLE                 0x0040
+
+#define VIRTUAL_INQUIRY_SCAN_ENABLE         0x01
+#define VIRTUAL_PAGE_SCAN_ENABLE            0x02
+
+#define VIRTUAL_MIN_ADVERTISING_INTERVAL_MS   20
+
+#define VIRTUAL_ADV_DATA_LEN                  31
+#define VIRTUAL_DEVICE_NAME_LEN              248
+
+// messages exchanged with the peer controller, framed by a 16-bit little endian length
+#define VIRTUAL_AIR_STATE                   0x01
+#define VIRTUAL_AIR_CONNECT                 0x02
+#define VIRTUAL_AIR_CONNECT_RESPONSE        0x03
+#define VIRTUAL_AIR_LE_CONNECT              0x04
+#define VIRTUAL_AIR_LE_CONNECT_RESPONSE     0x05
+#define VIRTUAL_AIR_DISCONNECT              0x06
+#define VIRTUAL_AIR_ACL                     0x07
+#define VIRTUAL_AIR_LE_ENCRYPT              0x08
+#define VIRTUAL_AIR_LE_ENCRYPT_RESPONSE     0x09
+#define VIRTUAL_AIR_LE_CONNECTION_UPDATE    0x0a
+
+#define VIRTUAL_AIR_HEADER_SIZE    2
+#define VIRTUAL_AIR_MAX_MESSAGE    (1 + HCI_PACKET_BUFFER_SIZE)
+#define VIRTUAL_AIR_STATE_SIZE     (1 + 6 + 1 + 3 + 1 + 1 + 2 + 1 + VIRTUAL_ADV_DATA_LEN + VIRTUAL_DEVICE_NAME_LEN)
+
+#define OPCODE(ogf, ocf) (ocf | ogf << 10)
+
+typedef enum {
+    VIRTUAL_LINK_IDLE,
+    VIRTUAL_LINK_W4_PEER,       // outgoing connection, waiting for peer
+    VIRTUAL_LINK_W4_ACCEPT,     // incoming connection, waiting for host
+    VIRTUAL_LINK_OPEN,
+} VIRTUAL_LINK_STATE;
+
+typedef struct {
+    VIRTUAL_LINK_STATE state;
+    hci_con_handle_t handle;
+    bd_addr_t address;          // address reported to the host
+    uint8_t   address_type;
+    uint8_t   encrypted;
+    uint16_t  packets_in_flight;
+    uint16_t  packets_completed;
+    // LE
+    uint16_t  conn_interval;
+    uint16_t  conn_latency;
+    uint16_t  supervision_timeout;
+    uint8_t   ltk[16];
+} virtual_link_t;
+
+// state that is visible to the peer
+typedef struct {
+    bd_addr_t address;
+    uint8_t   scan_enable;
+    uint32_t  class_of_device;
+    uint8_t   adv_enabled;
+    uint8_t   adv_type;
+    uint16_t  adv_interval_ms;
+    uint8_t   adv_data_len;
+    uint8_t   adv_data[VIRTUAL_ADV_DATA_LEN];
+    uint8_t   name[VIRTUAL_DEVICE_NAME_LEN];
+} virtual_device_t;
+
+typedef struct virtual_packet {
+    struct virtual_packet * next;
+    virtual_link_t * link;      // ACL packet to report as completed when sent
+    uint32_t  due_ms;
+    uint32_t  received_us;      // time packet to host was generated
+    uint8_t   packet_type;
+    uint16_t  size;
+    uint8_t * data;
+} virtual_packet_t;
+
+typedef struct {
+    virtual_packet_t * head;
+    virtual_packet_t * tail;
+} virtual_queue_t;
+
+typedef struct {
+    hci_transport_t transport;
+    data_source_t * ds;         // connection to peer
+    data_source_t * listen_ds;
+} hci_transport_virtual_t;
+
+typedef struct {
+    const hci_cmd_t * cmd;
+    void (*handler)(uint16_t opcode, const uint8_t * params);
+} virtual_command_handler_t;
+
+// single instance
+static hci_transport_virtual_t * hci_transport_virtual = NULL;
+static hci_transport_virtual_config_t * virtual_config;
+
+static void (*packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size) = NULL;
+
+// controller configuration
+static uint16_t virtual_acl_data_packet_length;
+static uint16_t virtual_acl_packets_total_num;
+static uint16_t virtual_le_data_packets_length;
+static uint8_t  virtual_le_acl_packets_total_num;
+
+static const uint8_t virtual_local_supported_features[] = { 0xff, 0xff, 0x8f, 0xfe, 0xd8, 0x3f, 0x5b, 0x87 };
+static const uint8_t virtual_le_supported_features[]    = { 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+// controller state
+static virtual_device_t virtual_local;
+static virtual_device_t virtual_peer;
+static int              virtual_peer_known;
+static uint8_t          virtual_inquiry_mode;
+static uint8_t          virtual_le_scan_enable;
+static virtual_link_t   virtual_classic_link;
+static virtual_link_t   virtual_le_link;
+static uint32_t         virtual_random_state;
+
+// packets to host, delivered from the run loop to avoid re-entrant calls
+static virtual_queue_t  virtual_host_queue;
+static timer_source_t   virtual_host_timer;
+static int              virtual_host_timer_active;
+static uint32_t         virtual_host_received_us;
+
+// messages to peer, sorted by due time
+static virtual_queue_t  virtual_air_queue;
+static timer_source_t   virtual_air_timer;
+static uint32_t         virtual_air_last_due_ms;
+static uint16_t         virtual_air_tx_pos;
+
+// incoming frames from peer
+static uint8_t          virtual_air_rx_buffer[2 * (VIRTUAL_AIR_HEADER_SIZE + VIRTUAL_AIR_MAX_MESSAGE)];
+static int              virtual_air_rx_len;
+
+static timer_source_t   virtual_adv_timer;
+
+static void virtual_peer_open(void);
+static void virtual_peer_send_state(void);
+static void virtual_le_connect_run(void);
+static void virtual_adv_timer_update(void);
+
+// deterministic random numbers make test runs repeatable
+static uint32_t virtual_random(void){
+    virtual_random_state = virtual_random_state * 1103515245 + 12345;
+    return virtual_random_state >> 16;
+}
+
+static virtual_packet_t * virtual_packet_alloc(uint16_t pre_buffer, uint16_t size){
+    virtual_packet_t * packet = (virtual_packet_t *) malloc(sizeof(virtual_packet_t) + pre_buffer + size);
+    if (!packet) return NULL;
+    memset(packet, 0, sizeof(virtual_packet_t));
+    packet->data = ((uint8_t *) (packet + 1)) + pre_buffer;
+    packet->size = size;
+    return packet;
+}
+
+static void virtual_queue_add(virtual_queue_t * queue, virtual_packet_t * packet){
+    packet->next = NULL;
+    if (queue->tail){
+        queue->tail->next = packet;
+    } else {
+        queue->head = packet;
+    }
+    queue->tail = packet;
+}
+
+static virtual_packet_t * virtual_queue_pop(virtual_queue_t * queue){
+    virtual_packet_t * packet = queue->head;
+    if (!packet) return NULL;
+    queue->head = packet->next;
+    if (!queue->head){
+        queue->tail = NULL;
+    }
+    return packet;
+}
+
+static void virtual_queue_free(virtual_queue_t * queue){
+    virtual_packet_t * packet;
+    while ((packet = virtual_queue_pop(queue)) != NULL){
+        free(packet);
+    }
+}
+
+static virtual_link_t * virtual_link_for_handle(uint16_t handle){
+    handle &= 0x0fff;
+    if (handle == virtual_classic_link.handle) return &virtual_classic_link;
+    if (handle == virtual_le_link.handle)      return &virtual_le_link;
+    return NULL;
+}
+
+static void virtual_link_reset(virtual_link_t * link){
+    hci_con_handle_t handle = link->handle;
+    memset(link, 0, sizeof(virtual_link_t));
+    link->handle = handle;
+}
+
+// host side
+
+static uint32_t virtual_get_time_us(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t) (now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
+
+static uint32_t virtual_get_packet_receive_timestamp_us(void){
+    return virtual_host_received_us;
+}
+
+static void virtual_host_timeout_handler(timer_source_t * ts){
+    virtual_packet_t * packet;
+    while ((packet = virtual_queue_pop(&virtual_host_queue)) != NULL){
+        virtual_host_received_us = packet->received_us;
+        packet_handler(packet->packet_type, packet->data, packet->size);
+        free(packet);
+        // packet handler might have closed the transport
+        if (!virtual_config) break;
+    }
+    virtual_host_timer_active = 0;
+}
+
+static void virtual_host_send(uint8_t packet_type, const uint8_t * data, uint16_t size){
+    virtual_packet_t * packet = virtual_packet_alloc(HCI_INCOMING_PRE_BUFFER_SIZE, size);
+    if (!packet){
+        log_error("virtual: no memory for packet to host");
+        return;
+    }
+    packet->packet_type = packet_type;
+    packet->received_us = virtual_get_time_us();
+    memcpy(packet->data, data, size);
+    virtual_queue_add(&virtual_host_queue, packet);
+    if (virtual_host_timer_active) return;
+    virtual_host_timer_active = 1;
+    run_loop_set_timer(&virtual_host_timer, 0);
+    run_loop_add_timer(&virtual_host_timer);
+}
+
+static void virtual_emit_event(const uint8_t * event, uint16_t size){
+    virtual_host_send(HCI_EVENT_PACKET, event, size);
+}
+
+static void virtual_emit_command_complete(uint16_t opcode, const uint8_t * params, uint16_t params_len){
+    uint8_t event[5 + 255];
+    event[0] = HCI_EVENT_COMMAND_COMPLETE;
+    event[1] = 3 + params_len;
+    event[2] = 1;   // num hci command packets
+    bt_store_16(event, 3, opcode);
+    memcpy(&event[5], params, params_len);
+    virtual_emit_event(event, 5 + params_len);
+}
+
+static void virtual_emit_command_complete_status(uint16_t opcode, uint8_t status){
+    virtual_emit_command_complete(opcode, &status, 1);
+}
+
+static void virtual_emit_command_status(uint16_t opcode, uint8_t status){
+    uint8_t event[6];
+    event[0] = HCI_EVENT_COMMAND_STATUS;
+    event[1] = sizeof(event) - 2;
+    event[2] = status;
+    event[3] = 1;   // num hci command packets
+    bt_store_16(event, 4, opcode);
+    virtual_emit_event(event, sizeof(event));
+}
+
+static void virtual_emit_connection_complete(virtual_link_t * link, uint8_t status){
+    uint8_t event[13];
+    event[0] = HCI_EVENT_CONNECTION_COMPLETE;
+    event[1] = sizeof(event) - 2;
+    event[2] = status;
+    bt_store_16(event, 3, link->handle);
+    bt_flip_addr(&event[5], link->address);
+    event[11] = 1;  // ACL
+    event[12] = 0;  // encryption disabled
+    virtual_emit_event(event, sizeof(event));
+}
+
+static void virtual_emit_le_connection_complete(virtual_link_t * link, uint8_t status, uint8_t role){
+    uint8_t event[21];
+    event[0] = HCI_EVENT_LE_META;
+    event[1] = sizeof(event) - 2;
+    event[2] = HCI_SUBEVENT_LE_CONNECTION_COMPLETE;
+    event[3] = status;
+    bt_store_16(event, 4, link->handle);
+    event[6] = role;
+    event[7] = link->address_type;
+    bt_flip_addr(&event[8], link->address);
+    bt_store_16(event, 14, link->conn_interval);
+    bt_store_16(event, 16, link->conn_latency);
+    bt_store_16(event, 18, link->supervision_timeout);
+    event[20] = 0;  // master clock accuracy
+    virtual_emit_event(event, sizeof(event));
+}
+
+static void virtual_emit_le_connection_update_complete(virtual_link_t * link){
+    uint8_t event[12];
+    event[0] = HCI_EVENT_LE_META;
+    event[1] = sizeof(event) - 2;
+    event[2] = HCI_SUBEVENT_LE_CONNECTION_UPDATE_COMPLETE;
+    event[3] = 0;
+    bt_store_16(event, 4, link->handle);
+    bt_store_16(event, 6, link->conn_interval);
+    bt_store_16(event, 8, link->conn_latency);
+    bt_store_16(event, 10, link->supervision_timeout);
+    virtual_emit_event(event, sizeof(event));
+}
+
+static void virtual_emit_disconnection_complete(virtual_link_t * link, uint8_t reason){
+    uint8_t event[6];
+    event[0] = HCI_EVENT_DISCONNECTION_COMPLETE;
+    event[1] = sizeof(event) - 2;
+    event[2] = 0;
+    bt_store_16(event, 3, link->handle);
+    event[5] = reason;
+    virtual_emit_event(event, sizeof(event));
+}
+
+static void virtual_emit_encryption_change(virtual_link_t * link, uint8_t status, uint8_t enabled){
+    uint8_t event[6];
+    // key refresh if link was already encrypted
+    if (link->encrypted && status == 0 && enabled){
+        event[0] = HCI_EVENT_ENCRYPTION_KEY_REFRESH_COMPLETE;
+        event[1] = 3;
+        event[2] = 0;
+        bt_store_16(event, 3, link->handle);
+        virtual_emit_event(event, 5);
+        return;
+    }
+    event[0] = HCI_EVENT_ENCRYPTION_CHANGE;
+    event[1] = sizeof(event) - 2;
+    event[2] = status;
+    bt_store_16(event, 3, link->handle);
+    event[5] = enabled;
+    virtual_emit_event(event, sizeof(event));
+    if (status == 0){
+        link->encrypted = enabled;
+    }
+}
+
+static void virtual_emit_number_of_completed_packets(virtual_link_t * link){
+    if (!link->packets_completed) return;
+    uint8_t event[7];
+    event[0] = HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS;
+    event[1] = sizeof(event) - 2;
+    event[2] = 1;
+    bt_store_16(event, 3, link->handle);
+    bt_store_16(event, 5, link->packets_completed);
+    virtual_emit_event(event, sizeof(event));
+    link->packets_in_flight -= link->packets_completed;
+    link->packets_completed = 0;
+}
+
+// peer side
+
+static uint32_t virtual_time_until(uint32_t due_ms){
+    uint32_t now = run_loop_get_time_ms();
+    if ((int32_t)(due_ms - now) <= 0) return 0;
+    return due_ms - now;
+}
+
+static void virtual_air_run(void){
+    data_source_t * ds = hci_transport_virtual->ds;
+    run_loop_remove_timer(&virtual_air_timer);
+
+    while (virtual_air_queue.head){
+        virtual_packet_t * packet = virtual_air_queue.head;
+        if (!ds){
+            // no peer, drop message
+            free(virtual_queue_pop(&virtual_air_queue));
+            continue;
+        }
+        // wait until due, but finish partially written message
+        if (virtual_air_tx_pos == 0){
+            uint32_t delay_ms = virtual_time_until(packet->due_ms);
+            if (delay_ms){
+                run_loop_set_timer(&virtual_air_timer, delay_ms);
+                run_loop_add_timer(&virtual_air_timer);
+                break;
+            }
+        }
+#ifdef HAVE_SO_NOSIGPIPE
+        ssize_t bytes_written = write(ds->fd, &packet->data[virtual_air_tx_pos], packet->size - virtual_air_tx_pos);
+#else
+        ssize_t bytes_written = send(ds->fd, &packet->data[virtual_air_tx_pos], packet->size - virtual_air_tx_pos, MSG_NOSIGNAL);
+#endif
+        if (bytes_written < 0){
+            // peer loss is detected by read
+            if (errno != EAGAIN && errno != EINTR) break;
+            run_loop_enable_data_source_write(ds, 1);
+            break;
+        }
+        virtual_air_tx_pos += bytes_written;
+        if (virtual_air_tx_pos < packet->size) {
+            run_loop_enable_data_source_write(ds, 1);
+            break;
+        }
+        virtual_air_tx_pos = 0;
+        virtual_queue_pop(&virtual_air_queue);
+        if (packet->link){
+            packet->link->packets_completed++;
+        }
+        free(packet);
+    }
+
+    if (ds && !virtual_air_queue.head){
+        run_loop_enable_data_source_write(ds, 0);
+    }
+
+    // report sent packets, one event per link
+    virtual_emit_number_of_completed_packets(&virtual_classic_link);
+    virtual_emit_number_of_completed_packets(&virtual_le_link);
+}
+
+static void virtual_air_timeout_handler(timer_source_t * ts){
+    virtual_air_run();
+}
+
+static virtual_packet_t * virtual_air_alloc(uint8_t type, uint16_t len){
+    virtual_packet_t * packet = virtual_packet_alloc(0, VIRTUAL_AIR_HEADER_SIZE + 1 + len);
+    if (!packet){
+        log_error("virtual: no memory for message to peer");
+        return NULL;
+    }
+    bt_store_16(packet->data, 0, 1 + len);
+    packet->data[VIRTUAL_AIR_HEADER_SIZE] = type;
+    return packet;
+}
+
+static uint8_t * virtual_air_payload(virtual_packet_t * packet){
+    return &packet->data[VIRTUAL_AIR_HEADER_SIZE + 1];
+}
+
+// messages are sent in order. ACL data is delayed by the configured latency and retransmissions
+static void virtual_air_queue_message(virtual_packet_t * packet, uint32_t delay_ms){
+    uint32_t due_ms = run_loop_get_time_ms() + delay_ms;
+    if ((int32_t)(due_ms - virtual_air_last_due_ms) < 0){
+        due_ms = virtual_air_last_due_ms;
+    }
+    packet->due_ms = due_ms;
+    virtual_air_last_due_ms = due_ms;
+    virtual_queue_add(&virtual_air_queue, packet);
+    virtual_air_run();
+}
+
+static void virtual_air_send(uint8_t type, const uint8_t * payload, uint16_t len){
+    if (!hci_transport_virtual->ds) return;
+    virtual_packet_t * packet = virtual_air_alloc(type, len);
+    if (!packet) return;
+    memcpy(virtual_air_payload(packet), payload, len);
+    virtual_air_queue_message(packet, 0);
+}
+
+static void virtual_air_send_acl(virtual_link_t * link, const uint8_t * acl, uint16_t size){
+    virtual_packet_t * packet = virtual_air_alloc(VIRTUAL_AIR_ACL, size);
+    if (!packet) return;
+    memcpy(virtual_air_payload(packet), acl, size);
+    packet->link = link;
+
+    uint32_t delay_ms = virtual_config->latency_ms;
+    if (virtual_config->loss_per_mille){
+        uint32_t retransmit_ms = virtual_config->latency_ms ? virtual_config->latency_ms : 1;
+        while ((virtual_random() % 1000) < virtual_config->loss_per_mille){
+            delay_ms += retransmit_ms;
+        }
+    }
+    virtual_air_queue_message(packet, delay_ms);
+}
+
+static void virtual_air_send_disconnect(virtual_link_t * link, uint8_t reason){
+    uint8_t payload[3];
+    bt_store_16(payload, 0, link->handle);
+    payload[2] = reason;
+    virtual_air_send(VIRTUAL_AIR_DISCONNECT, payload, sizeof(payload));
+}
+
+// drop queued ACL packets of a closed link, they don't get reported as completed
+static void virtual_air_drop_acl(virtual_link_t * link){
+    // keep partially written message to not break framing
+    virtual_packet_t * partial = virtual_air_tx_pos ? virtual_air_queue.head : NULL;
+    virtual_queue_t queue = virtual_air_queue;
+    memset(&virtual_air_queue, 0, sizeof(virtual_air_queue));
+    virtual_packet_t * packet;
+    while ((packet = virtual_queue_pop(&queue)) != NULL){
+        if (packet->link == link){
+            if (packet != partial){
+                free(packet);
+                continue;
+            }
+            packet->link = NULL;
+        }
+        virtual_queue_add(&virtual_air_queue, packet);
+    }
+    link->packets_in_flight = 0;
+    link->packets_completed = 0;
+}
+
+static void virtual_peer_send_state(void){
+    uint8_t state[VIRTUAL_AIR_STATE_SIZE - 1];
+    int pos = 0;
+    BD_ADDR_COPY(&state[pos], virtual_local.address);
+    pos += 6;
+    state[pos++] = virtual_local.scan_enable;
+    bt_store_16(state, pos, virtual_local.class_of_device & 0xffff);
+    state[pos + 2] = virtual_local.class_of_device >> 16;
+    pos += 3;
+    state[pos++] = virtual_local.adv_enabled;
+    state[pos++] = virtual_local.adv_type;
+    bt_store_16(state, pos, virtual_local.adv_interval_ms);
+    pos += 2;
+    state[pos++] = virtual_local.adv_data_len;
+    memcpy(&state[pos], virtual_local.adv_data, VIRTUAL_ADV_DATA_LEN);
+    pos += VIRTUAL_ADV_DATA_LEN;
+    memcpy(&state[pos], virtual_local.name, VIRTUAL_DEVICE_NAME_LEN);
+    virtual_air_send(VIRTUAL_AIR_STATE, state, sizeof(state));
+}
+
+static void virtual_peer_handle_state(const uint8_t * state){
+    int pos = 0;
+    BD_ADDR_COPY(virtual_peer.address, &state[pos]);
+    pos += 6;
+    virtual_peer.scan_enable = state[pos++];
+    virtual_peer.class_of_device = READ_BT_24(state, pos);
+    pos += 3;
+    virtual_peer.adv_enabled = state[pos++];
+    virtual_peer.adv_type = state[pos++];
+    virtual_peer.adv_interval_ms = READ_BT_16(state, pos);
+    pos += 2;
+    virtual_peer.adv_data_len = state[pos++];
+    memcpy(virtual_peer.adv_data, &state[pos], VIRTUAL_ADV_DATA_LEN);
+    pos += VIRTUAL_ADV_DATA_LEN;
+    memcpy(virtual_peer.name, &state[pos], VIRTUAL_DEVICE_NAME_LEN);
+    if (!virtual_peer_known){
+        log_info("virtual: peer %s", bd_addr_to_str(virtual_peer.address));
+    }
+    virtual_peer_known = 1;
+
+    virtual_le_connect_run();
+    virtual_adv_timer_update();
+}
+
+static int virtual_peer_connectable_advertising(void){
+    if (!virtual_peer_known) return 0;
+    if (!virtual_peer.adv_enabled) return 0;
+    // ADV_IND or ADV_DIRECT_IND
+    return virtual_peer.adv_type <= 0x01;
+}
+
+static void virtual_adv_timeout_handler(timer_source_t * ts){
+    if (!virtual_le_scan_enable || !virtual_peer_known || !virtual_peer.adv_enabled) return;
+
+    uint8_t event[14 + VIRTUAL_ADV_DATA_LEN];
+    uint8_t len = virtual_peer.adv_data_len;
+    event[0] = HCI_EVENT_LE_META;
+    event[1] = 12 + len;
+    event[2] = HCI_SUBEVENT_LE_ADVERTISING_REPORT;
+    event[3] = 1;
+    event[4] = virtual_peer.adv_type;   // matches advertising type for legacy advertising
+    event[5] = 0;                       // public address
+    bt_flip_addr(&event[6], virtual_peer.address);
+    event[12] = len;
+    memcpy(&event[13], virtual_peer.adv_data, len);
+    event[13 + len] = (uint8_t) -40;    // rssi
+    virtual_emit_event(event, 14 + len);
+
+    uint16_t interval_ms = virtual_peer.adv_interval_ms;
+    if (interval_ms < VIRTUAL_MIN_ADVERTISING_INTERVAL_MS){
+        interval_ms = VIRTUAL_MIN_ADVERTISING_INTERVAL_MS;
+    }
+    run_loop_set_timer(&virtual_adv_timer, interval_ms);
+    run_loop_add_timer(&virtual_adv_timer);
+}
+
+static void virtual_adv_timer_update(void){
+    run_loop_remove_timer(&virtual_adv_timer);
+    if (!virtual_le_scan_enable || !virtual_peer_known || !virtual_peer.adv_enabled) return;
+    run_loop_set_timer(&virtual_adv_timer, 0);
+    run_loop_add_timer(&virtual_adv_timer);
+}
+
+static void virtual_le_connect_run(void){
+    virtual_link_t * link = &virtual_le_link;
+    if (link->state != VIRTUAL_LINK_W4_PEER) return;
+    if (!virtual_peer_connectable_advertising()) return;
+    uint8_t payload[13];
+    BD_ADDR_COPY(&payload[0], virtual_local.address);
+    bt_store_16(payload, 6, link->conn_interval);
+    bt_store_16(payload, 8, link->conn_latency);
+    bt_store_16(payload, 10, link->supervision_timeout);
+    payload[12] = 0;    // public address
+    virtual_air_send(VIRTUAL_AIR_LE_CONNECT, payload, sizeof(payload));
+}
+
+static void virtual_air_handle_connect(const uint8_t * payload){
+    virtual_link_t * link = &virtual_classic_link;
+    if (link->state != VIRTUAL_LINK_IDLE || !(virtual_local.scan_enable & VIRTUAL_PAGE_SCAN_ENABLE)){
+        uint8_t status = link->state != VIRTUAL_LINK_IDLE ? ERROR_CODE_CONNECTION_REJECTED_DUE_TO_LIMITED_RESOURCES : ERROR_CODE_PAGE_TIMEOUT;
+        virtual_air_send(VIRTUAL_AIR_CONNECT_RESPONSE, &status, 1);
+        return;
+    }
+    link->state = VIRTUAL_LINK_W4_ACCEPT;
+    BD_ADDR_COPY(link->address, payload);
+    uint8_t event[12];
+    event[0] = HCI_EVENT_CONNECTION_REQUEST;
+    event[1] = sizeof(event) - 2;
+    bt_flip_addr(&event[2], link->address);
+    memcpy(&event[8], &payload[6], 3);  // class of device
+    event[11] = 1;  // ACL
+    virtual_emit_event(event, sizeof(event));
+}
+
+static void virtual_air_handle_connect_response(uint8_t status){
+    virtual_link_t * link = &virtual_classic_link;
+    if (link->state != VIRTUAL_LINK_W4_PEER) return;
+    virtual_emit_connection_complete(link, status);
+    if (status){
+        virtual_link_reset(link);
+        return;
+    }
+    link->state = VIRTUAL_LINK_OPEN;
+}
+
+static void virtual_air_handle_le_connect(const uint8_t * payload){
+    virtual_link_t * link = &virtual_le_link;
+    if (link->state != VIRTUAL_LINK_IDLE) return;
+    if (!virtual_local.adv_enabled || virtual_local.adv_type > 0x01) return;
+
+    // advertising stops when a connection is established
+    virtual_local.adv_enabled = 0;
+    virtual_peer_send_state();
+
+    link->state = VIRTUAL_LINK_OPEN;
+    BD_ADDR_COPY(link->address, payload);
+    link->conn_interval       = READ_BT_16(payload, 6);
+    link->conn_latency        = READ_BT_16(payload, 8);
+    link->supervision_timeout = READ_BT_16(payload, 10);
+    link->address_type        = payload[12];
+    virtual_emit_le_connection_complete(link, 0, 1);   // slave
+
+    uint8_t status = 0;
+    virtual_air_send(VIRTUAL_AIR_LE_CONNECT_RESPONSE, &status, 1);
+}
+
+static void virtual_air_handle_le_connect_response(uint8_t status){
+    virtual_link_t * link = &virtual_le_link;
+    if (link->state != VIRTUAL_LINK_W4_PEER) return;
+    virtual_emit_le_connection_complete(link, status, 0);  // master
+    if (status){
+        virtual_link_reset(link);
+        return;
+    }
+    link->state = VIRTUAL_LINK_OPEN;
+}
+
+static void virtual_air_handle_disconnect(const uint8_t * payload){
+    virtual_link_t * link = virtual_link_for_handle(READ_BT_16(payload, 0));
+    if (!link) return;
+    uint8_t reason = payload[2];
+    switch (link->state){
+        case VIRTUAL_LINK_OPEN:
+            virtual_air_drop_acl(link);
+            virtual_emit_disconnection_complete(link, reason);
+            break;
+        case VIRTUAL_LINK_W4_ACCEPT:
+            // connection attempt cancelled by peer
+            virtual_emit_connection_complete(link, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+            break;
+        default:
+            return;
+    }
+    virtual_link_reset(link);
+}
+
+static void virtual_air_handle_acl(const uint8_t * acl, uint16_t size){
+    virtual_link_t * link = virtual_link_for_handle(READ_ACL_CONNECTION_HANDLE(acl));
+    if (!link || link->state != VIRTUAL_LINK_OPEN) return;
+    // controller reports first fragments as flushable
+    uint8_t packet[HCI_PACKET_BUFFER_SIZE];
+    memcpy(packet, acl, size);
+    if ((READ_ACL_FLAGS(packet) & 0x03) == 0x00){
+        packet[1] |= 0x02 << 4;
+    }
+    virtual_host_send(HCI_ACL_DATA_PACKET, packet, size);
+}
+
+static void virtual_air_handle_le_encrypt(const uint8_t * payload){
+    virtual_link_t * link = &virtual_le_link;
+    if (link->state != VIRTUAL_LINK_OPEN) return;
+    // store ltk of master to verify reply from host
+    memcpy(link->ltk, &payload[10], 16);
+    uint8_t event[15];
+    event[0] = HCI_EVENT_LE_META;
+    event[1] = sizeof(event) - 2;
+    event[2] = HCI_SUBEVENT_LE_LONG_TERM_KEY_REQUEST;
+    bt_store_16(event, 3, link->handle);
+    memcpy(&event[5], payload, 10);     // random number, ediv
+    virtual_emit_event(event, sizeof(event));
+}
+
+static void virtual_air_handle_le_encrypt_response(uint8_t status){
+    virtual_link_t * link = &virtual_le_link;
+    if (link->state != VIRTUAL_LINK_OPEN) return;
+    virtual_emit_encryption_change(link, status, status == 0);
+}
+
+static void virtual_air_handle_le_connection_update(const uint8_t * payload){
+    virtual_link_t * link = &virtual_le_link;
+    if (link->state != VIRTUAL_LINK_OPEN) return;
+    link->conn_interval       = READ_BT_16(payload, 0);
+    link->conn_latency        = READ_BT_16(payload, 2);
+    link->supervision_timeout = READ_BT_16(payload, 4);
+    virtual_emit_le_connection_update_complete(link);
+}
+
+static void virtual_air_handle_message(const uint8_t * message, uint16_t size){
+    const uint8_t * payload = &message[1];
+    uint16_t payload_len = size - 1;
+    switch (message[0]){
+        case VIRTUAL_AIR_STATE:
+            if (size < VIRTUAL_AIR_STATE_SIZE) break;
+            virtual_peer_handle_state(payload);
+            break;
+        case VIRTUAL_AIR_CONNECT:
+            if (payload_len < 9) break;
+            virtual_air_handle_connect(payload);
+            break;
+        case VIRTUAL_AIR_CONNECT_RESPONSE:
+            if (payload_len < 1) break;
+            virtual_air_handle_connect_response(payload[0]);
+            break;
+        case VIRTUAL_AIR_LE_CONNECT:
+            if (payload_len < 13) break;
+            virtual_air_handle_le_connect(payload);
+            break;
+        case VIRTUAL_AIR_LE_CONNECT_RESPONSE:
+            if (payload_len < 1) break;
+            virtual_air_handle_le_connect_response(payload[0]);
+            break;
+        case VIRTUAL_AIR_DISCONNECT:
+            if (payload_len < 3) break;
+            virtual_air_handle_disconnect(payload);
+            break;
+        case VIRTUAL_AIR_ACL:
+            if (payload_len < 4 || payload_len > HCI_PACKET_BUFFER_SIZE) break;
+            virtual_air_handle_acl(payload, payload_len);
+            break;
+        case VIRTUAL_AIR_LE_ENCRYPT:
+            if (payload_len < 26) break;
+            virtual_air_handle_le_encrypt(payload);
+            break;
+        case VIRTUAL_AIR_LE_ENCRYPT_RESPONSE:
+            if (payload_len < 1) break;
+            virtual_air_handle_le_encrypt_response(payload[0]);
+            break;
+        case VIRTUAL_AIR_LE_CONNECTION_UPDATE:
+            if (payload_len < 6) break;
+            virtual_air_handle_le_connection_update(payload);
+            break;
+        default:
+            log_error("virtual: unknown message 0x%02x from peer", message[0]);
+            break;
+    }
+}
+
+static void virtual_peer_lost(void){
+    data_source_t * ds = hci_transport_virtual->ds;
+    log_info("virtual: peer lost");
+    run_loop_remove_data_source(ds);
+    close(ds->fd);
+    free(ds);
+    hci_transport_virtual->ds = NULL;
+    virtual_queue_free(&virtual_air_queue);
+    virtual_air_tx_pos = 0;
+    virtual_air_rx_len = 0;
+    virtual_peer_known = 0;
+    virtual_adv_timer_update();
+
+    // links to peer time out, pending LE connection waits for next advertiser
+    virtual_link_t * links[] = { &virtual_classic_link, &virtual_le_link };
+    int i;
+    for (i = 0; i < 2; i++){
+        virtual_link_t * link = links[i];
+        switch (link->state){
+            case VIRTUAL_LINK_OPEN:
+                link->packets_in_flight = 0;
+                link->packets_completed = 0;
+                virtual_emit_disconnection_complete(link, ERROR_CODE_CONNECTION_TIMEOUT);
+                virtual_link_reset(link);
+                break;
+            case VIRTUAL_LINK_W4_ACCEPT:
+                virtual_emit_connection_complete(link, ERROR_CODE_CONNECTION_TIMEOUT);
+                virtual_link_reset(link);
+                break;
+            case VIRTUAL_LINK_W4_PEER:
+                if (link == &virtual_le_link) break;
+                virtual_emit_connection_complete(link, ERROR_CODE_PAGE_TIMEOUT);
+                virtual_link_reset(link);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // wait for next peer
+    if (!hci_transport_virtual->listen_ds){
+        virtual_peer_open();
+    }
+}
+
+static int virtual_peer_process(data_source_t * ds){
+    if (ds->write_enabled){
+        virtual_air_run();
+    }
+
+    ssize_t bytes_read = read(ds->fd, &virtual_air_rx_buffer[virtual_air_rx_len], sizeof(virtual_air_rx_buffer) - virtual_air_rx_len);
+    if (bytes_read == 0 || (bytes_read < 0 && errno != EAGAIN && errno != EINTR)){
+        virtual_peer_lost();
+        return 0;
+    }
+    if (bytes_read < 0) return 0;
+    virtual_air_rx_len += bytes_read;
+
+    // handle all complete messages
+    int pos = 0;
+    while (virtual_air_rx_len - pos >= VIRTUAL_AIR_HEADER_SIZE){
+        uint16_t size = READ_BT_16(virtual_air_rx_buffer, pos);
+        if (size == 0 || size > VIRTUAL_AIR_MAX_MESSAGE){
+            log_error("virtual: invalid message size %u from peer", size);
+            virtual_peer_lost();
+            return 0;
+        }
+        if (virtual_air_rx_len - pos < VIRTUAL_AIR_HEADER_SIZE + size) break;
+        virtual_air_handle_message(&virtual_air_rx_buffer[pos + VIRTUAL_AIR_HEADER_SIZE], size);
+        pos += VIRTUAL_AIR_HEADER_SIZE + size;
+        if (!hci_transport_virtual->ds) return 0;
+    }
+    virtual_air_rx_len -= pos;
+    memmove(virtual_air_rx_buffer, &virtual_air_rx_buffer[pos], virtual_air_rx_len);
+    return 0;
+}
+
+static void virtual_peer_attach(int fd){
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#ifdef HAVE_SO_NOSIGPIPE
+    int set = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, (void *)&set, sizeof(int));
+#endif
+    data_source_t * ds = (data_source_t*) malloc(sizeof(data_source_t));
+    if (!ds){
+        close(fd);
+        return;
+    }
+    ds->fd = fd;
+    ds->process = virtual_peer_process;
+    run_loop_add_data_source(ds);
+    hci_transport_virtual->ds = ds;
+    virtual_air_tx_pos = 0;
+    virtual_air_rx_len = 0;
+    virtual_air_last_due_ms = run_loop_get_time_ms();
+    log_info("virtual: connected to peer via %s", virtual_config->peer_path);
+    virtual_peer_send_state();
+}
+
+static int virtual_peer_accept(data_source_t * ds){
+    int fd = accept(ds->fd, NULL, NULL);
+    if (fd < 0) return 0;
+    // only a single peer is supported
+    if (hci_transport_virtual->ds){
+        close(fd);
+        return 0;
+    }
+    virtual_peer_attach(fd);
+    return 0;
+}
+
+// connect to a waiting peer, or become the listening side
+static void virtual_peer_open(void){
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, virtual_config->peer_path, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return;
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0){
+        virtual_peer_attach(fd);
+        return;
+    }
+    close(fd);
+
+    // remove stale socket
+    unlink(virtual_config->peer_path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return;
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 1) < 0){
+        log_error("virtual: cannot listen on %s", virtual_config->peer_path);
+        close(fd);
+        return;
+    }
+    data_source_t * ds = (data_source_t*) malloc(sizeof(data_source_t));
+    if (!ds){
+        close(fd);
+        return;
+    }
+    ds->fd = fd;
+    ds->process = virtual_peer_accept;
+    run_loop_add_data_source(ds);
+    hci_transport_virtual->listen_ds = ds;
+    log_info("virtual: waiting for peer on %s", virtual_config->peer_path);
+}
+
+// HCI commands
+
+static void virtual_reset(uint16_t opcode, const uint8_t * params){
+    // drop links without events, peer sees a timeout
+    virtual_link_t * links[] = { &virtual_classic_link, &virtual_le_link };
+    int i;
+    for (i = 0; i < 2; i++){
+        virtual_link_t * link = links[i];
+        if (link->state == VIRTUAL_LINK_OPEN){
+            virtual_air_drop_acl(link);
+            virtual_air_send_disconnect(link, ERROR_CODE_CONNECTION_TIMEOUT);
+        }
+        virtual_link_reset(link);
+    }
+    virtual_local.scan_enable = 0;
+    virtual_local.adv_enabled = 0;
+    virtual_le_scan_enable = 0;
+    virtual_inquiry_mode = 0;
+    virtual_adv_timer_update();
+    virtual_peer_send_state();
+    virtual_emit_command_complete_status(opcode, 0);
+}
+
+static void virtual_read_local_version_information(uint16_t opcode, const uint8_t * params){
+    uint8_t result[9];
+    result[0] = 0;
+    result[1] = 0x06;               // HCI version 4.0
+    bt_store_16(result, 2, 0);      // HCI revision
+    result[4] = 0x06;               // LMP version 4.0
+    bt_store_16(result, 5, 0xffff); // manufacturer: internal use
+    bt_store_16(result, 7, 0);      // LMP subversion
+    virtual_emit_command_complete(opcode, result, sizeof(result));
+}
+
+static void virtual_read_bd_addr(uint16_t opcode, const uint8_t * params){
+    uint8_t result[7];
+    result[0] = 0;
+    bt_flip_addr(&result[1], virtual_local.address);
+    virtual_emit_command_complete(opcode, result, sizeof(result));
+}
+
+static void virtual_read_buffer_size(uint16_t opcode, const uint8_t * params){
+    uint8_t result[8];
+    result[0] = 0;
+    bt_store_16(result, 1, virtual_acl_data_packet_length);
+    result[3] = 0;                  // no SCO
+    bt_store_16(result, 4, virtual_acl_packets_total_num);
+    bt_store_16(result, 6, 0);
+    virtual_emit_command_complete(opcode, result, sizeof(result));
+}
+
+static void virtual_read_local_supported_commands(uint16_t opcode, const uint8_t * params){
+    uint8_t result[65];
+    memset(result, 0, sizeof(result));
+    result[1 + 14] = 0x80;  // Read Buffer Size
+    result[1 + 24] = 0x40;  // Write LE Host Supported
+    virtual_emit_command_complete(opcode, result, sizeof(result));
+}
+
+static void virtual_read_local_supported_features(uint16_t opcode, const uint8_t * params){
+    uint8_t result[9];
+    result[0] = 0;
+    memcpy(&result[1], virtual_local_supported_features, 8);
+    virtual_emit_command_complete(opcode, result, sizeof(result));
+}
+
+static void virtual_write_scan_enable(uint16_t opcode, const uint8_t * params){
+    virtual_local.scan_enable = params[0];
+    virtual_peer_send_state();
+    virtual_emit_command_complete_status(opcode, 0);
+}
+
+static void virtual_write_class_of_device(uint16_t opcode, const uint8_t * params){
+    virtual_local.class_of_device = READ_BT_24(params, 0);
+    virtual_peer_send_state();
+    virtual_emit_command_complete_status(opcode, 0);
+}
+
+static void virtual_write_local_name(uint16_t opcode, const uint8_t * params){
+    memcpy(virtual_local.name, params, VIRTUAL_DEVICE_NAME_LEN);
+    virtual_peer_send_state();
+    virtual_emit_command_complete_status(opcode, 0);
+}
+
+static void virtual_write_inquiry_mode(uint16_t opcode, const uint8_t * params){
+    virtual_inquiry_mode = params[0];
+    virtual_emit_command_complete_status(opcode, 0);
+}
+
+static void virtual_host_number_of_completed_packets(uint16_t opcode, const uint8_t * params){
+    // no event for this command
+}
+
+static void virtual_inquiry(uint16_t opcode, const uint8_t * params){
+    virtual_emit_command_status(opcode, 0);
+    if (virtual_peer_known && (virtual_peer.scan_enable & VIRTUAL_INQUIRY_SCAN_ENABLE)){
+        uint8_t event[17];
+        event[0] = virtual_inquiry_mode ? HCI_EVENT_INQUIRY_RESULT_WITH_RSSI : HCI_EVENT_INQUIRY_RESULT;
+        event[1] = 15;
+        event[2] = 1;
+        bt_flip_addr(&event[3], virtual_peer.address);
+        event[9] = 1;       // page scan repetition mode
+        event[10] = 0;
+        int pos = 11;
+        if (!virtual_inquiry_mode){
+            event[pos++] = 0;
+        }
+        bt_store_16(event, pos, virtual_peer.class_of_device & 0xffff);
+        event[pos + 2] = virtual_peer.class_of_device >> 16;
+        bt_store_16(event, pos + 3, 0);  // clock offset
+        if (virtual_inquiry_mode){
+            event[pos + 5] = (uint8_t) -40;
+        }
+        virtual_emit_event(event, sizeof(event));
+    }
+    uint8_t event[3] = { HCI_EVENT_INQUIRY_COMPLETE, 1, 0};
+    virtual_emit_event(event, sizeof(event));
+}
+
+static void virtual_create_connection(uint16_t opcode, const uint8_t * params){
+    virtual_link_t * link = &virtual_classic_link;
+    if (link->state != VIRTUAL_LINK_IDLE){
+        virtual_emit_command_status(opcode, ERROR_CODE_ACL_CONNECTION_ALREADY_EXISTS);
+        return;
+    }
+    virtual_emit_command_status(opcode, 0);
+    // any address reaches the peer
+    bt_flip_addr(link->address, (uint8_t *) params);
+    if (!virtual_peer_known || !(virtual_peer.scan_enable & VIRTUAL_PAGE_SCAN_ENABLE)){
+        virtual_emit_connection_complete(link, ERROR_CODE_PAGE_TIMEOUT);
+        virtual_link_reset(link);
+        return;
+    }
+    link->state = VIRTUAL_LINK_W4_PEER;
+    uint8_t payload[9];
+    BD_ADDR_COPY(payload, virtual_local.address);
+    bt_store_16(payload, 6, virtual_local.class_of_device & 0xffff);
+    payload[8] = virtual_local.class_of_device >> 16;
+    virtual_air_send(VIRTUAL_AIR_CONNECT, payload, sizeof(payload));
+}
+
+static void virtual_create_connection_cancel(uint16_t opcode, const uint8_t * params){
+    virtual_link_t * link = &virtual_classic_link;
+    uint8_t result[7];
+    result[0] = link->state == VIRTUAL_LINK_W4_PEER ? 0 : ERROR_CODE_COMMAND_DISALLOWED;
+    memcpy(&result[1], params, 6);
+    virtual_emit_command_complete(opcode, result, sizeof(result));
+    if (link->state != VIRTUAL_LINK_W4_PEER) return;
+    virtual_air_send_disconnect(link, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+    virtual_emit_connection_complete(link, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+    virtual_link_reset(link);
+}
+
+static void virtual_accept_connection_request(uint16_t opcode, const uint8_t * params){
+    virtual_link_t * link = &virtual_classic_link;
+    if (link->state != VIRTUAL_LINK_W4_ACCEPT){
+        virtual_emit_command_status(opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+        return;
+    }
+    virtual_emit_command_status(opcode, 0);
+    link->state = VIRTUAL_LINK_OPEN;
+    virtual_emit_connection_complete(link, 0);
+    uint8_t status = 0;
+    virtual_air_send(VIRTUAL_AIR_CONNECT_RESPONSE, &status, 1);
+}
+
+static void virtual_reject_connection_request(uint16_t opcode, const uint8_t * params){
+    virtual_link_t * link = &virtual_classic_link;
+    if (link->state != VIRTUAL_LINK_W4_ACCEPT){
+        virtual_emit_command_status(opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+        return;
+    }
+    virtual_emit_command_status(opcode, 0);
+    uint8_t reason = params[6];
+    virtual_emit_connection_complete(link, reason);
+    virtual_link_reset(link);
+    virtual_air_send(VIRTUAL_AIR_CONNECT_RESPONSE, &reason, 1);
+}
+
+static void virtual_disconnect(uint16_t opcode, const uint8_t * params){
+    virtual_link_t * link = virtual_link_for_handle(READ_BT_16(params, 0));
+    if (!link || link->state != VIRTUAL_LINK_OPEN){
+        virtual_emit_command_status(opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+        return;
+    }
+    virtual_emit_command_status(opcode, 0);
+    virtual_air_drop_acl(link);
+    virtual_air_send_disconnect(link, params[2]);
+    virtual_emit_disconnection_complete(link, ERROR_CODE_CONNECTION_TERMINATED_BY_LOCAL_HOST);
+    virtual_link_reset(link);
+}
+
+static void virtual_authentication_requested(uint16_t opcode, const uint8_t * params){
+    virtual_link_t * link = virtual_link_for_handle(READ_BT_16(params, 0));
+    if (!link || link->state != VIRTUAL_LINK_OPEN){
+        virtual_emit_command_status(opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+        return;
+    }
+    virtual_emit_command_status(opcode, 0);
+    // pairing is not modelled, report new unauthenticated link key
+    uint8_t event[25];
+    event[0] = HCI_EVENT_LINK_KEY_NOTIFICATION;
+    event[1] = sizeof(event) - 2;
+    bt_flip_addr(&event[2], link->address);
+    int i;
+    for (i = 0; i < 16; i++){
+        event[8 + i] = virtual_random();
+    }
+    event[24] = UNAUTHENTICATED_COMBINATION_KEY_GENERATED_FROM_P192;
+    virtual_emit_event(event, sizeof(event));
+    uint8_t complete[5];
+    complete[0] = HCI_EVENT_AUTHENTICATION_COMPLETE_EVENT;
+    complete[1] = sizeof(complete) - 2;
+    complete[2] = 0;
+    bt_store_16(complete, 3, link->handle);
+    virtual_emit_event(complete, sizeof(complete));
+}
+
+static void virtual_set_connection_encryption(uint16_t opcode, const uint8_t * params){
+    virtual_link_t * link = virtual_link_for_handle(READ_BT_16(params, 0));
+    if (!link || link->state != VIRTUAL_LINK_OPEN){
+        virtual_emit_command_status(opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+        return;
+    }
+    virtual_emit_command_status(opcode, 0);
+    virtual_emit_encryption_change(link, 0, params[2]);
+}
+
+static void virtual_remote_name_request(uint16_t opcode, const uint8_t * params){
+    virtual_emit_command_status(opcode, 0);
+    uint8_t event[2 + 1 + 6 + VIRTUAL_DEVICE_NAME_LEN];
+    event[0] = HCI_EVENT_REMOTE_NAME_REQUEST_COMPLETE;
+    event[1] = sizeof(event) - 2;
+    event[2] = virtual_peer_known ? 0 : ERROR_CODE_PAGE_TIMEOUT;
+    memcpy(&event[3], params, 6);
+    memcpy(&event[9], virtual_peer.name, VIRTUAL_DEVICE_NAME_LEN);
+    virtual_emit_event(event, sizeof(event));
+}
+
+static void virtual_read_remote_supported_features(uint16_t opcode, const uint8_t * params){
+    virtual_link_t * link = virtual_link_for_handle(READ_BT_16(params, 0));
+    if (!link || link->state != VIRTUAL_LINK_OPEN){
+        virtual_emit_command_status(opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+        return;
+    }
+    virtual_emit_command_status(opcode, 0);
+    uint8_t event[13];
+    event[0] = HCI_EVENT_READ_REMOTE_SUPPORTED_FEATURES_COMPLETE;
+    event[1] = sizeof(event) - 2;
+    event[2] = 0;
+    bt_store_16(event, 3, link->handle);
+    memcpy(&event[5], virtual_local_supported_features, 8);
+    virtual_emit_event(event, sizeof(event));
+}
+
+static void virtual_le_read_buffer_size(uint16_t opcode, const uint8_t * params){
+    uint8_t result[4];
+    result[0] = 0;
+    bt_store_16(result, 1, virtual_le_data_packets_length);
+    result[3] = virtual_le_acl_packets_total_num;
+    virtual_emit_command_complete(opcode, result, sizeof(result));
+}
+
+static void virtual_le_read_supported_features(uint16_t opcode, const uint8_t * params){
+    uint8_t result[9];
+    result[0] = 0;
+    memcpy(&result[1], virtual_le_supported_features, 8);
+    virtual_emit_command_complete(opcode, result, sizeof(result));
+}
+
+static void virtual_le_read_white_list_size(uint16_t opcode, const uint8_t * params){
+    uint8_t result[2] = { 0, VIRTUAL_LE_WHITE_LIST_SIZE };
+    virtual_emit_command_complete(opcode, result, sizeof(result));
+}
+
+static void virtual_le_set_advertising_parameters(uint16_t opcode, const uint8_t * params){
+    // interval in 0.625 ms units
+    virtual_local.adv_interval_ms = READ_BT_16(params, 0) * 5 / 8;
+    virtual_local.adv_type = params[4];
+    virtual_emit_command_complete_status(opcode, 0);
+}
+
+static void virtual_le_set_advertising_data(uint16_t opcode, const uint8_t * params){
+    uint8_t len = params[0];
+    if (len > VIRTUAL_ADV_DATA_LEN){
+        len = VIRTUAL_ADV_DATA_LEN;
+    }
+    virtual_local.adv_data_len = len;
+    memcpy(virtual_local.adv_data, &params[1], len);
+    virtual_peer_send_state();
+    virtual_emit_command_complete_status(opcode, 0);
+}
+
+static void virtual_le_set_advertise_enable(uint16_t opcode, const uint8_t * params){
+    virtual_local.adv_enabled = params[0];
+    virtual_peer_send_state();
+    virtual_emit_command_complete_status(opcode, 0);
+}
+
+static void virtual_le_set_scan_enable(uint16_t opcode, const uint8_t * params){
+    virtual_le_scan_enable = params[0];
+    virtual_adv_timer_update();
+    virtual_emit_command_complete_status(opcode, 0);
+}
+
+static void virtual_le_create_connection(uint16_t opcode, const uint8_t * params){
+    virtual_link_t * link = &virtual_le_link;
+    if (link->state != VIRTUAL_LINK_IDLE){
+        virtual_emit_command_status(opcode, ERROR_CODE_COMMAND_DISALLOWED);
+        return;
+    }
+    virtual_emit_command_status(opcode, 0);
+    // any address reaches the peer
+    link->state               = VIRTUAL_LINK_W4_PEER;
+    link->address_type        = params[5];
+    bt_flip_addr(link->address, (uint8_t *) &params[6]);
+    link->conn_interval       = READ_BT_16(params, 13);
+    link->conn_latency        = READ_BT_16(params, 17);
+    link->supervision_timeout = READ_BT_16(params, 19);
+    virtual_le_connect_run();
+}
+
+static void virtual_le_create_connection_cancel(uint16_t opcode, const uint8_t * params){
+    virtual_link_t * link = &virtual_le_link;
+    if (link->state != VIRTUAL_LINK_W4_PEER){
+        virtual_emit_command_complete_status(opcode, ERROR_CODE_COMMAND_DISALLOWED);
+        return;
+    }
+    virtual_emit_command_complete_status(opcode, 0);
+    virtual_emit_le_connection_complete(link, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER, 0);
+    virtual_link_reset(link);
+}
+
+static void virtual_le_connection_update(uint16_t opcode, const uint8_t * params){
+    virtual_link_t * link = virtual_link_for_handle(READ_BT_16(params, 0));
+    if (link != &virtual_le_link || link->state != VIRTUAL_LINK_OPEN){
+        virtual_emit_command_status(opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+        return;
+    }
+    virtual_emit_command_status(opcode, 0);
+    link->conn_interval       = READ_BT_16(params, 2);
+    link->conn_latency        = READ_BT_16(params, 6);
+    link->supervision_timeout = READ_BT_16(params, 8);
+    virtual_emit_le_connection_update_complete(link);
+    uint8_t payload[6];
+    bt_store_16(payload, 0, link->conn_interval);
+    bt_store_16(payload, 2, link->conn_latency);
+    bt_store_16(payload, 4, link->supervision_timeout);
+    virtual_air_send(VIRTUAL_AIR_LE_CONNECTION_UPDATE, payload, sizeof(payload));
+}
+
+static void virtual_le_read_remote_used_features(uint16_t opcode, const uint8_t * params){
+    virtual_link_t * link = virtual_link_for_handle(READ_BT_16(params, 0));
+    if (link != &virtual_le_link || link->state != VIRTUAL_LINK_OPEN){
+        virtual_emit_command_status(opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+        return;
+    }
+    virtual_emit_command_status(opcode, 0);
+    uint8_t event[14];
+    event[0] = HCI_EVENT_LE_META;
+    event[1] = sizeof(event) - 2;
+    event[2] = HCI_SUBEVENT_LE_READ_REMOTE_USED_FEATURES_COMPLETE;
+    event[3] = 0;
+    bt_store_16(event, 4, link->handle);
+    memcpy(&event[6], virtual_le_supported_features, 8);
+    virtual_emit_event(event, sizeof(event));
+}
+
+static void virtual_le_encrypt(uint16_t opcode, const uint8_t * params){
+    // HCI uses little endian byte order
+    uint8_t key[16];
+    uint8_t plaintext[16];
+    uint8_t ciphertext[16];
+    swap128(&params[0], key);
+    swap128(&params[16], plaintext);
+    uint32_t rk[RKLENGTH(KEYBITS)];
+    int nrounds = rijndaelSetupEncrypt(rk, key, KEYBITS);
+    rijndaelEncrypt(rk, nrounds, plaintext, ciphertext);
+    uint8_t result[17];
+    result[0] = 0;
+    swap128(ciphertext, &result[1]);
+    virtual_emit_command_complete(opcode, result, sizeof(result));
+}
+
+static void virtual_le_rand(uint16_t opcode, const uint8_t * params){
+    uint8_t result[9];
+    result[0] = 0;
+    int i;
+    for (i = 1; i < 9; i++){
+        result[i] = virtual_random();
+    }
+    virtual_emit_command_complete(opcode, result, sizeof(result));
+}
+
+static void virtual_le_start_encryption(uint16_t opcode, const uint8_t * params){
+    virtual_link_t * link = virtual_link_for_handle(READ_BT_16(params, 0));
+    if (link != &virtual_le_link || link->state != VIRTUAL_LINK_OPEN){
+        virtual_emit_command_status(opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+        return;
+    }
+    virtual_emit_command_status(opcode, 0);
+    // random number, ediv, ltk
+    virtual_air_send(VIRTUAL_AIR_LE_ENCRYPT, &params[2], 26);
+}
+
+static void virtual_le_long_term_key_reply(uint16_t opcode, const uint8_t * params, int positive){
+    uint16_t handle = READ_BT_16(params, 0);
+    virtual_link_t * link = virtual_link_for_handle(handle);
+    uint8_t result[3];
+    result[0] = (link == &virtual_le_link && link->state == VIRTUAL_LINK_OPEN) ? 0 : ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+    bt_store_16(result, 1, handle);
+    virtual_emit_command_complete(opcode, result, sizeof(result));
+    if (result[0]) return;
+    uint8_t status = 0;
+    if (!positive || memcmp(link->ltk, &params[2], 16) != 0){
+        status = ERROR_CODE_PIN_OR_KEY_MISSING;
+    }
+    virtual_emit_encryption_change(link, status, status == 0);
+    virtual_air_send(VIRTUAL_AIR_LE_ENCRYPT_RESPONSE, &status, 1);
+}
+
+static void virtual_le_long_term_key_request_reply(uint16_t opcode, const uint8_t * params){
+    virtual_le_long_term_key_reply(opcode, params, 1);
+}
+
+static void virtual_le_long_term_key_negative_reply(uint16_t opcode, const uint8_t * params){
+    virtual_le_long_term_key_reply(opcode, params, 0);
+}
+
+static const virtual_command_handler_t virtual_command_handlers[] = {
+    { &hci_reset,                                virtual_reset },
+    { &hci_read_local_version_information,       virtual_read_local_version_information },
+    { &hci_read_bd_addr,                         virtual_read_bd_addr },
+    { &hci_read_buffer_size,                     virtual_read_buffer_size },
+    { &hci_read_local_supported_commands,        virtual_read_local_supported_commands },
+    { &hci_read_local_supported_features,        virtual_read_local_supported_features },
+    { &hci_write_scan_enable,                    virtual_write_scan_enable },
+    { &hci_write_class_of_device,                virtual_write_class_of_device },
+    { &hci_write_local_name,                     virtual_write_local_name },
+    { &hci_write_inquiry_mode,                   virtual_write_inquiry_mode },
+    { &hci_host_number_of_completed_packets,     virtual_host_number_of_completed_packets },
+    { &hci_inquiry,                              virtual_inquiry },
+    { &hci_create_connection,                    virtual_create_connection },
+    { &hci_create_connection_cancel,             virtual_create_connection_cancel },
+    { &hci_accept_connection_request,            virtual_accept_connection_request },
+    { &hci_reject_connection_request,            virtual_reject_connection_request },
+    { &hci_disconnect,                           virtual_disconnect },
+    { &hci_authentication_requested,             virtual_authentication_requested },
+    { &hci_set_connection_encryption,            virtual_set_connection_encryption },
+    { &hci_remote_name_request,                  virtual_remote_name_request },
+    { &hci_read_remote_supported_features_command, virtual_read_remote_supported_features },
+    { &hci_le_read_buffer_size,                  virtual_le_read_buffer_size },
+    { &hci_le_read_supported_features,           virtual_le_read_supported_features },
+    { &hci_le_read_white_list_size,              virtual_le_read_white_list_size },
+    { &hci_le_set_advertising_parameters,        virtual_le_set_advertising_parameters },
+    { &hci_le_set_advertising_data,              virtual_le_set_advertising_data },
+    { &hci_le_set_advertise_enable,              virtual_le_set_advertise_enable },
+    { &hci_le_set_scan_enable,                   virtual_le_set_scan_enable },
+    { &hci_le_create_connection,                 virtual_le_create_connection },
+    { &hci_le_create_connection_cancel,          virtual_le_create_connection_cancel },
+    { &hci_le_connection_update,                 virtual_le_connection_update },
+    { &hci_le_read_remote_used_features,         virtual_le_read_remote_used_features },
+    { &hci_le_encrypt,                           virtual_le_encrypt },
+    { &hci_le_rand,                              virtual_le_rand },
+    { &hci_le_start_encryption,                  virtual_le_start_encryption },
+    { &hci_le_long_term_key_request_reply,       virtual_le_long_term_key_request_reply },
+    { &hci_le_long_term_key_negative_reply,      virtual_le_long_term_key_negative_reply },
+};
+
+static void virtual_handle_command(const uint8_t * packet, int size){
+    uint16_t opcode = READ_BT_16(packet, 0);
+    unsigned int i;
+    for (i = 0; i < sizeof(virtual_command_handlers) / sizeof(virtual_command_handler_t); i++){
+        if (virtual_command_handlers[i].cmd->opcode != opcode) continue;
+        // parameters are accessed without further checks
+        uint8_t params[255];
+        memset(params, 0, sizeof(params));
+        memcpy(params, &packet[3], size - 3);
+        virtual_command_handlers[i].handler(opcode, params);
+        return;
+    }
+    switch (READ_CMD_OGF(packet)){
+        case OGF_LINK_CONTROL:
+            // commands that would require a response from the peer
+            virtual_emit_command_status(opcode, ERROR_CODE_UNKNOWN_HCI_COMMAND);
+            break;
+        case OGF_VENDOR:
+            virtual_emit_command_complete_status(opcode, ERROR_CODE_UNKNOWN_HCI_COMMAND);
+            break;
+        default:
+            // accept configuration without further processing
+            virtual_emit_command_complete_status(opcode, 0);
+            break;
+    }
+}
+
+static void virtual_handle_acl(const uint8_t * packet, int size){
+    virtual_link_t * link = virtual_link_for_handle(READ_ACL_CONNECTION_HANDLE(packet));
+    if (!link || link->state != VIRTUAL_LINK_OPEN){
+        log_error("virtual: ACL packet for unknown handle 0x%04x", READ_ACL_CONNECTION_HANDLE(packet));
+        return;
+    }
+    int le = link == &virtual_le_link;
+    uint16_t max_length = le ? virtual_le_data_packets_length : virtual_acl_data_packet_length;
+    uint16_t buffers    = le ? virtual_le_acl_packets_total_num : virtual_acl_packets_total_num;
+    if (READ_ACL_LENGTH(packet) > max_length){
+        log_error("virtual: ACL packet with %u bytes exceeds buffer size %u", READ_ACL_LENGTH(packet), max_length);
+    }
+    if (link->packets_in_flight >= buffers){
+        log_error("virtual: host exceeds %u %s ACL buffers", buffers, le ? "LE" : "classic");
+    }
+    link->packets_in_flight++;
+    virtual_air_send_acl(link, packet, size);
+}
+
+// transport
+
+static int virtual_open(void *transport_config){
+    virtual_config = (hci_transport_virtual_config_t *) transport_config;
+    if (!virtual_config || !virtual_config->peer_path) return -1;
+
+    virtual_acl_data_packet_length   = virtual_config->acl_data_packet_length   ? virtual_config->acl_data_packet_length   : VIRTUAL_ACL_DATA_PACKET_LENGTH;
+    virtual_acl_packets_total_num    = virtual_config->acl_packets_total_num    ? virtual_config->acl_packets_total_num    : VIRTUAL_ACL_PACKETS_TOTAL_NUM;
+    virtual_le_data_packets_length   = virtual_config->le_data_packets_length   ? virtual_config->le_data_packets_length   : VIRTUAL_LE_DATA_PACKETS_LENGTH;
+    virtual_le_acl_packets_total_num = virtual_config->le_acl_packets_total_num ? virtual_config->le_acl_packets_total_num : VIRTUAL_LE_ACL_PACKETS_TOTAL_NUM;
+
+    memset(&virtual_local, 0, sizeof(virtual_local));
+    memset(&virtual_peer,  0, sizeof(virtual_peer));
+    BD_ADDR_COPY(virtual_local.address, virtual_config->bd_addr);
+    virtual_peer_known = 0;
+    virtual_le_scan_enable = 0;
+    virtual_inquiry_mode = 0;
+    virtual_classic_link.handle = VIRTUAL_CLASSIC_HANDLE;
+    virtual_le_link.handle      = VIRTUAL_LE_HANDLE;
+    virtual_link_reset(&virtual_classic_link);
+    virtual_link_reset(&virtual_le_link);
+    virtual_random_state = READ_NET_32(virtual_local.address, 2);
+
+    virtual_peer_open();
+    if (!hci_transport_virtual->ds && !hci_transport_virtual->listen_ds) return -1;
+    return 0;
+}
+
+static int virtual_close(void *transport_config){
+    run_loop_remove_timer(&virtual_host_timer);
+    run_loop_remove_timer(&virtual_air_timer);
+    run_loop_remove_timer(&virtual_adv_timer);
+    virtual_host_timer_active = 0;
+    virtual_queue_free(&virtual_host_queue);
+    virtual_queue_free(&virtual_air_queue);
+
+    data_source_t * ds = hci_transport_virtual->ds;
+    if (ds){
+        run_loop_remove_data_source(ds);
+        close(ds->fd);
+        free(ds);
+        hci_transport_virtual->ds = NULL;
+    }
+    ds = hci_transport_virtual->listen_ds;
+    if (ds){
+        run_loop_remove_data_source(ds);
+        close(ds->fd);
+        free(ds);
+        hci_transport_virtual->listen_ds = NULL;
+        unlink(virtual_config->peer_path);
+    }
+    virtual_config = NULL;
+    return 0;
+}
+
+static int virtual_send_packet(uint8_t packet_type, uint8_t *packet, int size){
+    switch (packet_type){
+        case HCI_COMMAND_DATA_PACKET:
+            if (size < 3) return -1;
+            virtual_handle_command(packet, size);
+            break;
+        case HCI_ACL_DATA_PACKET:
+            if (size < 4) return -1;
+            virtual_handle_acl(packet, size);
+            break;
+        default:
+            // SCO is not supported
+            return -1;
+    }
+    return 0;
+}
+
+static void virtual_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    packet_handler = handler;
+}
+
+static const char * virtual_get_transport_name(void){
+    return "VIRTUAL";
+}
+
+static void dummy_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
+}
+
+// get virtual singleton
+hci_transport_t * hci_transport_virtual_instance(void) {
+    if (hci_transport_virtual == NULL) {
+        hci_transport_virtual = (hci_transport_virtual_t*) malloc( sizeof(hci_transport_virtual_t));
+        memset(hci_transport_virtual, 0, sizeof(hci_transport_virtual_t));
+        hci_transport_virtual->transport.open                     = virtual_open;
+        hci_transport_virtual->transport.close                    = virtual_close;
+        hci_transport_virtual->transport.send_packet              = virtual_send_packet;
+        hci_transport_virtual->transport.register_packet_handler  = virtual_register_packet_handler;
+        hci_transport_virtual->transport.get_transport_name       = virtual_get_transport_name;
+        hci_transport_virtual->transport.set_baudrate             = NULL;
+        hci_transport_virtual->transport.can_send_packet_now      = NULL;
+        hci_transport_virtual->transport.get_packet_receive_timestamp_us = virtual_get_packet_receive_timestamp_us;
+        packet_handler = dummy_handler;
+
+        run_loop_set_timer_handler(&virtual_host_timer, virtual_host_timeout_handler);
+        run_loop_set_timer_handler(&virtual_air_timer, virtual_air_timeout_handler);
+        run_loop_set_timer_handler(&virtual_adv_timer, virtual_adv_timeout_handler);
+    }
+    return (hci_transport_t *) hci_transport_virtual;
+}
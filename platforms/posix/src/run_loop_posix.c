@@ -51,27 +51,95 @@
 #include "Winsock2.h"
 #else
 #include <sys/select.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#ifdef USE_EPOLL_RUN_LOOP
+#include <errno.h>
+#include <poll.h>
+#include <sys/epoll.h>
 #endif
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 static void posix_dump_timer(void);
 static int posix_timeval_compare(struct timeval *a, struct timeval *b);
 static int posix_timer_compare(timer_source_t *a, timer_source_t *b);
+#ifndef _WIN32
+static void posix_callback_queue_open(void);
+#endif
 
 // the run loop
 static linked_list_t data_sources;
 static int data_sources_modified;
-static linked_list_t timers;
 static struct timeval init_tv;
+
+// monotonic time, updated once per iteration after waiting for data sources and timers
+static struct timeval now_tv;
+
+static void posix_update_now(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    now_tv.tv_sec  = now.tv_sec;
+    now_tv.tv_usec = now.tv_nsec / 1000;
+}
+
+#ifdef ENABLE_RUN_LOOP_PROFILING
+// current monotonic time in us, independent of once per iteration now_tv
+static uint32_t posix_get_time_us(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+#endif
+
+/**
+ * Call data source handler
+ */
+static void posix_process_data_source(data_source_t *ds){
+#ifdef ENABLE_RUN_LOOP_PROFILING
+    // handler might re-use data source
+    int (*process)(data_source_t *ds) = ds->process;
+    uint32_t start_us = posix_get_time_us();
+    process(ds);
+    run_loop_profiling_handler_executed((void (*)(void)) process, 0, posix_get_time_us() - start_us, 0);
+#else
+    ds->process(ds);
+#endif
+}
+
+/**
+ * Call timer handler
+ */
+static void posix_process_timer(timer_source_t *ts){
+#ifdef ENABLE_RUN_LOOP_PROFILING
+    // handler might re-use timer
+    void (*process)(timer_source_t *ts) = ts->process;
+    uint32_t timeout_us = (uint32_t) ts->timeout.tv_sec * 1000000 + ts->timeout.tv_usec;
+    uint32_t start_us   = posix_get_time_us();
+    process(ts);
+    run_loop_profiling_handler_executed((void (*)(void)) process, 1, posix_get_time_us() - start_us, start_us - timeout_us);
+#else
+    ts->process(ts);
+#endif
+}
+
 /**
  * Add data_source to run_loop
  */
-static void posix_add_data_source(data_source_t *ds){
+static int posix_add_data_source(data_source_t *ds){
     data_sources_modified = 1;
     // log_info("posix_add_data_source %x with fd %u\n", (int) ds, ds->fd);
     linked_list_add(&data_sources, (linked_item_t *) ds);
+    return 0;
 }
 
 /**
@@ -84,23 +152,19 @@ static int posix_remove_data_source(data_source_t *ds){
 }
 
 /**
- * Add timer to run_loop (keep list sorted)
+ * Enable/Disable write callback for data_source, fd sets are collected on every iteration
  */
-static void posix_add_timer(timer_source_t *ts){
-    linked_item_t *it;
-    for (it = (linked_item_t *) &timers; it->next ; it = it->next){
-        if ((timer_source_t *) it->next == ts){
-            log_error( "run_loop_timer_add error: timer to add already in list!");
-            return;
-        }
-        if (posix_timer_compare( (timer_source_t *) it->next, ts) > 0) {
-            break;
-        }
-    }
-    ts->item.next = it->next;
-    it->next = (linked_item_t *) ts;
+static void posix_enable_data_source_write(data_source_t *ds, int enabled){
+    ds->write_enabled = enabled;
+}
+
+/**
+ * Add timer to run_loop (keep heap ordered)
+ */
+static int posix_add_timer(timer_source_t *ts){
     // log_info("Added timer %x at %u\n", (int) ts, (unsigned int) ts->timeout.tv_sec);
     // posix_dump_timer();
+    return run_loop_timer_heap_add(ts);
 }
 
 /**
@@ -109,26 +173,63 @@ static void posix_add_timer(timer_source_t *ts){
 static int posix_remove_timer(timer_source_t *ts){
     // log_info("Removed timer %x at %u\n", (int) ts, (unsigned int) ts->timeout.tv_sec);
     // posix_dump_timer();
-    return linked_list_remove(&timers, (linked_item_t *) ts);
+    return run_loop_timer_heap_remove(ts);
 }
 
 static void posix_dump_timer(void){
-    linked_item_t *it;
-    int i = 0;
-    for (it = (linked_item_t *) timers; it ; it = it->next){
-        timer_source_t *ts = (timer_source_t*) it;
+    int i;
+    for (i = 0; i < run_loop_timer_heap_size(); i++){
+        timer_source_t *ts = run_loop_timer_heap_get(i);
         log_info("timer %u, timeout %u\n", i, (unsigned int) ts->timeout.tv_sec);
     }
 }
 
+/**
+ * Get time until next timer expires, returns NULL if there is no timer
+ */
+static struct timeval * posix_get_next_timeout(struct timeval * next_tv){
+    // pre: 0 <= tv_usec < 1000000
+    timer_source_t * ts = run_loop_timer_heap_first();
+    if (!ts) return NULL;
+    // handlers of this iteration took time as well
+    posix_update_now();
+    next_tv->tv_usec = ts->timeout.tv_usec - now_tv.tv_usec;
+    next_tv->tv_sec  = ts->timeout.tv_sec  - now_tv.tv_sec;
+    while (next_tv->tv_usec < 0){
+        next_tv->tv_usec += 1000000;
+        next_tv->tv_sec--;
+    }
+    if (next_tv->tv_sec < 0){
+        next_tv->tv_sec  = 0; 
+        next_tv->tv_usec = 0;
+    }
+    return next_tv;
+}
+
+/**
+ * Process expired timers
+ */
+static void posix_process_timers(void){
+    // pre: 0 <= tv_usec < 1000000
+    timer_source_t * ts;
+    while ((ts = run_loop_timer_heap_first()) != NULL) {
+        if (ts->timeout.tv_sec  > now_tv.tv_sec) break;
+        if (ts->timeout.tv_sec == now_tv.tv_sec && ts->timeout.tv_usec > now_tv.tv_usec) break;
+        // log_info("posix_execute: process times %x\n", (int) ts);
+        
+        // remove timer before processing it to allow handler to re-register with run loop
+        run_loop_remove_timer(ts);
+        posix_process_timer(ts);
+    }
+}
+
 /**
  * Execute run_loop
  */
 static void posix_execute(void) {
     fd_set descriptors;
+    fd_set write_descriptors;
     
-    timer_source_t       *ts;
-    struct timeval current_tv;
     struct timeval next_tv;
     struct timeval *timeout;
     linked_list_iterator_t it;
@@ -136,12 +237,16 @@ static void posix_execute(void) {
     while (1) {
         // collect FDs
         FD_ZERO(&descriptors);
+        FD_ZERO(&write_descriptors);
         int highest_fd = 0;
         linked_list_iterator_init(&it, &data_sources);
         while (linked_list_iterator_has_next(&it)){
             data_source_t *ds = (data_source_t*) linked_list_iterator_next(&it);
             if (ds->fd >= 0) {
                 FD_SET(ds->fd, &descriptors);
+                if (ds->write_enabled){
+                    FD_SET(ds->fd, &write_descriptors);
+                }
                 if (ds->fd > highest_fd) {
                     highest_fd = ds->fd;
                 }
@@ -149,26 +254,11 @@ static void posix_execute(void) {
         }
         
         // get next timeout
-        // pre: 0 <= tv_usec < 1000000
-        timeout = NULL;
-        if (timers) {
-            gettimeofday(&current_tv, NULL);
-            ts = (timer_source_t *) timers;
-            next_tv.tv_usec = ts->timeout.tv_usec - current_tv.tv_usec;
-            next_tv.tv_sec  = ts->timeout.tv_sec  - current_tv.tv_sec;
-            while (next_tv.tv_usec < 0){
-                next_tv.tv_usec += 1000000;
-                next_tv.tv_sec--;
-            }
-            if (next_tv.tv_sec < 0){
-                next_tv.tv_sec  = 0; 
-                next_tv.tv_usec = 0;
-            }
-            timeout = &next_tv;
-        }
+        timeout = posix_get_next_timeout(&next_tv);
                 
         // wait for ready FDs
-        select( highest_fd+1 , &descriptors, NULL, NULL, timeout);
+        select( highest_fd+1 , &descriptors, &write_descriptors, NULL, timeout);
+        posix_update_now();
         
         // process data sources very carefully
         // bt_control.close() triggered from a client can remove a different data source
@@ -179,35 +269,24 @@ static void posix_execute(void) {
         while (linked_list_iterator_has_next(&it) && !data_sources_modified){
             data_source_t *ds = (data_source_t*) linked_list_iterator_next(&it);
             // log_info("posix_execute: check %x with fd %u\n", (int) ds, ds->fd);
-            if (FD_ISSET(ds->fd, &descriptors)) {
+            if (FD_ISSET(ds->fd, &descriptors) || FD_ISSET(ds->fd, &write_descriptors)) {
                 // log_info("posix_execute: process %x with fd %u\n", (int) ds, ds->fd);
-                ds->process(ds);
+                posix_process_data_source(ds);
             }
         }
         // log_info("posix_execute: after ds check\n");
         
         // process timers
-        // pre: 0 <= tv_usec < 1000000
-        while (timers) {
-            gettimeofday(&current_tv, NULL);
-            ts = (timer_source_t *) timers;
-            if (ts->timeout.tv_sec  > current_tv.tv_sec) break;
-            if (ts->timeout.tv_sec == current_tv.tv_sec && ts->timeout.tv_usec > current_tv.tv_usec) break;
-            // log_info("posix_execute: process times %x\n", (int) ts);
-            
-            // remove timer before processing it to allow handler to re-register with run loop
-            run_loop_remove_timer(ts);
-            ts->process(ts);
-        }
+        posix_process_timers();
     }
 }
 
 // set timer
 static void posix_set_timer(timer_source_t *a, uint32_t timeout_in_ms){
-    gettimeofday(&a->timeout, NULL);
+    a->timeout = now_tv;
     a->timeout.tv_sec  +=  timeout_in_ms / 1000;
     a->timeout.tv_usec += (timeout_in_ms % 1000) * 1000;
-    if (a->timeout.tv_usec  > 1000000) {
+    if (a->timeout.tv_usec >= 1000000) {
         a->timeout.tv_usec -= 1000000;
         a->timeout.tv_sec++;
     }
@@ -249,20 +328,337 @@ static int posix_timer_compare(timer_source_t *a, timer_source_t *b){
 
 static void posix_init(void){
     data_sources = NULL;
-    timers = NULL;
-    gettimeofday(&init_tv, NULL);
+    run_loop_timer_heap_init(&posix_timer_compare);
+    posix_update_now();
+    init_tv = now_tv;
+#ifndef _WIN32
+    posix_callback_queue_open();
+#endif
 }
 
 /**
  * @brief Queries the current time in ms since start
  */
 static uint32_t posix_get_time_ms(void){
-    struct timeval current_tv;
-    gettimeofday(&current_tv, NULL);
-    return (current_tv.tv_sec  - init_tv.tv_sec)  * 1000
-         + (current_tv.tv_usec - init_tv.tv_usec) / 1000;
+    return (now_tv.tv_sec  - init_tv.tv_sec)  * 1000
+         + (now_tv.tv_usec - init_tv.tv_usec) / 1000;
+}
+
+#ifdef USE_EPOLL_RUN_LOOP
+
+// epoll variant: data sources stay registered with the kernel, only ready ones are visited
+
+// max number of ready data sources handled per iteration, more are handled in the next one
+#define EPOLL_MAX_EVENTS 16
+
+// max number of data sources epoll cannot watch, e.g. regular files (EPERM) or fds used by another data source (EEXIST)
+#define EPOLL_MAX_FALLBACK_SOURCES 4
+
+static int epoll_fd = -1;
+static struct epoll_event epoll_events[EPOLL_MAX_EVENTS];
+static int epoll_events_pos;
+static int epoll_events_num;
+
+// fallback data sources are polled together with the epoll fd
+static data_source_t * epoll_fallback_sources[EPOLL_MAX_FALLBACK_SOURCES];
+static int epoll_fallback_num;
+static data_source_t * epoll_fallback_ready[EPOLL_MAX_FALLBACK_SOURCES];
+static int epoll_fallback_ready_pos;
+static int epoll_fallback_ready_num;
+
+static int epoll_ctl_data_source(int op, data_source_t *ds){
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events   = EPOLLIN;
+    if (ds->write_enabled){
+        event.events |= EPOLLOUT;
+    }
+    event.data.ptr = ds;
+    return epoll_ctl(epoll_fd, op, ds->fd, &event);
+}
+
+static int epoll_fallback_index(data_source_t *ds){
+    int i;
+    for (i = 0; i < epoll_fallback_num; i++){
+        if (epoll_fallback_sources[i] == ds) return i;
+    }
+    return -1;
 }
 
+static int epoll_add_data_source(data_source_t *ds){
+    if (ds->fd < 0) return 0;
+    if (epoll_ctl_data_source(EPOLL_CTL_ADD, ds) == 0) return 0;
+    if (errno != EPERM && errno != EEXIST){
+        log_error("epoll_add_data_source: cannot add fd %u, errno %u", ds->fd, errno);
+        return -1;
+    }
+    if (epoll_fallback_num >= EPOLL_MAX_FALLBACK_SOURCES){
+        log_error("epoll_add_data_source: cannot add fd %u, errno %u, too many fallback data sources", ds->fd, errno);
+        return -1;
+    }
+    log_info("epoll_add_data_source: fd %u not supported by epoll, errno %u, using poll", ds->fd, errno);
+    epoll_fallback_sources[epoll_fallback_num++] = ds;
+    return 0;
+}
+
+static int epoll_remove_data_source(data_source_t *ds){
+    // don't call removed data source for events already collected in this iteration
+    int i;
+    for (i = epoll_events_pos; i < epoll_events_num; i++){
+        if (epoll_events[i].data.ptr == ds){
+            epoll_events[i].data.ptr = NULL;
+        }
+    }
+    for (i = epoll_fallback_ready_pos; i < epoll_fallback_ready_num; i++){
+        if (epoll_fallback_ready[i] == ds){
+            epoll_fallback_ready[i] = NULL;
+        }
+    }
+    int index = epoll_fallback_index(ds);
+    if (index >= 0){
+        epoll_fallback_num--;
+        memmove(&epoll_fallback_sources[index], &epoll_fallback_sources[index + 1], (epoll_fallback_num - index) * sizeof(data_source_t *));
+        return 0;
+    }
+    if (ds->fd < 0) return 0;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_DEL, ds->fd, NULL);
+}
+
+static void epoll_enable_data_source_write(data_source_t *ds, int enabled){
+    if (ds->write_enabled == enabled) return;
+    ds->write_enabled = enabled;
+    if (ds->fd < 0) return;
+    // fallback data sources get their poll events on every iteration
+    if (epoll_fallback_index(ds) >= 0) return;
+    epoll_ctl_data_source(EPOLL_CTL_MOD, ds);
+}
+
+// waits for epoll fd and fallback data sources, collects ready fallback data sources
+static void epoll_poll_fallback_data_sources(int timeout_ms){
+    struct pollfd fds[1 + EPOLL_MAX_FALLBACK_SOURCES];
+    int num_fds = 1 + epoll_fallback_num;
+    int i;
+    memset(fds, 0, sizeof(fds));
+    fds[0].fd     = epoll_fd;
+    fds[0].events = POLLIN;
+    for (i = 0; i < epoll_fallback_num; i++){
+        fds[1 + i].fd     = epoll_fallback_sources[i]->fd;
+        fds[1 + i].events = epoll_fallback_sources[i]->write_enabled ? POLLIN | POLLOUT : POLLIN;
+    }
+    epoll_fallback_ready_pos = 0;
+    epoll_fallback_ready_num = 0;
+    if (poll(fds, num_fds, timeout_ms) < 0){
+        if (errno != EINTR){
+            log_error("epoll_execute: poll failed, errno %u", errno);
+        }
+        return;
+    }
+    for (i = 0; i < epoll_fallback_num; i++){
+        if (!fds[1 + i].revents) continue;
+        epoll_fallback_ready[epoll_fallback_ready_num++] = epoll_fallback_sources[i];
+    }
+}
+
+static void epoll_execute(void) {
+    struct timeval next_tv;
+    while (1) {
+        // get next timeout, rounded up to not wake up before timer expires
+        int timeout_ms = -1;
+        struct timeval * timeout = posix_get_next_timeout(&next_tv);
+        if (timeout){
+            timeout_ms = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+        }
+
+        // wait for epoll fd and fallback data sources, regular files are always ready
+        if (epoll_fallback_num){
+            epoll_poll_fallback_data_sources(timeout_ms);
+            timeout_ms = 0;
+        }
+
+        // wait for ready FDs
+        epoll_events_num = epoll_wait(epoll_fd, epoll_events, EPOLL_MAX_EVENTS, timeout_ms);
+        posix_update_now();
+        if (epoll_events_num < 0){
+            if (errno != EINTR){
+                log_error("epoll_execute: epoll_wait failed, errno %u", errno);
+            }
+            epoll_events_num = 0;
+        }
+
+        // process ready data sources, handlers might remove other data sources
+        for (epoll_events_pos = 0; epoll_events_pos < epoll_events_num; epoll_events_pos++){
+            data_source_t *ds = (data_source_t *) epoll_events[epoll_events_pos].data.ptr;
+            if (!ds) continue;
+            posix_process_data_source(ds);
+        }
+        epoll_events_num = 0;
+        for (epoll_fallback_ready_pos = 0; epoll_fallback_ready_pos < epoll_fallback_ready_num; epoll_fallback_ready_pos++){
+            data_source_t *ds = epoll_fallback_ready[epoll_fallback_ready_pos];
+            if (!ds) continue;
+            posix_process_data_source(ds);
+        }
+        epoll_fallback_ready_num = 0;
+
+        // process timers
+        posix_process_timers();
+    }
+}
+
+static void epoll_init(void){
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0){
+        log_error("epoll_init: epoll_create1 failed, errno %u", errno);
+    }
+    // adds data source for callback queue
+    posix_init();
+}
+
+#endif
+
+#ifndef _WIN32
+
+// Vyukov's intrusive MPSC queue: add is wait-free, the run loop might see an item that is not linked yet
+// and stops processing then, but the producer of that item will wake it up once more afterwards
+
+static void posix_queue_push(run_loop_posix_queue_t * queue, run_loop_posix_queue_item_t * item){
+    item->next = NULL;
+    run_loop_posix_queue_item_t * prev = __atomic_exchange_n(&queue->head, item, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, item, __ATOMIC_RELEASE);
+}
+
+static run_loop_posix_queue_item_t * posix_queue_pop(run_loop_posix_queue_t * queue){
+    run_loop_posix_queue_item_t * tail = queue->tail;
+    run_loop_posix_queue_item_t * next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (tail == &queue->stub){
+        if (!next) return NULL;
+        queue->tail = next;
+        tail = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+    if (next){
+        queue->tail = next;
+        return tail;
+    }
+    // producer has not linked the next item yet
+    if (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE)) return NULL;
+    // tail is last item, re-insert stub to be able to take it
+    posix_queue_push(queue, &queue->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (!next) return NULL;
+    queue->tail = next;
+    return tail;
+}
+
+static void posix_queue_process_items(run_loop_posix_queue_t * queue){
+    run_loop_posix_queue_item_t * item;
+    while ((item = posix_queue_pop(queue)) != NULL){
+        queue->process(queue, item);
+    }
+}
+
+static int posix_queue_process(data_source_t * ds){
+    run_loop_posix_queue_t * queue = (run_loop_posix_queue_t *) ds;
+
+    // drain wakeup fd
+    uint8_t buffer[8];
+    while (read(ds->fd, buffer, sizeof(buffer)) > 0);
+
+    // clear flag before taking items, producers that add items later will signal again
+    __atomic_store_n(&queue->wakeup_pending, 0, __ATOMIC_SEQ_CST);
+    posix_queue_process_items(queue);
+    return 0;
+}
+
+int run_loop_posix_queue_open(run_loop_posix_queue_t * queue, void (*process)(run_loop_posix_queue_t * queue, run_loop_posix_queue_item_t * item)){
+#ifdef __linux__
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        log_error("run_loop_posix_queue_open: eventfd failed");
+        return -1;
+    }
+    queue->ds.fd = fd;
+    queue->wakeup_fd = fd;
+#else
+    int fds[2];
+    if (pipe(fds) < 0) {
+        log_error("run_loop_posix_queue_open: pipe failed");
+        return -1;
+    }
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+    queue->ds.fd = fds[0];
+    queue->wakeup_fd = fds[1];
+#endif
+    queue->wakeup_pending = 0;
+    queue->stub.next = NULL;
+    queue->head = &queue->stub;
+    queue->tail = &queue->stub;
+    queue->process = process;
+    queue->ds.process = posix_queue_process;
+    if (run_loop_add_data_source(&queue->ds) < 0){
+        if (queue->wakeup_fd != queue->ds.fd){
+            close(queue->wakeup_fd);
+        }
+        close(queue->ds.fd);
+        queue->ds.fd = -1;
+        queue->wakeup_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void run_loop_posix_queue_add(run_loop_posix_queue_t * queue, run_loop_posix_queue_item_t * item){
+    posix_queue_push(queue, item);
+    // only the first producer since the run loop took items writes to the wakeup fd
+    if (__atomic_exchange_n(&queue->wakeup_pending, 1, __ATOMIC_SEQ_CST)) return;
+#ifdef __linux__
+    uint64_t value = 1;
+    ssize_t res = write(queue->wakeup_fd, &value, sizeof(value));
+#else
+    uint8_t value = 1;
+    ssize_t res = write(queue->wakeup_fd, &value, sizeof(value));
+#endif
+    (void) res;
+}
+
+void run_loop_posix_queue_close(run_loop_posix_queue_t * queue){
+    run_loop_remove_data_source(&queue->ds);
+    posix_queue_process_items(queue);
+    if (queue->wakeup_fd != queue->ds.fd){
+        close(queue->wakeup_fd);
+    }
+    close(queue->ds.fd);
+    queue->ds.fd = -1;
+    queue->wakeup_fd = -1;
+}
+
+// callbacks from other threads
+
+static run_loop_posix_queue_t posix_callback_queue;
+static int posix_callback_queue_is_open;
+
+static void posix_callback_queue_process(run_loop_posix_queue_t * queue, run_loop_posix_queue_item_t * item){
+    run_loop_callback_t * callback_registration = (run_loop_callback_t *) item;
+    callback_registration->callback(callback_registration->context);
+}
+
+static void posix_callback_queue_open(void){
+    posix_callback_queue_is_open = run_loop_posix_queue_open(&posix_callback_queue, &posix_callback_queue_process) == 0;
+    if (!posix_callback_queue_is_open){
+        log_error("posix_callback_queue_open: cannot open queue, execute on main thread not available");
+    }
+}
+
+static void posix_execute_on_main_thread(run_loop_callback_t * callback_registration){
+    if (!posix_callback_queue_is_open){
+        log_error("posix_execute_on_main_thread: callback queue not open, dropping callback %p", callback_registration);
+        return;
+    }
+    run_loop_posix_queue_add(&posix_callback_queue, (run_loop_posix_queue_item_t *) callback_registration);
+}
+
+#endif
+
 run_loop_t run_loop_posix = {
     &posix_init,
     &posix_add_data_source,
@@ -273,4 +669,26 @@ run_loop_t run_loop_posix = {
     &posix_execute,
     &posix_dump_timer,
     &posix_get_time_ms,
+    &posix_enable_data_source_write,
+#ifndef _WIN32
+    &posix_execute_on_main_thread,
+#else
+    NULL,
+#endif
+};
+
+#ifdef USE_EPOLL_RUN_LOOP
+run_loop_t run_loop_epoll = {
+    &epoll_init,
+    &epoll_add_data_source,
+    &epoll_remove_data_source,
+    &posix_set_timer,
+    &posix_add_timer,
+    &posix_remove_timer,
+    &epoll_execute,
+    &posix_dump_timer,
+    &posix_get_time_ms,
+    &epoll_enable_data_source_write,
+    &posix_execute_on_main_thread,
 };
+#endif
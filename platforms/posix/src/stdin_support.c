@@ -40,6 +40,7 @@
 #include <btstack/run_loop.h>
 #include <stdlib.h>
 
+#include "debug.h"
 #include "stdin_support.h"
 
 #ifndef _WIN32
@@ -64,7 +65,9 @@ void btstack_stdin_setup(int (*stdin_process)(data_source_t *_ds)){
 
     stdin_source.fd = 0; // stdin
     stdin_source.process = stdin_process;
-    run_loop_add_data_source(&stdin_source);
+    if (run_loop_add_data_source(&stdin_source) < 0){
+        log_error("btstack_stdin_setup: cannot add stdin to run loop");
+    }
 
     activated = 1;
 }
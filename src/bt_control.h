@@ -73,7 +73,8 @@ typedef struct {
     int          (*baudrate_cmd)(void * config, uint32_t baudrate, uint8_t *hci_cmd_buffer); 
     
     /** support custom init sequences after RESET command - cmd has to be stored in hci_cmd_buffer
-      * @return have command
+      * @return have command: 0 = done, 1 = send and wait for completion, 2 = CSR warm boot,
+      *         3 = send without waiting, as long as the controller accepts more commands
       */
     int          (*next_cmd)(void *config, uint8_t * hci_cmd_buffer); 
 
@@ -84,6 +84,38 @@ void btstack_memory_hci_connection_free(hci_connection_t *hci_connection){
 #endif
 
 
+// MARK: hci_acl_recombination_buffer_t
+#ifdef MAX_NO_HCI_ACL_RECOMBINATION_BUFFERS
+#if MAX_NO_HCI_ACL_RECOMBINATION_BUFFERS > 0
+static hci_acl_recombination_buffer_t hci_acl_recombination_buffer_storage[MAX_NO_HCI_ACL_RECOMBINATION_BUFFERS];
+static memory_pool_t hci_acl_recombination_buffer_pool;
+hci_acl_recombination_buffer_t * btstack_memory_hci_acl_recombination_buffer_get(void){
+    return (hci_acl_recombination_buffer_t *) memory_pool_get(&hci_acl_recombination_buffer_pool);
+}
+void btstack_memory_hci_acl_recombination_buffer_free(hci_acl_recombination_buffer_t *hci_acl_recombination_buffer){
+    memory_pool_free(&hci_acl_recombination_buffer_pool, hci_acl_recombination_buffer);
+}
+#else
+hci_acl_recombination_buffer_t * btstack_memory_hci_acl_recombination_buffer_get(void){
+    return NULL;
+}
+void btstack_memory_hci_acl_recombination_buffer_free(hci_acl_recombination_buffer_t *hci_acl_recombination_buffer){
+    // silence compiler warning about unused parameter in a portable way
+    (void) hci_acl_recombination_buffer;
+};
+#endif
+#elif defined(HAVE_MALLOC)
+hci_acl_recombination_buffer_t * btstack_memory_hci_acl_recombination_buffer_get(void){
+    return (hci_acl_recombination_buffer_t*) malloc(sizeof(hci_acl_recombination_buffer_t));
+}
+void btstack_memory_hci_acl_recombination_buffer_free(hci_acl_recombination_buffer_t *hci_acl_recombination_buffer){
+    free(hci_acl_recombination_buffer);
+}
+#else
+#error "Neither HAVE_MALLOC nor MAX_NO_HCI_ACL_RECOMBINATION_BUFFERS for struct hci_acl_recombination_buffer is defined. Please, edit the config file."
+#endif
+
+
 
 // MARK: l2cap_service_t
 #ifdef MAX_NO_L2CAP_SERVICES
@@ -577,6 +609,9 @@ void btstack_memory_init(void){
 #if MAX_NO_HCI_CONNECTIONS > 0
     memory_pool_create(&hci_connection_pool, hci_connection_storage, MAX_NO_HCI_CONNECTIONS, sizeof(hci_connection_t));
 #endif
+#if MAX_NO_HCI_ACL_RECOMBINATION_BUFFERS > 0
+    memory_pool_create(&hci_acl_recombination_buffer_pool, hci_acl_recombination_buffer_storage, MAX_NO_HCI_ACL_RECOMBINATION_BUFFERS, sizeof(hci_acl_recombination_buffer_t));
+#endif
 #if MAX_NO_L2CAP_SERVICES > 0
     memory_pool_create(&l2cap_service_pool, l2cap_service_storage, MAX_NO_L2CAP_SERVICES, sizeof(l2cap_service_t));
 #endif
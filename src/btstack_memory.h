@@ -74,9 +74,11 @@ void btstack_memory_init(void);
 
 /* API_END */
 
-// hci_connection
+// hci_connection, hci_acl_recombination_buffer
 hci_connection_t * btstack_memory_hci_connection_get(void);
 void   btstack_memory_hci_connection_free(hci_connection_t *hci_connection);
+hci_acl_recombination_buffer_t * btstack_memory_hci_acl_recombination_buffer_get(void);
+void   btstack_memory_hci_acl_recombination_buffer_free(hci_acl_recombination_buffer_t *hci_acl_recombination_buffer);
 
 // l2cap_service, l2cap_channel
 l2cap_service_t * btstack_memory_l2cap_service_get(void);
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/**
+ * interface to persist controller information across restarts
+ */
+
+#ifndef __CONTROLLER_INFO_DB_H
+#define __CONTROLLER_INFO_DB_H
+
+#include <btstack/utils.h>
+
+#include <stdint.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+/* API_START */
+
+typedef struct {
+
+    // identity: from HCI Read Local Version Information and HCI Read BD ADDR
+    uint8_t   hci_version;
+    uint16_t  hci_revision;
+    uint8_t   lmp_version;
+    uint16_t  manufacturer;
+    uint16_t  lmp_subversion;
+    bd_addr_t bd_addr;
+
+    // capabilities: as reported by the controller, not limited by local buffer sizes
+    uint8_t  local_supported_commands[1];
+    uint8_t  local_supported_features[8];
+    uint16_t acl_data_packet_length;
+    uint8_t  sco_data_packet_length;
+    uint16_t acl_packets_total_num;
+    uint16_t sco_packets_total_num;
+    uint16_t le_data_packets_length;
+    uint8_t  le_acl_packets_total_num;
+    uint16_t le_whitelist_capacity;
+
+} controller_info_t;
+
+typedef struct {
+
+    // returns 1 if controller info was found
+    int  (*get_controller_info)(controller_info_t * controller_info);
+    void (*put_controller_info)(controller_info_t * controller_info);
+    void (*delete_controller_info)(void);
+
+} controller_info_db_t;
+
+/*
+ * @brief File-based implementation, stores controller info in /tmp
+ */
+extern const controller_info_db_t controller_info_db_fs;
+
+/* API_END */
+
+#if defined __cplusplus
+}
+#endif
+
+#endif // __CONTROLLER_INFO_DB_H
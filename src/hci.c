@@ -101,6 +101,160 @@ static hci_stack_t * hci_stack = NULL;
 // test helper
 static uint8_t disable_l2cap_timeouts = 0;
 
+// connections are indexed by handle and by address in small hash tables
+static int hci_connection_handle_hash(hci_con_handle_t con_handle){
+    return con_handle & (HCI_CONNECTION_HASH_SIZE - 1);
+}
+
+static int hci_connection_address_hash(bd_addr_t addr, bd_addr_type_t addr_type){
+    return (addr[5] ^ addr[4] ^ addr_type) & (HCI_CONNECTION_HASH_SIZE - 1);
+}
+
+static void hci_connection_index_add(hci_connection_t * conn){
+    int handle_hash  = hci_connection_handle_hash(conn->con_handle);
+    conn->next_for_handle = hci_stack->connections_for_handle[handle_hash];
+    hci_stack->connections_for_handle[handle_hash] = conn;
+    int address_hash = hci_connection_address_hash(conn->address, conn->address_type);
+    conn->next_for_address = hci_stack->connections_for_address[address_hash];
+    hci_stack->connections_for_address[address_hash] = conn;
+}
+
+static void hci_connection_index_remove(hci_connection_t * conn){
+    hci_connection_t ** it;
+    for (it = &hci_stack->connections_for_handle[hci_connection_handle_hash(conn->con_handle)]; *it ; it = &(*it)->next_for_handle){
+        if (*it != conn) continue;
+        *it = conn->next_for_handle;
+        break;
+    }
+    for (it = &hci_stack->connections_for_address[hci_connection_address_hash(conn->address, conn->address_type)]; *it ; it = &(*it)->next_for_address){
+        if (*it != conn) continue;
+        *it = conn->next_for_address;
+        break;
+    }
+}
+
+// traffic statistics are counted per connection and in total
+static void hci_statistics_count_acl_fragment_sent(hci_connection_t * conn, uint16_t size){
+    conn->statistics.acl_fragments_sent++;
+    conn->statistics.acl_bytes_sent += size;
+    hci_stack->statistics.acl_fragments_sent++;
+    hci_stack->statistics.acl_bytes_sent += size;
+}
+
+static void hci_statistics_count_acl_received(hci_connection_t * conn, uint16_t size){
+    conn->statistics.acl_packets_received++;
+    conn->statistics.acl_bytes_received += size;
+    hci_stack->statistics.acl_packets_received++;
+    hci_stack->statistics.acl_bytes_received += size;
+}
+
+static void hci_statistics_count_acl_recombination_drop(hci_connection_t * conn){
+    conn->statistics.acl_recombination_drops++;
+    hci_stack->statistics.acl_recombination_drops++;
+}
+
+static void hci_statistics_count_sco_sent(hci_connection_t * conn, uint16_t size){
+    conn->statistics.sco_packets_sent++;
+    conn->statistics.sco_bytes_sent += size;
+    hci_stack->statistics.sco_packets_sent++;
+    hci_stack->statistics.sco_bytes_sent += size;
+}
+
+static void hci_statistics_count_sco_received(hci_connection_t * conn, uint16_t size){
+    conn->statistics.sco_packets_received++;
+    conn->statistics.sco_bytes_received += size;
+    hci_stack->statistics.sco_packets_received++;
+    hci_stack->statistics.sco_bytes_received += size;
+}
+
+// track time that connections have queued ACL packets but no free controller buffers
+static void hci_statistics_set_acl_no_free_slots(hci_connection_t * conn, int no_free_slots){
+    if (conn->acl_no_free_slots == no_free_slots) return;
+    conn->acl_no_free_slots = no_free_slots;
+    uint32_t now = run_loop_get_time_ms();
+    if (no_free_slots){
+        conn->acl_no_free_slots_start_ms = now;
+        if (hci_stack->acl_no_free_slots++ == 0){
+            hci_stack->acl_no_free_slots_start_ms = now;
+        }
+    } else {
+        conn->statistics.acl_no_free_slots_ms += now - conn->acl_no_free_slots_start_ms;
+        if (--hci_stack->acl_no_free_slots == 0){
+            hci_stack->statistics.acl_no_free_slots_ms += now - hci_stack->acl_no_free_slots_start_ms;
+        }
+    }
+}
+
+static void hci_statistics_count_cmd_completed(uint16_t opcode){
+    // opcode 0 only updates Num_HCI_Command_Packets
+    if (opcode == 0) return;
+    if (hci_stack->statistics.cmd_packets_pending == 0) return;
+    hci_stack->statistics.cmd_packets_pending--;
+}
+
+#ifdef ENABLE_HCI_ACL_LATENCY_HISTOGRAMS
+static void hci_latency_histogram_add(hci_latency_histogram_t * histogram, uint32_t latency_ms){
+    int bucket = 0;
+    while ((latency_ms >> bucket) && bucket < HCI_LATENCY_HISTOGRAM_BUCKETS - 1){
+        bucket++;
+    }
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->sum_ms += latency_ms;
+    if (latency_ms > histogram->max_ms){
+        histogram->max_ms = latency_ms;
+    }
+}
+
+static void hci_acl_latency_fragment_sent(hci_connection_t * conn, hci_acl_buffer_t * acl_buffer, int last_fragment){
+    // fifo full: only count fragment to skip its completion later
+    if (conn->acl_latency_fifo_count == HCI_ACL_LATENCY_FIFO_SIZE){
+        conn->acl_latency_untracked++;
+        return;
+    }
+    int pos = (conn->acl_latency_fifo_head + conn->acl_latency_fifo_count) % HCI_ACL_LATENCY_FIFO_SIZE;
+    conn->acl_latency_fifo[pos].sent_ms = run_loop_get_time_ms();
+    conn->acl_latency_fifo[pos].queued_ms = acl_buffer->queued_ms;
+    conn->acl_latency_fifo[pos].untracked_before = conn->acl_latency_untracked;
+    conn->acl_latency_fifo[pos].last_fragment = last_fragment;
+    conn->acl_latency_fifo_count++;
+    conn->acl_latency_untracked = 0;
+}
+
+// controller completes packets of a connection in order, untracked fragments are skipped
+static void hci_acl_latency_fragments_completed(hci_connection_t * conn, uint16_t num_packets){
+    uint32_t now = run_loop_get_time_ms();
+    while (num_packets && conn->acl_latency_fifo_count){
+        hci_acl_latency_entry_t * entry = &conn->acl_latency_fifo[conn->acl_latency_fifo_head];
+        if (entry->untracked_before){
+            uint16_t skip = num_packets < entry->untracked_before ? num_packets : entry->untracked_before;
+            entry->untracked_before -= skip;
+            num_packets -= skip;
+            continue;
+        }
+        hci_latency_histogram_add(&conn->acl_latency.fragment_completion, now - entry->sent_ms);
+        if (entry->last_fragment){
+            hci_latency_histogram_add(&conn->acl_latency.packet_completion, now - entry->queued_ms);
+        }
+        conn->acl_latency_fifo_head = (conn->acl_latency_fifo_head + 1) % HCI_ACL_LATENCY_FIFO_SIZE;
+        conn->acl_latency_fifo_count--;
+        num_packets--;
+    }
+    if (num_packets > conn->acl_latency_untracked){
+        num_packets = conn->acl_latency_untracked;
+    }
+    conn->acl_latency_untracked -= num_packets;
+}
+#endif
+
+void hci_statistics_count_acl_buffers_full(hci_con_handle_t con_handle){
+    hci_connection_t * conn = hci_connection_for_handle(con_handle);
+    if (conn){
+        conn->statistics.acl_buffers_full++;
+    }
+    hci_stack->statistics.acl_buffers_full++;
+}
+
 /**
  * create connection for given address
  *
@@ -124,11 +278,40 @@ static hci_connection_t * create_connection_for_bd_addr_and_type(bd_addr_t addr,
     conn->acl_recombination_pos = 0;
     conn->num_acl_packets_sent = 0;
     conn->num_sco_packets_sent = 0;
+    conn->acl_priority = HCI_ACL_PRIORITY_DEFAULT;
+    conn->acl_deficit = 0;
     conn->le_con_parameter_update_state = CON_PARAMETER_UPDATE_NONE;
     linked_list_add(&hci_stack->connections, (linked_item_t *) conn);
+    hci_connection_index_add(conn);
     return conn;
 }
 
+/**
+ * remove connection from lists and free it
+ */
+static void hci_connection_free(hci_connection_t * conn){
+    hci_statistics_set_acl_no_free_slots(conn, 0);
+    if (conn->acl_recombination_buffer){
+        btstack_memory_hci_acl_recombination_buffer_free(conn->acl_recombination_buffer);
+    }
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+    // packets of closed connections are considered completed by the controller
+    hci_stack->host_num_completed_packets -= conn->host_num_completed_packets;
+#endif
+    hci_connection_index_remove(conn);
+    linked_list_remove(&hci_stack->connections, (linked_item_t *) conn);
+    btstack_memory_hci_connection_free( conn );
+}
+
+/**
+ * set handle of connection and update index
+ */
+static void hci_connection_set_handle(hci_connection_t * conn, hci_con_handle_t con_handle){
+    hci_connection_index_remove(conn);
+    conn->con_handle = con_handle;
+    hci_connection_index_add(conn);
+}
+
 
 /**
  * get le connection parameter range
@@ -164,10 +347,8 @@ void hci_connections_get_iterator(linked_list_iterator_t *it){
  * @return connection OR NULL, if not found
  */
 hci_connection_t * hci_connection_for_handle(hci_con_handle_t con_handle){
-    linked_list_iterator_t it;
-    linked_list_iterator_init(&it, &hci_stack->connections);
-    while (linked_list_iterator_has_next(&it)){
-        hci_connection_t * item = (hci_connection_t *) linked_list_iterator_next(&it);
+    hci_connection_t * item;
+    for (item = hci_stack->connections_for_handle[hci_connection_handle_hash(con_handle)]; item ; item = item->next_for_handle){
         if ( item->con_handle == con_handle ) {
             return item;
         }
@@ -181,10 +362,8 @@ hci_connection_t * hci_connection_for_handle(hci_con_handle_t con_handle){
  * @return connection OR NULL, if not found
  */
 hci_connection_t * hci_connection_for_bd_addr_and_type(bd_addr_t  addr, bd_addr_type_t addr_type){
-    linked_list_iterator_t it;
-    linked_list_iterator_init(&it, &hci_stack->connections);
-    while (linked_list_iterator_has_next(&it)){
-        hci_connection_t * connection = (hci_connection_t *) linked_list_iterator_next(&it);
+    hci_connection_t * connection;
+    for (connection = hci_stack->connections_for_address[hci_connection_address_hash(addr, addr_type)]; connection ; connection = connection->next_for_address){
         if (connection->address_type != addr_type)  continue;
         if (memcmp(addr, connection->address, 6) != 0) continue;
         return connection;   
@@ -194,31 +373,17 @@ hci_connection_t * hci_connection_for_bd_addr_and_type(bd_addr_t  addr, bd_addr_
 
 static void hci_connection_timeout_handler(timer_source_t *timer){
     hci_connection_t * connection = (hci_connection_t *) linked_item_get_user(&timer->item);
-#ifdef HAVE_TIME
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    if (tv.tv_sec >= connection->timestamp.tv_sec + HCI_CONNECTION_TIMEOUT_MS/1000) {
+    if (run_loop_get_time_ms() - connection->timestamp_ms >= HCI_CONNECTION_TIMEOUT_MS) {
         // connections might be timed out
         hci_emit_l2cap_check_timeout(connection);
     }
-#endif
-#ifdef HAVE_TICK
-    if (embedded_get_ticks() > connection->timestamp + embedded_ticks_for_ms(HCI_CONNECTION_TIMEOUT_MS)){
-        // connections might be timed out
-        hci_emit_l2cap_check_timeout(connection);
-    }
-#endif
     run_loop_set_timer(timer, HCI_CONNECTION_TIMEOUT_MS);
     run_loop_add_timer(timer);
 }
 
+// called for every ACL packet, run loop time is cheap to get
 static void hci_connection_timestamp(hci_connection_t *connection){
-#ifdef HAVE_TIME
-    gettimeofday(&connection->timestamp, NULL);
-#endif
-#ifdef HAVE_TICK
-    connection->timestamp = embedded_get_ticks();
-#endif
+    connection->timestamp_ms = run_loop_get_time_ms();
 }
 
 
@@ -291,79 +456,96 @@ uint8_t hci_number_outgoing_packets(hci_con_handle_t handle){
     return connection->num_acl_packets_sent;
 }
 
-uint8_t hci_number_free_acl_slots_for_handle(hci_con_handle_t con_handle){
-    
-    int num_packets_sent_classic = 0;
-    int num_packets_sent_le = 0;
+// outgoing packets are counted per connection and in total for O(1) checks
+static void hci_count_acl_packet_sent(hci_connection_t * connection){
+    connection->num_acl_packets_sent++;
+    if (connection->address_type == BD_ADDR_TYPE_CLASSIC){
+        hci_stack->acl_packets_sent_classic++;
+    } else {
+        hci_stack->acl_packets_sent_le++;
+    }
+}
 
-    bd_addr_type_t address_type = BD_ADDR_TYPE_UNKNOWN;
+static void hci_count_acl_packets_completed(hci_connection_t * connection, uint16_t num_packets){
+    if (connection->num_acl_packets_sent < num_packets){
+        log_error("hci_number_completed_packets, more acl slots freed then sent.");
+        num_packets = connection->num_acl_packets_sent;
+    }
+    connection->num_acl_packets_sent -= num_packets;
+    if (connection->address_type == BD_ADDR_TYPE_CLASSIC){
+        hci_stack->acl_packets_sent_classic -= num_packets;
+    } else {
+        hci_stack->acl_packets_sent_le -= num_packets;
+    }
+}
 
-    linked_item_t *it;
-    for (it = (linked_item_t *) hci_stack->connections; it ; it = it->next){
-        hci_connection_t * connection = (hci_connection_t *) it;
-        if (connection->address_type == BD_ADDR_TYPE_CLASSIC){
-            num_packets_sent_classic += connection->num_acl_packets_sent;
-        } else {
-            num_packets_sent_le += connection->num_acl_packets_sent;
-        }
-        // ignore connections that are not open, e.g., in state RECEIVED_DISCONNECTION_COMPLETE
-        if (connection->con_handle == con_handle && connection->state == OPEN){
-            address_type = connection->address_type;
-        }
+static void hci_count_sco_packet_sent(hci_connection_t * connection){
+    connection->num_sco_packets_sent++;
+    hci_stack->sco_packets_sent++;
+}
+
+static void hci_count_sco_packets_completed(hci_connection_t * connection, uint16_t num_packets){
+    if (connection->num_sco_packets_sent < num_packets){
+        log_error("hci_number_completed_packets, more sco slots freed then sent.");
+        num_packets = connection->num_sco_packets_sent;
     }
+    connection->num_sco_packets_sent -= num_packets;
+    hci_stack->sco_packets_sent -= num_packets;
+}
+
+static int hci_number_free_acl_slots_for_connection(hci_connection_t * connection){
+
+    // ignore connections that are not open, e.g., in state RECEIVED_DISCONNECTION_COMPLETE
+    if (connection->state != OPEN) return 0;
 
-    int free_slots_classic = hci_stack->acl_packets_total_num - num_packets_sent_classic;
+    int free_slots_classic = hci_stack->acl_packets_total_num - hci_stack->acl_packets_sent_classic;
     int free_slots_le = 0;
 
     if (free_slots_classic < 0){
-        log_error("hci_number_free_acl_slots: outgoing classic packets (%u) > total classic packets (%u)", num_packets_sent_classic, hci_stack->acl_packets_total_num);
+        log_error("hci_number_free_acl_slots: outgoing classic packets (%u) > total classic packets (%u)", hci_stack->acl_packets_sent_classic, hci_stack->acl_packets_total_num);
         return 0;
     }
 
     if (hci_stack->le_acl_packets_total_num){
         // if we have LE slots, they are used
-        free_slots_le = hci_stack->le_acl_packets_total_num - num_packets_sent_le;
+        free_slots_le = hci_stack->le_acl_packets_total_num - hci_stack->acl_packets_sent_le;
         if (free_slots_le < 0){
-            log_error("hci_number_free_acl_slots: outgoing le packets (%u) > total le packets (%u)", num_packets_sent_le, hci_stack->le_acl_packets_total_num);
+            log_error("hci_number_free_acl_slots: outgoing le packets (%u) > total le packets (%u)", hci_stack->acl_packets_sent_le, hci_stack->le_acl_packets_total_num);
             return 0;
         }
     } else {
         // otherwise, classic slots are used for LE, too
-        free_slots_classic -= num_packets_sent_le;
+        free_slots_classic -= hci_stack->acl_packets_sent_le;
         if (free_slots_classic < 0){
-            log_error("hci_number_free_acl_slots: outgoing classic + le packets (%u + %u) > total packets (%u)", num_packets_sent_classic, num_packets_sent_le, hci_stack->acl_packets_total_num);
+            log_error("hci_number_free_acl_slots: outgoing classic + le packets (%u + %u) > total packets (%u)", hci_stack->acl_packets_sent_classic, hci_stack->acl_packets_sent_le, hci_stack->acl_packets_total_num);
             return 0;
         }
     }
 
-    switch (address_type){
-        case BD_ADDR_TYPE_UNKNOWN:
-            log_error("hci_number_free_acl_slots: handle 0x%04x not in connection list", con_handle);
-            return 0;
-
-        case BD_ADDR_TYPE_CLASSIC:
-            return free_slots_classic;
+    if (connection->address_type == BD_ADDR_TYPE_CLASSIC){
+        return free_slots_classic;
+    }
+    if (hci_stack->le_acl_packets_total_num){
+        return free_slots_le;
+    }
+    return free_slots_classic; 
+}
 
-        default:
-           if (hci_stack->le_acl_packets_total_num){
-               return free_slots_le;
-           }
-           return free_slots_classic; 
+uint8_t hci_number_free_acl_slots_for_handle(hci_con_handle_t con_handle){
+    hci_connection_t * connection = hci_connection_for_handle(con_handle);
+    if (!connection){
+        log_error("hci_number_free_acl_slots: handle 0x%04x not in connection list", con_handle);
+        return 0;
     }
+    return hci_number_free_acl_slots_for_connection(connection);
 }
 
 static int hci_number_free_sco_slots_for_handle(hci_con_handle_t handle){
-    int num_sco_packets_sent = 0;
-    linked_item_t *it;
-    for (it = (linked_item_t *) hci_stack->connections; it ; it = it->next){
-        hci_connection_t * connection = (hci_connection_t *) it;
-        num_sco_packets_sent += connection->num_sco_packets_sent;
-    }
-    if (num_sco_packets_sent > hci_stack->sco_packets_total_num){
-        log_info("hci_number_free_sco_slots_for_handle: outgoing packets (%u) > total packets (%u)", num_sco_packets_sent, hci_stack->sco_packets_total_num);
+    if (hci_stack->sco_packets_sent > hci_stack->sco_packets_total_num){
+        log_info("hci_number_free_sco_slots_for_handle: outgoing packets (%u) > total packets (%u)", hci_stack->sco_packets_sent, hci_stack->sco_packets_total_num);
         return 0;
     }
-    return hci_stack->sco_packets_total_num - num_sco_packets_sent;
+    return hci_stack->sco_packets_total_num - hci_stack->sco_packets_sent;
 }
 
 // new functions replacing hci_can_send_packet_now[_using_packet_buffer]
@@ -380,18 +562,24 @@ int hci_can_send_command_packet_now(void){
     return hci_stack->num_cmd_packets > 0;
 }
 
+// prepared ACL packets are queued until the controller has free buffers
 int hci_can_send_prepared_acl_packet_now(hci_con_handle_t con_handle) {
-    // check for async hci transport implementations
-    if (hci_stack->hci_transport->can_send_packet_now){
-        if (!hci_stack->hci_transport->can_send_packet_now(HCI_ACL_DATA_PACKET)){
-            return 0;
-        }
-    }
-    return hci_number_free_acl_slots_for_handle(con_handle) > 0;
+    hci_connection_t * connection = hci_connection_for_handle(con_handle);
+    if (!connection) return 0;
+    // ignore connections that are not open, e.g., in state RECEIVED_DISCONNECTION_COMPLETE
+    return connection->state == OPEN;
 }
 
 int hci_can_send_acl_packet_now(hci_con_handle_t con_handle){
-    if (hci_stack->hci_packet_buffer_reserved) return 0;
+    if (hci_stack->acl_buffer_reserved) return 0;
+    if (!hci_stack->acl_buffers_free) return 0;
+#if HCI_OUTGOING_ACL_BUFFERS > 1
+    // keep last free buffer for connections without queued packets, a bulk sender must not block other connections
+    if (!hci_stack->acl_buffers_free->next){
+        hci_connection_t * connection = hci_connection_for_handle(con_handle);
+        if (connection && connection->acl_buffers_queued) return 0;
+    }
+#endif
     return hci_can_send_prepared_acl_packet_now(con_handle);
 }
 
@@ -406,27 +594,53 @@ int hci_can_send_prepared_sco_packet_now(hci_con_handle_t con_handle){
 }
 
 int hci_can_send_sco_packet_now(hci_con_handle_t con_handle){
-    if (hci_stack->hci_packet_buffer_reserved) return 0;
+    if (hci_stack->acl_buffer_reserved) return 0;
+    if (!hci_stack->acl_buffers_free) return 0;
     return hci_can_send_prepared_sco_packet_now(con_handle);
 }
 
 // used for internal checks in l2cap[-le].c
 int hci_is_packet_buffer_reserved(void){
-    return hci_stack->hci_packet_buffer_reserved;
+    return hci_stack->acl_buffer_reserved != NULL;
 }
 
 // reserves outgoing packet buffer. @returns 1 if successful
 int hci_reserve_packet_buffer(void){
-    if (hci_stack->hci_packet_buffer_reserved) {
+    if (hci_stack->acl_buffer_reserved) {
         log_error("hci_reserve_packet_buffer called but buffer already reserved");
         return 0;
     }
-    hci_stack->hci_packet_buffer_reserved = 1;
+    hci_acl_buffer_t * acl_buffer = (hci_acl_buffer_t *) hci_stack->acl_buffers_free;
+    if (!acl_buffer) {
+        log_error("hci_reserve_packet_buffer called but no free buffer");
+        return 0;
+    }
+    hci_stack->acl_buffers_free = acl_buffer->item.next;
+    hci_stack->acl_buffer_reserved = acl_buffer;
     return 1;    
 }
 
+static void hci_free_acl_buffer(hci_acl_buffer_t * acl_buffer){
+    acl_buffer->size = 0;
+    acl_buffer->fragmentation_pos = 0;
+    linked_list_add(&hci_stack->acl_buffers_free, (linked_item_t *) acl_buffer);
+}
+
 void hci_release_packet_buffer(void){
-    hci_stack->hci_packet_buffer_reserved = 0;
+    if (!hci_stack->acl_buffer_reserved) return;
+    hci_free_acl_buffer(hci_stack->acl_buffer_reserved);
+    hci_stack->acl_buffer_reserved = NULL;
+}
+
+static void hci_acl_buffers_init(void){
+    hci_stack->acl_buffers_free = NULL;
+    hci_stack->acl_buffer_reserved = NULL;
+    hci_stack->acl_buffer_sending = NULL;
+    hci_stack->sco_buffer_sending = NULL;
+    int i;
+    for (i = 0; i < HCI_OUTGOING_ACL_BUFFERS; i++){
+        hci_free_acl_buffer(&hci_stack->acl_buffers[i]);
+    }
 }
 
 // assumption: synchronous implementations don't provide can_send_packet_now as they don't keep the buffer after the call
@@ -434,102 +648,219 @@ static int hci_transport_synchronous(void){
     return hci_stack->hci_transport->can_send_packet_now == NULL;
 }
 
+// async transport: release buffer of sent ACL packet, keep it queued if there are further fragments
+static void hci_release_acl_buffer_sending(void){
+    if (!hci_stack->acl_buffer_sending) return;
+    if (hci_stack->acl_buffer_sending->fragmentation_pos == 0){
+        hci_free_acl_buffer(hci_stack->acl_buffer_sending);
+    }
+    hci_stack->acl_buffer_sending = NULL;
+}
+
+// async transport: release buffer of sent SCO packet
+static void hci_release_sco_buffer_sending(void){
+    if (!hci_stack->sco_buffer_sending) return;
+    hci_free_acl_buffer(hci_stack->sco_buffer_sending);
+    hci_stack->sco_buffer_sending = NULL;
+}
+
+static void hci_emit_hci_packet_sent(void){
+    // notify upper stack that it might be possible to send again
+    uint8_t event[] = { DAEMON_EVENT_HCI_PACKET_SENT, 0};
+    hci_stack->packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
+}
+
 uint16_t hci_max_acl_le_data_packet_length(void){
     return hci_stack->le_data_packets_length > 0 ? hci_stack->le_data_packets_length : hci_stack->acl_data_packet_length;
 }
 
-static int hci_send_acl_packet_fragments(hci_connection_t *connection){
-
-    // log_info("hci_send_acl_packet_fragments  %u/%u (con 0x%04x)", hci_stack->acl_fragmentation_pos, hci_stack->acl_fragmentation_total_size, connection->con_handle);
+static int hci_can_send_queued_acl_packet_now(hci_connection_t *connection){
+    // check for async hci transport implementations
+    if (hci_stack->hci_transport->can_send_packet_now){
+        if (!hci_stack->hci_transport->can_send_packet_now(HCI_ACL_DATA_PACKET)){
+            return 0;
+        }
+    }
+    return hci_number_free_acl_slots_for_connection(connection) > 0;
+}
 
+static uint16_t hci_max_acl_data_packet_length_for_connection(hci_connection_t *connection){
     // max ACL data packet length depends on connection type (LE vs. Classic) and available buffers
-    uint16_t max_acl_data_packet_length = hci_stack->acl_data_packet_length;
     if (hci_is_le_connection(connection) && hci_stack->le_data_packets_length > 0){
-        max_acl_data_packet_length = hci_stack->le_data_packets_length;
+        return hci_stack->le_data_packets_length;
     }
+    return hci_stack->acl_data_packet_length;
+}
+
+// size of next fragment of first queued packet of connection
+static uint16_t hci_next_acl_fragment_size(hci_connection_t *connection){
+    hci_acl_buffer_t * acl_buffer = (hci_acl_buffer_t *) connection->acl_buffers_queued;
+    int current_acl_data_packet_length = acl_buffer->size - acl_buffer->fragmentation_pos;
+    uint16_t max_acl_data_packet_length = hci_max_acl_data_packet_length_for_connection(connection);
 
     // testing: reduce buffer to minimum
     // max_acl_data_packet_length = 52;
 
-    int err;
-    // multiple packets could be send on a synchronous HCI transport
-    while (1){
+    // if ACL packet is larger than Bluetooth packet buffer, only send max_acl_data_packet_length
+    if (current_acl_data_packet_length > max_acl_data_packet_length){
+        return max_acl_data_packet_length;
+    }
+    return current_acl_data_packet_length;
+}
 
-        // get current data
-        const uint16_t acl_header_pos = hci_stack->acl_fragmentation_pos - 4;
-        int current_acl_data_packet_length = hci_stack->acl_fragmentation_total_size - hci_stack->acl_fragmentation_pos;
-        int more_fragments = 0;
+// send next fragment of first queued packet of connection
+static int hci_send_acl_fragment(hci_connection_t *connection){
 
-        // if ACL packet is larger than Bluetooth packet buffer, only send max_acl_data_packet_length
-        if (current_acl_data_packet_length > max_acl_data_packet_length){
-            more_fragments = 1;
-            current_acl_data_packet_length = max_acl_data_packet_length;
-        }
+    hci_acl_buffer_t * acl_buffer = (hci_acl_buffer_t *) connection->acl_buffers_queued;
+    uint8_t * buffer = acl_buffer->buffer;
 
-        // copy handle_and_flags if not first fragment and update packet boundary flags to be 01 (continuing fragmnent)
-        if (acl_header_pos > 0){
-            uint16_t handle_and_flags = READ_BT_16(hci_stack->hci_packet_buffer, 0);
-            handle_and_flags = (handle_and_flags & 0xcfff) | (1 << 12);
-            bt_store_16(hci_stack->hci_packet_buffer, acl_header_pos, handle_and_flags);
-        }
+    // async transport with transmit queue accepts another packet, so it is done with the previous one
+    hci_release_acl_buffer_sending();
 
-        // update header len
-        bt_store_16(hci_stack->hci_packet_buffer, acl_header_pos + 2, current_acl_data_packet_length);
+    // log_info("hci_send_acl_fragment  %u/%u (con 0x%04x)", acl_buffer->fragmentation_pos, acl_buffer->size, connection->con_handle);
 
-        // count packet
-        connection->num_acl_packets_sent++;
+    // get current data
+    const uint16_t acl_header_pos = acl_buffer->fragmentation_pos - 4;
+    const uint16_t current_acl_data_packet_length = hci_next_acl_fragment_size(connection);
 
-        // send packet
-        uint8_t * packet = &hci_stack->hci_packet_buffer[acl_header_pos];
-        const int size = current_acl_data_packet_length + 4;
-        hci_dump_packet(HCI_ACL_DATA_PACKET, 0, packet, size);
-        err = hci_stack->hci_transport->send_packet(HCI_ACL_DATA_PACKET, packet, size);
+    // copy handle_and_flags if not first fragment and update packet boundary flags to be 01 (continuing fragmnent)
+    if (acl_header_pos > 0){
+        uint16_t handle_and_flags = READ_BT_16(buffer, 0);
+        handle_and_flags = (handle_and_flags & 0xcfff) | (1 << 12);
+        bt_store_16(buffer, acl_header_pos, handle_and_flags);
+    }
+
+    // update header len
+    bt_store_16(buffer, acl_header_pos + 2, current_acl_data_packet_length);
+
+    // count packet
+    hci_count_acl_packet_sent(connection);
+    hci_statistics_count_acl_fragment_sent(connection, current_acl_data_packet_length);
 
-        // done yet?
-        if (!more_fragments) break;
+    // update start of next fragment to send
+    acl_buffer->fragmentation_pos += current_acl_data_packet_length;
+    int last_fragment = acl_buffer->fragmentation_pos >= acl_buffer->size;
 
-        // update start of next fragment to send
-        hci_stack->acl_fragmentation_pos += current_acl_data_packet_length;
+#ifdef ENABLE_HCI_ACL_LATENCY_HISTOGRAMS
+    hci_acl_latency_fragment_sent(connection, acl_buffer, last_fragment);
+#endif
 
-        // can send more?
-        if (!hci_can_send_prepared_acl_packet_now(connection->con_handle)) return err;
+    // last fragment: remove packet from queue
+    if (last_fragment){
+        connection->acl_buffers_queued = acl_buffer->item.next;
+        acl_buffer->fragmentation_pos = 0;
     }
 
-    // done    
-    hci_stack->acl_fragmentation_pos = 0;
-    hci_stack->acl_fragmentation_total_size = 0;
+    // send packet
+    uint8_t * packet = &buffer[acl_header_pos];
+    const int size = current_acl_data_packet_length + 4;
+    hci_dump_packet(HCI_ACL_DATA_PACKET, 0, packet, size);
+    int err = hci_stack->hci_transport->send_packet(HCI_ACL_DATA_PACKET, packet, size);
 
-    // release buffer now for synchronous transport
-    if (hci_transport_synchronous()){
-        hci_release_packet_buffer();
-        // notify upper stack that iit might be possible to send again
-        uint8_t event[] = { DAEMON_EVENT_HCI_PACKET_SENT, 0};
-        hci_stack->packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
+    // async transport keeps buffer until packet sent
+    if (!hci_transport_synchronous()){
+        hci_stack->acl_buffer_sending = acl_buffer;
+        return err;
     }
 
+    // more fragments?
+    if (acl_buffer->fragmentation_pos) return err;
+
+    // release buffer now for synchronous transport
+    hci_free_acl_buffer(acl_buffer);
+    hci_emit_hci_packet_sent();
+
+    return err;
+}
+
+// deficit round robin scheduler: interleave fragments of queued ACL packets from all connections.
+// in each round, a connection can send up to its priority times max ACL data packet length bytes
+static int hci_send_queued_acl_packets(void){
+    int err = 0;
+    int fragments_sent;
+    do {
+        fragments_sent = 0;
+
+        // start round after connection served last
+        hci_connection_t * last = hci_connection_for_handle(hci_stack->acl_last_scheduled_con_handle);
+        linked_item_t * start = last ? last->item.next : NULL;
+        if (!start) start = (linked_item_t *) hci_stack->connections;
+
+        linked_item_t * it = start;
+        while (it){
+            hci_connection_t * connection = (hci_connection_t *) it;
+            it = it->next;
+            if (!it) it = (linked_item_t *) hci_stack->connections;
+            if (it == start) it = NULL;
+
+            if (!connection->acl_buffers_queued) {
+                connection->acl_deficit = 0;
+                continue;
+            }
+            if (!hci_can_send_queued_acl_packet_now(connection)) {
+                hci_statistics_set_acl_no_free_slots(connection, hci_number_free_acl_slots_for_connection(connection) == 0);
+                continue;
+            }
+
+            uint32_t quantum = connection->acl_priority * hci_max_acl_data_packet_length_for_connection(connection);
+            connection->acl_deficit += quantum;
+            while (connection->acl_buffers_queued && hci_can_send_queued_acl_packet_now(connection)){
+                uint16_t fragment_size = hci_next_acl_fragment_size(connection);
+                if (fragment_size > connection->acl_deficit) break;
+                connection->acl_deficit -= fragment_size;
+                hci_stack->acl_last_scheduled_con_handle = connection->con_handle;
+                err = hci_send_acl_fragment(connection);
+                fragments_sent = 1;
+            }
+            if (!connection->acl_buffers_queued){
+                connection->acl_deficit = 0;
+            }
+            hci_statistics_set_acl_no_free_slots(connection,
+                connection->acl_buffers_queued && hci_number_free_acl_slots_for_connection(connection) == 0);
+            // don't accumulate credit while controller buffers are full
+            if (connection->acl_deficit > quantum){
+                connection->acl_deficit = quantum;
+            }
+        }
+    } while (fragments_sent);
     return err;
 }
 
+// set weight of connection for outgoing ACL scheduler
+int hci_set_acl_priority(hci_con_handle_t con_handle, uint8_t priority){
+    hci_connection_t * connection = hci_connection_for_handle(con_handle);
+    if (!connection) return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+    if (priority < HCI_ACL_PRIORITY_LOW) priority = HCI_ACL_PRIORITY_LOW;
+    connection->acl_priority = priority;
+    return 0;
+}
+
+// drop queued ACL packets, e.g. on disconnect
+static void hci_drop_queued_acl_packets(hci_connection_t *connection){
+    while (connection->acl_buffers_queued){
+        hci_acl_buffer_t * acl_buffer = (hci_acl_buffer_t *) connection->acl_buffers_queued;
+        connection->acl_buffers_queued = acl_buffer->item.next;
+        if (acl_buffer == hci_stack->acl_buffer_sending){
+            // fragment still owned by transport, buffer is freed on DAEMON_EVENT_HCI_PACKET_SENT
+            acl_buffer->fragmentation_pos = 0;
+            continue;
+        }
+        hci_free_acl_buffer(acl_buffer);
+    }
+}
+
 // pre: caller has reserved the packet buffer
 int hci_send_acl_packet_buffer(int size){
 
     // log_info("hci_send_acl_packet_buffer size %u", size);
 
-    if (!hci_stack->hci_packet_buffer_reserved) {
+    hci_acl_buffer_t * acl_buffer = hci_stack->acl_buffer_reserved;
+    if (!acl_buffer) {
         log_error("hci_send_acl_packet_buffer called without reserving packet buffer");
         return 0;
     }
 
-    uint8_t * packet = hci_stack->hci_packet_buffer;
-    hci_con_handle_t con_handle = READ_ACL_CONNECTION_HANDLE(packet);
-
-    // check for free places on Bluetooth module
-    if (!hci_can_send_prepared_acl_packet_now(con_handle)) {
-        log_error("hci_send_acl_packet_buffer called but no free ACL buffers on controller");
-        hci_release_packet_buffer();
-        return BTSTACK_ACL_BUFFERS_FULL;
-    }
-
+    hci_con_handle_t con_handle = READ_ACL_CONNECTION_HANDLE(acl_buffer->buffer);
     hci_connection_t *connection = hci_connection_for_handle( con_handle);
     if (!connection) {
         log_error("hci_send_acl_packet_buffer called but no connection for handle 0x%04x", con_handle);
@@ -540,11 +871,18 @@ int hci_send_acl_packet_buffer(int size){
     
     // hci_dump_packet( HCI_ACL_DATA_PACKET, 0, packet, size);
 
-    // setup data
-    hci_stack->acl_fragmentation_total_size = size;
-    hci_stack->acl_fragmentation_pos = 4;   // start of L2CAP packet
+    // setup data and queue packet
+    hci_stack->acl_buffer_reserved = NULL;
+    acl_buffer->size = size;
+    acl_buffer->fragmentation_pos = 4;   // start of L2CAP packet
+#ifdef ENABLE_HCI_ACL_LATENCY_HISTOGRAMS
+    acl_buffer->queued_ms = run_loop_get_time_ms();
+#endif
+    linked_list_add_tail(&connection->acl_buffers_queued, (linked_item_t *) acl_buffer);
+    connection->statistics.acl_packets_sent++;
+    hci_stack->statistics.acl_packets_sent++;
 
-    return hci_send_acl_packet_fragments(connection);
+    return hci_send_queued_acl_packets();
 }
 
 // pre: caller has reserved the packet buffer
@@ -552,12 +890,13 @@ int hci_send_sco_packet_buffer(int size){
 
     // log_info("hci_send_acl_packet_buffer size %u", size);
 
-    if (!hci_stack->hci_packet_buffer_reserved) {
-        log_error("hci_send_acl_packet_buffer called without reserving packet buffer");
+    hci_acl_buffer_t * acl_buffer = hci_stack->acl_buffer_reserved;
+    if (!acl_buffer) {
+        log_error("hci_send_sco_packet_buffer called without reserving packet buffer");
         return 0;
     }
 
-    uint8_t * packet = hci_stack->hci_packet_buffer;
+    uint8_t * packet = acl_buffer->buffer;
 
     // skip checks in loopback mode
     if (!hci_stack->loopback_mode){
@@ -577,22 +916,91 @@ int hci_send_sco_packet_buffer(int size){
             hci_release_packet_buffer();
             return 0;
         }
-        connection->num_sco_packets_sent++;
+        hci_count_sco_packet_sent(connection);
+        hci_statistics_count_sco_sent(connection, size - 3);
     }
 
+    // async transport with transmit queue accepts another packet, so it is done with the previous one
+    hci_release_sco_buffer_sending();
+
     hci_dump_packet( HCI_SCO_DATA_PACKET, 0, packet, size);
     int err = hci_stack->hci_transport->send_packet(HCI_SCO_DATA_PACKET, packet, size);
 
-    if (hci_transport_synchronous()){
-        hci_release_packet_buffer();
-        // notify upper stack that iit might be possible to send again
-        uint8_t event[] = { DAEMON_EVENT_HCI_PACKET_SENT, 0};
-        hci_stack->packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
+    hci_stack->acl_buffer_reserved = NULL;
+
+    // async transport keeps buffer until packet sent
+    if (!hci_transport_synchronous()){
+        hci_stack->sco_buffer_sending = acl_buffer;
+        return err;
     }
 
+    // release buffer now for synchronous transport
+    hci_free_acl_buffer(acl_buffer);
+    hci_emit_hci_packet_sent();
+
     return err;
 }
 
+static void hci_connection_release_recombination_buffer(hci_connection_t * conn){
+    if (conn->acl_recombination_buffer){
+        btstack_memory_hci_acl_recombination_buffer_free(conn->acl_recombination_buffer);
+        conn->acl_recombination_buffer = NULL;
+    }
+    conn->acl_recombination_length = 0;
+    conn->acl_recombination_pos = 0;
+}
+
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+// Host Number Of Completed Packets can be sent even if the controller doesn't accept other commands
+// and it does not generate a Command Complete event
+static void hci_host_send_number_of_completed_packets(void){
+    // report in batches. the controller can continue sending as long as the not reported packets
+    // are less than HCI_HOST_ACL_PACKET_NUM
+    if (hci_stack->host_num_completed_packets < (HCI_HOST_ACL_PACKET_NUM + 1) / 2) return;
+
+    while (hci_stack->host_num_completed_packets){
+        if (hci_stack->hci_packet_buffer_reserved) return;
+        if (!hci_transport_synchronous() && !hci_stack->hci_transport->can_send_packet_now(HCI_COMMAND_DATA_PACKET)) return;
+
+        linked_item_t * it;
+        hci_connection_t * conn = NULL;
+        for (it = (linked_item_t *) hci_stack->connections; it ; it = it->next){
+            if (((hci_connection_t *) it)->host_num_completed_packets == 0) continue;
+            conn = (hci_connection_t *) it;
+            break;
+        }
+        if (!conn){
+            log_error("hci_host_send_number_of_completed_packets: %u packets without connection", hci_stack->host_num_completed_packets);
+            hci_stack->host_num_completed_packets = 0;
+            return;
+        }
+
+        uint16_t size = hci_create_cmd(hci_stack->hci_packet_buffer, (hci_cmd_t *) &hci_host_number_of_completed_packets,
+            1, conn->con_handle, conn->host_num_completed_packets);
+        hci_stack->host_num_completed_packets -= conn->host_num_completed_packets;
+        conn->host_num_completed_packets = 0;
+
+        hci_stack->hci_packet_buffer_reserved = 1;
+        hci_dump_packet(HCI_COMMAND_DATA_PACKET, 0, hci_stack->hci_packet_buffer, size);
+        hci_stack->hci_transport->send_packet(HCI_COMMAND_DATA_PACKET, hci_stack->hci_packet_buffer, size);
+        if (hci_transport_synchronous()){
+            hci_stack->hci_packet_buffer_reserved = 0;
+        }
+    }
+}
+
+// received ACL packet has been processed, the transport can re-use its receive buffer
+static void hci_host_acl_packet_processed(hci_con_handle_t con_handle){
+    if (!hci_stack->host_flow_control_enabled) return;
+    hci_connection_t * conn = hci_connection_for_handle(con_handle);
+    // packets of closed connections are considered completed by the controller
+    if (!conn) return;
+    conn->host_num_completed_packets++;
+    hci_stack->host_num_completed_packets++;
+    hci_host_send_number_of_completed_packets();
+}
+#endif
+
 static void acl_handler(uint8_t *packet, int size){
 
     // log_info("acl_handler: size %u", size);
@@ -615,6 +1023,8 @@ static void acl_handler(uint8_t *packet, int size){
         return;
     }
 
+    hci_statistics_count_acl_received(conn, acl_length);
+
     // update idle timestamp
     hci_connection_timestamp(conn);
     
@@ -626,17 +1036,19 @@ static void acl_handler(uint8_t *packet, int size){
             // sanity checks
             if (conn->acl_recombination_pos == 0) {
                 log_error( "ACL Cont Fragment but no first fragment for handle 0x%02x", con_handle);
+                hci_statistics_count_acl_recombination_drop(conn);
                 return;
             }
             if (conn->acl_recombination_pos + acl_length > 4 + HCI_ACL_BUFFER_SIZE){
                 log_error( "ACL Cont Fragment to large: combined packet %u > buffer size %u for handle 0x%02x",
                     conn->acl_recombination_pos + acl_length, 4 + HCI_ACL_BUFFER_SIZE, con_handle);
-                conn->acl_recombination_pos = 0;
+                hci_connection_release_recombination_buffer(conn);
+                hci_statistics_count_acl_recombination_drop(conn);
                 return;
             }
 
             // append fragment payload (header already stored)
-            memcpy(&conn->acl_recombination_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + conn->acl_recombination_pos], &packet[4], acl_length );
+            memcpy(&conn->acl_recombination_buffer->buffer[HCI_INCOMING_PRE_BUFFER_SIZE + conn->acl_recombination_pos], &packet[4], acl_length );
             conn->acl_recombination_pos += acl_length;
             
             // log_error( "ACL Cont Fragment: acl_len %u, combined_len %u, l2cap_len %u", acl_length,
@@ -645,10 +1057,14 @@ static void acl_handler(uint8_t *packet, int size){
             // forward complete L2CAP packet if complete. 
             if (conn->acl_recombination_pos >= conn->acl_recombination_length + 4 + 4){ // pos already incl. ACL header
                 
-                hci_stack->packet_handler(HCI_ACL_DATA_PACKET, &conn->acl_recombination_buffer[HCI_INCOMING_PRE_BUFFER_SIZE], conn->acl_recombination_pos);
-                // reset recombination buffer
+                // detach recombination buffer from connection and free it after packet was processed
+                hci_acl_recombination_buffer_t * recombination_buffer = conn->acl_recombination_buffer;
+                uint16_t recombination_pos = conn->acl_recombination_pos;
+                conn->acl_recombination_buffer = NULL;
                 conn->acl_recombination_length = 0;
                 conn->acl_recombination_pos = 0;
+                hci_stack->packet_handler(HCI_ACL_DATA_PACKET, &recombination_buffer->buffer[HCI_INCOMING_PRE_BUFFER_SIZE], recombination_pos);
+                btstack_memory_hci_acl_recombination_buffer_free(recombination_buffer);
             }
             break;
             
@@ -657,7 +1073,8 @@ static void acl_handler(uint8_t *packet, int size){
             // sanity check
             if (conn->acl_recombination_pos) {
                 log_error( "ACL First Fragment but data in buffer for handle 0x%02x, dropping stale fragments", con_handle);
-                conn->acl_recombination_pos = 0;
+                hci_connection_release_recombination_buffer(conn);
+                hci_statistics_count_acl_recombination_drop(conn);
             }
 
             // peek into L2CAP packet!
@@ -676,14 +1093,22 @@ static void acl_handler(uint8_t *packet, int size){
                 if (acl_length > HCI_ACL_BUFFER_SIZE){
                     log_error( "ACL First Fragment to large: fragment %u > buffer size %u for handle 0x%02x",
                         4 + acl_length, 4 + HCI_ACL_BUFFER_SIZE, con_handle);
+                    hci_statistics_count_acl_recombination_drop(conn);
+                    return;
+                }
+
+                conn->acl_recombination_buffer = btstack_memory_hci_acl_recombination_buffer_get();
+                if (!conn->acl_recombination_buffer){
+                    log_error( "ACL First Fragment but no recombination buffer available for handle 0x%02x, dropping packet", con_handle);
+                    hci_statistics_count_acl_recombination_drop(conn);
                     return;
                 }
 
                 // store first fragment and tweak acl length for complete package
-                memcpy(&conn->acl_recombination_buffer[HCI_INCOMING_PRE_BUFFER_SIZE], packet, acl_length + 4);
+                memcpy(&conn->acl_recombination_buffer->buffer[HCI_INCOMING_PRE_BUFFER_SIZE], packet, acl_length + 4);
                 conn->acl_recombination_pos    = acl_length + 4;
                 conn->acl_recombination_length = l2cap_length;
-                bt_store_16(conn->acl_recombination_buffer, HCI_INCOMING_PRE_BUFFER_SIZE + 2, l2cap_length +4);
+                bt_store_16(conn->acl_recombination_buffer->buffer, HCI_INCOMING_PRE_BUFFER_SIZE + 2, l2cap_length +4);
             }
             break;
             
@@ -701,9 +1126,14 @@ static void hci_shutdown_connection(hci_connection_t *conn){
     log_info("Connection closed: handle 0x%x, %s", conn->con_handle, bd_addr_to_str(conn->address));
 
     run_loop_remove_timer(&conn->timeout);
+
+    hci_drop_queued_acl_packets(conn);
+
+    // controller discards packets of closed connection
+    hci_count_acl_packets_completed(conn, conn->num_acl_packets_sent);
+    hci_count_sco_packets_completed(conn, conn->num_sco_packets_sent);
     
-    linked_list_remove(&hci_stack->connections, (linked_item_t *) conn);
-    btstack_memory_hci_connection_free( conn );
+    hci_connection_free(conn);
     
     // now it's gone
     hci_emit_nr_connections_changed();
@@ -760,8 +1190,10 @@ uint16_t hci_usable_acl_packet_types(void){
 }
 
 uint8_t* hci_get_outgoing_packet_buffer(void){
-    // hci packet buffer is >= acl data packet length
-    return hci_stack->hci_packet_buffer;
+    // packet buffers are >= acl data packet length
+    if (hci_stack->acl_buffer_reserved) return hci_stack->acl_buffer_reserved->buffer;
+    log_error("hci_get_outgoing_packet_buffer called without reserving packet buffer");
+    return NULL;
 }
 
 uint16_t hci_max_acl_data_packet_length(void){
@@ -854,6 +1286,74 @@ static void hci_initialization_timeout_handler(timer_source_t * ds){
     }
 }
 
+static void hci_update_packet_types(void){
+    // determine usable ACL packet types based on host buffer size and supported features
+    hci_stack->packet_types = hci_acl_packet_types_for_buffer_size_and_local_features(HCI_ACL_PAYLOAD_SIZE, &hci_stack->local_supported_features[0]);
+    log_info("packet types %04x", hci_stack->packet_types); 
+
+    // Classic/LE
+    log_info("BR/EDR support %u, LE support %u", hci_classic_supported(), hci_le_supported());
+}
+
+static int hci_controller_info_matches(controller_info_t * stored){
+    controller_info_t * info = &hci_stack->controller_info;
+    return stored->hci_version    == info->hci_version
+        && stored->hci_revision   == info->hci_revision
+        && stored->lmp_version    == info->lmp_version
+        && stored->manufacturer   == info->manufacturer
+        && stored->lmp_subversion == info->lmp_subversion
+        && BD_ADDR_CMP(stored->bd_addr, hci_stack->local_bd_addr) == 0;
+}
+
+// use stored capabilities if the controller is the same as last time
+static void hci_controller_info_load(void){
+    hci_stack->controller_info_cached = 0;
+    BD_ADDR_COPY(hci_stack->controller_info.bd_addr, hci_stack->local_bd_addr);
+    if (!hci_stack->controller_info_db) return;
+
+    controller_info_t stored;
+    if (!hci_stack->controller_info_db->get_controller_info(&stored)) return;
+    if (!hci_controller_info_matches(&stored)){
+        log_info("Controller info does not match, reading capabilities");
+        return;
+    }
+    memcpy(&hci_stack->controller_info, &stored, sizeof(controller_info_t));
+
+    // same processing as for the HCI Command Complete events
+    hci_stack->local_supported_commands[0] = stored.local_supported_commands[0];
+    if (hci_stack->local_supported_commands[0] & 0x01){
+        hci_stack->acl_data_packet_length = stored.acl_data_packet_length;
+        hci_stack->sco_data_packet_length = stored.sco_data_packet_length;
+        hci_stack->acl_packets_total_num  = stored.acl_packets_total_num;
+        hci_stack->sco_packets_total_num  = stored.sco_packets_total_num;
+        if (HCI_ACL_PAYLOAD_SIZE < hci_stack->acl_data_packet_length){
+            hci_stack->acl_data_packet_length = HCI_ACL_PAYLOAD_SIZE;
+        }
+    }
+    memcpy(hci_stack->local_supported_features, stored.local_supported_features, 8);
+    hci_update_packet_types();
+#ifdef HAVE_BLE
+    hci_stack->le_data_packets_length   = stored.le_data_packets_length;
+    hci_stack->le_acl_packets_total_num = stored.le_acl_packets_total_num;
+    if (HCI_ACL_PAYLOAD_SIZE < hci_stack->le_data_packets_length){
+        hci_stack->le_data_packets_length = HCI_ACL_PAYLOAD_SIZE;
+    }
+    hci_stack->le_whitelist_capacity = stored.le_whitelist_capacity;
+#endif
+    log_info("Using stored controller info: acl size %u, count %u / sco size %u, count %u",
+             hci_stack->acl_data_packet_length, hci_stack->acl_packets_total_num,
+             hci_stack->sco_data_packet_length, hci_stack->sco_packets_total_num); 
+    hci_stack->controller_info_cached = 1;
+}
+
+// first LE init command, LE Read Buffer Size is skipped if controller info was loaded
+static hci_substate_t hci_initializing_le_substate(void){
+    if (!hci_stack->controller_info_cached) return HCI_INIT_LE_READ_BUFFER_SIZE;
+    // skip write le host if not supported (e.g. on LE only EM9301)
+    if (hci_stack->local_supported_commands[0] & 0x02) return HCI_INIT_WRITE_LE_HOST_SUPPORTED;
+    return HCI_INIT_LE_SET_SCAN_PARAMETERS;
+}
+
 static void hci_initializing_next_state(void){
     hci_stack->substate = (hci_substate_t )( ((int) hci_stack->substate) + 1);
 }
@@ -914,17 +1414,21 @@ static void hci_initializing_run(void){
             }
             break;
         case HCI_INIT_CUSTOM_INIT:
-            log_info("Custom init");
             // Custom initialization
             if (hci_stack->control && hci_stack->control->next_cmd){
                 int valid_cmd = (*hci_stack->control->next_cmd)(hci_stack->config, hci_stack->hci_packet_buffer);
                 if (valid_cmd){
                     int size = 3 + hci_stack->hci_packet_buffer[2];
+                    if (hci_stack->init_script_cmds_sent == 0){
+                        hci_stack->init_script_start_ms = run_loop_get_time_ms();
+                        log_info("Custom init after %"PRIu32" ms", hci_stack->init_script_start_ms - hci_stack->init_start_ms);
+                    }
+                    hci_stack->init_script_cmds_sent++;
                     hci_stack->last_cmd_opcode = READ_BT_16(hci_stack->hci_packet_buffer, 0);
-                    hci_dump_packet(HCI_COMMAND_DATA_PACKET, 0, hci_stack->hci_packet_buffer, size);
                     switch (valid_cmd) {
                         case 1:
                         default:
+                            hci_stack->init_script_cmds_pending++;
                             hci_stack->substate = HCI_INIT_W4_CUSTOM_INIT;
                             break;
                         case 2: // CSR Warm Boot: Wait a bit, then send HCI Reset until HCI Command Complete
@@ -934,11 +1438,23 @@ static void hci_initializing_run(void){
                             run_loop_add_timer(&hci_stack->timeout);
                             hci_stack->substate = HCI_INIT_W4_CUSTOM_INIT_CSR_WARM_BOOT;
                             break;
+                        case 3: // stay in HCI_INIT_CUSTOM_INIT, hci_run sends next one if controller accepts more commands
+                            hci_stack->init_script_cmds_pending++;
+                            break;
                     }
-                    hci_stack->hci_transport->send_packet(HCI_COMMAND_DATA_PACKET, hci_stack->hci_packet_buffer, size);
+                    hci_stack->hci_packet_buffer_reserved = 1;
+                    hci_send_cmd_packet(hci_stack->hci_packet_buffer, size);
                     break;
                 }
-               log_info("hci_run: init script done");
+                // wait for commands still in flight
+                if (hci_stack->init_script_cmds_pending){
+                    hci_stack->substate = HCI_INIT_W4_CUSTOM_INIT;
+                    break;
+                }
+                if (hci_stack->init_script_cmds_sent){
+                    hci_stack->init_script_duration_ms = run_loop_get_time_ms() - hci_stack->init_script_start_ms;
+                    log_info("Custom init: %u commands in %"PRIu32" ms", hci_stack->init_script_cmds_sent, hci_stack->init_script_duration_ms);
+                }
             }
             // otherwise continue
             hci_stack->substate = HCI_INIT_W4_READ_BD_ADDR;
@@ -956,6 +1472,17 @@ static void hci_initializing_run(void){
             hci_stack->substate = HCI_INIT_W4_READ_LOCAL_SUPPORTED_FEATUES;
             hci_send_cmd(&hci_read_local_supported_features);
             break;                
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+        case HCI_INIT_HOST_BUFFER_SIZE:
+            hci_stack->substate = HCI_INIT_W4_HOST_BUFFER_SIZE;
+            // SCO packets are not flow controlled
+            hci_send_cmd(&hci_host_buffer_size, HCI_HOST_ACL_PACKET_LEN, 0xff, HCI_HOST_ACL_PACKET_NUM, 1);
+            break;
+        case HCI_INIT_SET_CONTROLLER_TO_HOST_FLOW_CONTROL:
+            hci_stack->substate = HCI_INIT_W4_SET_CONTROLLER_TO_HOST_FLOW_CONTROL;
+            hci_send_cmd(&hci_set_controller_to_host_flow_control, 1); // ACL only
+            break;
+#endif
         case HCI_INIT_SET_EVENT_MASK:
             hci_stack->substate = HCI_INIT_W4_SET_EVENT_MASK;
             if (hci_le_supported()){
@@ -1024,6 +1551,12 @@ static void hci_initializing_run(void){
         // DONE
         case HCI_INIT_DONE:
             // done.
+            hci_stack->init_duration_ms = run_loop_get_time_ms() - hci_stack->init_start_ms;
+            log_info("HCI init done in %"PRIu32" ms, custom init %"PRIu32" ms, controller info %s", hci_stack->init_duration_ms,
+                hci_stack->init_script_duration_ms, hci_stack->controller_info_cached ? "loaded" : "read");
+            if (hci_stack->controller_info_db && !hci_stack->controller_info_cached){
+                hci_stack->controller_info_db->put_controller_info(&hci_stack->controller_info);
+            }
             hci_stack->state = HCI_STATE_WORKING;
             hci_emit_state();
             return;
@@ -1059,11 +1592,34 @@ static void hci_initializing_event_handler(uint8_t * packet, uint16_t size){
         }
     }
     // Vendor == CSR
-    if (hci_stack->substate == HCI_INIT_W4_CUSTOM_INIT && packet[0] == HCI_EVENT_VENDOR_SPECIFIC){
+    // only if a single init script command is outstanding, pipelined commands are completed by Command Complete
+    if (hci_stack->substate == HCI_INIT_W4_CUSTOM_INIT && packet[0] == HCI_EVENT_VENDOR_SPECIFIC
+    && hci_stack->init_script_cmds_pending <= 1){
         // TODO: track actual command
         command_completed = 1;
     }
 
+    // init script commands can be in flight, they complete in order
+    // only Command Complete and Command Status with error end a command
+    if (hci_stack->init_script_cmds_pending
+    && (hci_stack->substate == HCI_INIT_CUSTOM_INIT || hci_stack->substate == HCI_INIT_W4_CUSTOM_INIT)){
+        switch (packet[0]){
+            case HCI_EVENT_COMMAND_COMPLETE:
+                command_completed = 1;
+                break;
+            case HCI_EVENT_COMMAND_STATUS:
+                if (packet[2]){
+                    command_completed = 1;
+                }
+                break;
+            default:
+                break;
+        }
+        if (command_completed){
+            hci_stack->init_script_cmds_pending--;
+        }
+    }
+
     if (!command_completed) return;
 
     int need_baud_change = hci_stack->config
@@ -1129,10 +1685,30 @@ static void hci_initializing_event_handler(uint8_t * packet, uint16_t size){
             run_loop_remove_timer(&hci_stack->timeout);
             hci_stack->substate = HCI_INIT_CUSTOM_INIT;
             return;
+        case HCI_INIT_CUSTOM_INIT:
+            // pipelined init script command completed, keep sending
+            return;
         case HCI_INIT_W4_CUSTOM_INIT:
-            // repeat custom init
+            // repeat custom init after all commands in flight completed
+            if (hci_stack->init_script_cmds_pending) return;
             hci_stack->substate = HCI_INIT_CUSTOM_INIT;
             return;
+        case HCI_INIT_W4_READ_BD_ADDR:
+            hci_controller_info_load();
+            if (!hci_stack->controller_info_cached) break;
+            // skip reading supported commands, buffer size and supported features
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+            hci_stack->substate = HCI_INIT_HOST_BUFFER_SIZE;
+#else
+            hci_stack->substate = HCI_INIT_SET_EVENT_MASK;
+#endif
+            return;
+#ifndef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+        case HCI_INIT_W4_READ_LOCAL_SUPPORTED_FEATUES:
+            // skip controller to host flow control
+            hci_stack->substate = HCI_INIT_SET_EVENT_MASK;
+            return;
+#endif
         case HCI_INIT_W4_READ_LOCAL_SUPPORTED_COMMANDS:
             // skip read buffer size if not supported
             if (hci_stack->local_supported_commands[0] & 0x01) break;
@@ -1142,7 +1718,7 @@ static void hci_initializing_event_handler(uint8_t * packet, uint16_t size){
             // skip Classic init commands for LE only chipsets
             if (!hci_classic_supported()){
                 if (hci_le_supported()){
-                    hci_stack->substate = HCI_INIT_LE_READ_BUFFER_SIZE; // skip all classic command
+                    hci_stack->substate = hci_initializing_le_substate(); // skip all classic command
                     return;
                 } else {
                     log_error("Neither BR/EDR nor LE supported");
@@ -1166,6 +1742,13 @@ static void hci_initializing_event_handler(uint8_t * packet, uint16_t size){
                 hci_stack->substate = HCI_INIT_DONE;
                 return;
             }
+            hci_stack->substate = hci_initializing_le_substate();
+            return;
+        case HCI_INIT_W4_WRITE_LE_HOST_SUPPORTED:
+            // skip read white list size if controller info was loaded
+            if (!hci_stack->controller_info_cached) break;
+            hci_stack->substate = HCI_INIT_LE_SET_SCAN_PARAMETERS;
+            return;
         default:
             break;
     }
@@ -1202,6 +1785,7 @@ static void event_handler(uint8_t *packet, int size){
             // get num cmd packets
             // log_info("HCI_EVENT_COMMAND_COMPLETE cmds old %u - new %u", hci_stack->num_cmd_packets, packet[2]);
             hci_stack->num_cmd_packets = packet[2];
+            hci_statistics_count_cmd_completed(READ_BT_16(packet, 3));
 
             if (COMMAND_COMPLETE_EVENT(packet, hci_read_buffer_size)){
                 // from offset 5
@@ -1211,6 +1795,10 @@ static void event_handler(uint8_t *packet, int size){
                 hci_stack->sco_data_packet_length = packet[8];
                 hci_stack->acl_packets_total_num  = READ_BT_16(packet, 9);
                 hci_stack->sco_packets_total_num  = READ_BT_16(packet, 11); 
+                hci_stack->controller_info.acl_data_packet_length = hci_stack->acl_data_packet_length;
+                hci_stack->controller_info.sco_data_packet_length = hci_stack->sco_data_packet_length;
+                hci_stack->controller_info.acl_packets_total_num  = READ_BT_16(packet, 9);
+                hci_stack->controller_info.sco_packets_total_num  = READ_BT_16(packet, 11);
 
                 if (hci_stack->state == HCI_STATE_INITIALIZING){
                     // determine usable ACL payload size
@@ -1226,6 +1814,8 @@ static void event_handler(uint8_t *packet, int size){
             if (COMMAND_COMPLETE_EVENT(packet, hci_le_read_buffer_size)){
                 hci_stack->le_data_packets_length = READ_BT_16(packet, 6);
                 hci_stack->le_acl_packets_total_num  = packet[8];
+                hci_stack->controller_info.le_data_packets_length   = hci_stack->le_data_packets_length;
+                hci_stack->controller_info.le_acl_packets_total_num = hci_stack->le_acl_packets_total_num;
                     // determine usable ACL payload size
                     if (HCI_ACL_PAYLOAD_SIZE < hci_stack->le_data_packets_length){
                         hci_stack->le_data_packets_length = HCI_ACL_PAYLOAD_SIZE;
@@ -1234,6 +1824,7 @@ static void event_handler(uint8_t *packet, int size){
             }         
             if (COMMAND_COMPLETE_EVENT(packet, hci_le_read_white_list_size)){
                 hci_stack->le_whitelist_capacity = READ_BT_16(packet, 6);
+                hci_stack->controller_info.le_whitelist_capacity = hci_stack->le_whitelist_capacity;
                 log_info("hci_le_read_white_list_size: size %u", hci_stack->le_whitelist_capacity);
             }   
 #endif
@@ -1243,32 +1834,35 @@ static void event_handler(uint8_t *packet, int size){
                 log_info("Local Address, Status: 0x%02x: Addr: %s",
                     packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE], bd_addr_to_str(hci_stack->local_bd_addr));
             }
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+            if (COMMAND_COMPLETE_EVENT(packet, hci_set_controller_to_host_flow_control)){
+                hci_stack->host_flow_control_enabled = packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE] == 0;
+                log_info("Controller to host flow control enabled %u", hci_stack->host_flow_control_enabled);
+            }
+#endif
             if (COMMAND_COMPLETE_EVENT(packet, hci_write_scan_enable)){
                 hci_emit_discoverable_enabled(hci_stack->discoverable);
             }
             // Note: HCI init checks 
             if (COMMAND_COMPLETE_EVENT(packet, hci_read_local_supported_features)){
                 memcpy(hci_stack->local_supported_features, &packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE+1], 8);
-
-                // determine usable ACL packet types based on host buffer size and supported features
-                hci_stack->packet_types = hci_acl_packet_types_for_buffer_size_and_local_features(HCI_ACL_PAYLOAD_SIZE, &hci_stack->local_supported_features[0]);
-                log_info("packet types %04x", hci_stack->packet_types); 
-
-                // Classic/LE
-                log_info("BR/EDR support %u, LE support %u", hci_classic_supported(), hci_le_supported());
+                memcpy(hci_stack->controller_info.local_supported_features, hci_stack->local_supported_features, 8);
+                hci_update_packet_types();
             }
             if (COMMAND_COMPLETE_EVENT(packet, hci_read_local_version_information)){
-                // hci_stack->hci_version    = READ_BT_16(packet, 4);
-                // hci_stack->hci_revision   = READ_BT_16(packet, 6);
-                // hci_stack->lmp_version    = READ_BT_16(packet, 8);
+                hci_stack->controller_info.hci_version    = packet[6];
+                hci_stack->controller_info.hci_revision   = READ_BT_16(packet, 7);
+                hci_stack->controller_info.lmp_version    = packet[9];
+                hci_stack->controller_info.manufacturer   = READ_BT_16(packet, 10);
+                hci_stack->controller_info.lmp_subversion = READ_BT_16(packet, 12);
                 hci_stack->manufacturer   = READ_BT_16(packet, 10);
-                // hci_stack->lmp_subversion = READ_BT_16(packet, 12);
                 log_info("Manufacturer: 0x%04x", hci_stack->manufacturer);
             }
             if (COMMAND_COMPLETE_EVENT(packet, hci_read_local_supported_commands)){
                 hci_stack->local_supported_commands[0] =
                     (packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE+1+14] & 0X80) >> 7 |  // Octet 14, bit 7
                     (packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE+1+24] & 0x40) >> 5;   // Octet 24, bit 6 
+                hci_stack->controller_info.local_supported_commands[0] = hci_stack->local_supported_commands[0];
             }
             break;
             
@@ -1276,6 +1870,7 @@ static void event_handler(uint8_t *packet, int size){
             // get num cmd packets
             // log_info("HCI_EVENT_COMMAND_STATUS cmds - old %u - new %u", hci_stack->num_cmd_packets, packet[3]);
             hci_stack->num_cmd_packets = packet[3];
+            hci_statistics_count_cmd_completed(READ_BT_16(packet, 4));
             break;
             
         case HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS:{
@@ -1293,20 +1888,12 @@ static void event_handler(uint8_t *packet, int size){
                 }
                 
                 if (conn->address_type == BD_ADDR_TYPE_SCO){
-                    if (conn->num_sco_packets_sent >= num_packets){
-                        conn->num_sco_packets_sent -= num_packets;
-                    } else {
-                        log_error("hci_number_completed_packets, more sco slots freed then sent.");
-                        conn->num_sco_packets_sent = 0;
-                    }
-
+                    hci_count_sco_packets_completed(conn, num_packets);
                 } else {
-                    if (conn->num_acl_packets_sent >= num_packets){
-                        conn->num_acl_packets_sent -= num_packets;
-                    } else {
-                        log_error("hci_number_completed_packets, more acl slots freed then sent.");
-                        conn->num_acl_packets_sent = 0;
-                    }
+#ifdef ENABLE_HCI_ACL_LATENCY_HISTOGRAMS
+                    hci_acl_latency_fragments_completed(conn, num_packets);
+#endif
+                    hci_count_acl_packets_completed(conn, num_packets);
                 }
                 // log_info("hci_number_completed_packet %u processed for handle %u, outstanding %u", num_packets, handle, conn->num_acl_packets_sent);
             }
@@ -1342,7 +1929,7 @@ static void event_handler(uint8_t *packet, int size){
             if (conn) {
                 if (!packet[2]){
                     conn->state = OPEN;
-                    conn->con_handle = READ_BT_16(packet, 3);
+                    hci_connection_set_handle(conn, READ_BT_16(packet, 3));
                     conn->bonding_flags |= BONDING_REQUEST_REMOTE_FEATURES;
 
                     // restart timer
@@ -1359,8 +1946,7 @@ static void event_handler(uint8_t *packet, int size){
                     memcpy(&bd_address, conn->address, 6);
 
                     // connection failed, remove entry
-                    linked_list_remove(&hci_stack->connections, (linked_item_t *) conn);
-                    btstack_memory_hci_connection_free( conn );
+                    hci_connection_free(conn);
                     
                     // notify client if dedicated bonding
                     if (notify_dedicated_bonding_failed){
@@ -1391,7 +1977,7 @@ static void event_handler(uint8_t *packet, int size){
                 break;
             }
             conn->state = OPEN;
-            conn->con_handle = READ_BT_16(packet, 3);            
+            hci_connection_set_handle(conn, READ_BT_16(packet, 3));            
             break;
 
         case HCI_EVENT_READ_REMOTE_SUPPORTED_FEATURES_COMPLETE:
@@ -1580,8 +2166,15 @@ static void event_handler(uint8_t *packet, int size){
                 log_error("Synchronous HCI Transport shouldn't send DAEMON_EVENT_HCI_PACKET_SENT");
                 return; // instead of break: to avoid re-entering hci_run()
             }
-            if (hci_stack->acl_fragmentation_total_size) break;
-            hci_release_packet_buffer();
+            if (hci_stack->hci_packet_buffer_reserved && hci_stack->hci_transport->can_send_packet_now(HCI_COMMAND_DATA_PACKET)){
+                hci_stack->hci_packet_buffer_reserved = 0;
+            }
+            if (hci_stack->hci_transport->can_send_packet_now(HCI_SCO_DATA_PACKET)){
+                hci_release_sco_buffer_sending();
+            }
+            if (hci_stack->hci_transport->can_send_packet_now(HCI_ACL_DATA_PACKET)){
+                hci_release_acl_buffer_sending();
+            }
             break;
 
 #ifdef HAVE_BLE
@@ -1608,8 +2201,7 @@ static void event_handler(uint8_t *packet, int size){
                         hci_stack->le_connecting_state = LE_CONNECTING_IDLE;
                         // remove entry
                         if (conn){
-                            linked_list_remove(&hci_stack->connections, (linked_item_t *) conn);
-                            btstack_memory_hci_connection_free( conn );
+                            hci_connection_free(conn);
                         }
                         break;
                     }
@@ -1632,7 +2224,7 @@ static void event_handler(uint8_t *packet, int size){
                     
                     conn->state = OPEN;
                     conn->role  = packet[6];
-                    conn->con_handle = READ_BT_16(packet, 4);
+                    hci_connection_set_handle(conn, READ_BT_16(packet, 4));
                     
                     // TODO: store - role, peer address type, conn_interval, conn_latency, supervision timeout, master clock
 
@@ -1695,6 +2287,10 @@ static void event_handler(uint8_t *packet, int size){
 }
 
 static void sco_handler(uint8_t * packet, uint16_t size){
+    hci_connection_t * conn = hci_connection_for_handle(READ_ACL_CONNECTION_HANDLE(packet));   // same for ACL and SCO
+    if (conn){
+        hci_statistics_count_sco_received(conn, size - 3);
+    }
     if (!hci_stack->sco_packet_handler) return;
     hci_stack->sco_packet_handler(HCI_SCO_DATA_PACKET, packet, size);
 }
@@ -1707,6 +2303,9 @@ static void packet_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
             break;
         case HCI_ACL_DATA_PACKET:
             acl_handler(packet, size);
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+            hci_host_acl_packet_processed(READ_ACL_CONNECTION_HANDLE(packet));
+#endif
             break;
         case HCI_SCO_DATA_PACKET:
             sco_handler(packet, size);
@@ -1730,14 +2329,26 @@ void hci_register_sco_packet_handler(void (*handler)(uint8_t packet_type, uint8_
 static void hci_state_reset(void){
     // no connections yet
     hci_stack->connections = NULL;
+    memset(hci_stack->connections_for_handle,  0, sizeof(hci_stack->connections_for_handle));
+    memset(hci_stack->connections_for_address, 0, sizeof(hci_stack->connections_for_address));
+    hci_stack->acl_packets_sent_classic = 0;
+    hci_stack->acl_packets_sent_le = 0;
+    hci_stack->sco_packets_sent = 0;
+    memset(&hci_stack->statistics, 0, sizeof(hci_statistics_t));
+    hci_stack->acl_no_free_slots = 0;
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+    hci_stack->host_flow_control_enabled = 0;
+    hci_stack->host_num_completed_packets = 0;
+#endif
 
     // keep discoverable/connectable as this has been requested by the client(s)
     // hci_stack->discoverable = 0;
     // hci_stack->connectable = 0;
     // hci_stack->bondable = 1;
 
-    // buffer is free
+    // buffers are free
     hci_stack->hci_packet_buffer_reserved = 0;
+    hci_acl_buffers_init();
 
     // no pending cmds
     hci_stack->decline_reason = 0;
@@ -1842,6 +2453,76 @@ void hci_set_bd_addr(bd_addr_t addr){
     hci_stack->custom_bd_addr_set = 1;
 }
 
+void hci_set_controller_info_db(controller_info_db_t const * controller_info_db){
+    hci_stack->controller_info_db = controller_info_db;
+}
+
+uint32_t hci_get_init_duration_ms(void){
+    return hci_stack->init_duration_ms;
+}
+
+uint32_t hci_get_init_script_duration_ms(void){
+    return hci_stack->init_script_duration_ms;
+}
+
+uint32_t hci_get_packet_receive_timestamp_us(void){
+    if (!hci_stack->hci_transport->get_packet_receive_timestamp_us) return 0;
+    return hci_stack->hci_transport->get_packet_receive_timestamp_us();
+}
+
+int hci_get_connection_statistics(hci_con_handle_t con_handle, hci_statistics_t * statistics){
+    hci_connection_t * conn = hci_connection_for_handle(con_handle);
+    if (!conn) return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+    memcpy(statistics, &conn->statistics, sizeof(hci_statistics_t));
+    if (conn->acl_no_free_slots){
+        statistics->acl_no_free_slots_ms += run_loop_get_time_ms() - conn->acl_no_free_slots_start_ms;
+    }
+    statistics->acl_packets_queued = linked_list_count(&conn->acl_buffers_queued);
+    return 0;
+}
+
+void hci_get_statistics(hci_statistics_t * statistics){
+    memcpy(statistics, &hci_stack->statistics, sizeof(hci_statistics_t));
+    if (hci_stack->acl_no_free_slots){
+        statistics->acl_no_free_slots_ms += run_loop_get_time_ms() - hci_stack->acl_no_free_slots_start_ms;
+    }
+    statistics->acl_packets_queued = 0;
+    linked_item_t * it;
+    for (it = (linked_item_t *) hci_stack->connections; it ; it = it->next){
+        statistics->acl_packets_queued += linked_list_count(&((hci_connection_t *) it)->acl_buffers_queued);
+    }
+}
+
+int hci_get_acl_latency(hci_con_handle_t con_handle, hci_acl_latency_t * latency){
+    hci_connection_t * conn = hci_connection_for_handle(con_handle);
+    if (!conn) return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+#ifdef ENABLE_HCI_ACL_LATENCY_HISTOGRAMS
+    memcpy(latency, &conn->acl_latency, sizeof(hci_acl_latency_t));
+#else
+    memset(latency, 0, sizeof(hci_acl_latency_t));
+#endif
+    return 0;
+}
+
+void hci_reset_statistics(void){
+    uint32_t now = run_loop_get_time_ms();
+    linked_item_t * it;
+    for (it = (linked_item_t *) hci_stack->connections; it ; it = it->next){
+        hci_connection_t * conn = (hci_connection_t *) it;
+        memset(&conn->statistics, 0, sizeof(hci_statistics_t));
+        conn->acl_no_free_slots_start_ms = now;
+#ifdef ENABLE_HCI_ACL_LATENCY_HISTOGRAMS
+        memset(&conn->acl_latency, 0, sizeof(hci_acl_latency_t));
+#endif
+    }
+    // keep commands in flight
+    uint16_t cmd_packets_pending = hci_stack->statistics.cmd_packets_pending;
+    memset(&hci_stack->statistics, 0, sizeof(hci_statistics_t));
+    hci_stack->statistics.cmd_packets_pending = cmd_packets_pending;
+    hci_stack->statistics.cmd_packets_pending_max = cmd_packets_pending;
+    hci_stack->acl_no_free_slots_start_ms = now;
+}
+
 void hci_disable_l2cap_timeout_check(void){
     disable_l2cap_timeouts = 1;
 }
@@ -1949,6 +2630,12 @@ static void hci_power_transition_to_initializing(void){
     hci_stack->hci_packet_buffer_reserved = 0;
     hci_stack->state = HCI_STATE_INITIALIZING;
     hci_stack->substate = HCI_INIT_SEND_RESET;
+    memset(&hci_stack->controller_info, 0, sizeof(controller_info_t));
+    hci_stack->init_start_ms = run_loop_get_time_ms();
+    hci_stack->init_duration_ms = 0;
+    hci_stack->init_script_cmds_sent = 0;
+    hci_stack->init_script_cmds_pending = 0;
+    hci_stack->init_script_duration_ms = 0;
 }
 
 int hci_power_control(HCI_POWER_MODE power_mode){
@@ -2118,26 +2805,11 @@ void hci_local_bd_addr(bd_addr_t address_buffer){
     memcpy(address_buffer, hci_stack->local_bd_addr, 6);
 }
 
-void hci_run(void){
+// send next pending command, if any
+static void hci_run_next_command(void){
     
-    // log_info("hci_run: entered");
     linked_item_t * it;
 
-    // send continuation fragments first, as they block the prepared packet buffer
-    if (hci_stack->acl_fragmentation_total_size > 0) {
-        hci_con_handle_t con_handle = READ_ACL_CONNECTION_HANDLE(hci_stack->hci_packet_buffer);
-        if (hci_can_send_prepared_acl_packet_now(con_handle)){
-            hci_connection_t *connection = hci_connection_for_handle(con_handle);
-            if (connection) {
-                hci_send_acl_packet_fragments(connection);
-                return;
-            } 
-            // connection gone -> discard further fragments
-            hci_stack->acl_fragmentation_total_size = 0;
-            hci_stack->acl_fragmentation_pos = 0;
-        }        
-    }
-
     if (!hci_can_send_command_packet_now()) return;
 
     // global/non-connection oriented commands
@@ -2554,6 +3226,30 @@ void hci_run(void){
     }
 }
 
+void hci_run(void){
+    
+    // log_info("hci_run: entered");
+
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+    // report processed ACL packets
+    hci_host_send_number_of_completed_packets();
+#endif
+
+    // send queued ACL packets
+    hci_send_queued_acl_packets();
+
+    // send commands as long as the controller accepts more (Num_HCI_Command_Packets).
+    // during init and power transitions, each step waits for the previous command to complete,
+    // except for init script commands that can be pipelined
+    while (hci_can_send_command_packet_now()){
+        uint8_t num_cmd_packets = hci_stack->num_cmd_packets;
+        hci_run_next_command();
+        if (hci_stack->num_cmd_packets == num_cmd_packets) break;
+        if (hci_stack->state == HCI_STATE_INITIALIZING && hci_stack->substate == HCI_INIT_CUSTOM_INIT) continue;
+        if (hci_stack->state != HCI_STATE_WORKING) break;
+    }
+}
+
 int hci_send_cmd_packet(uint8_t *packet, int size){
     bd_addr_t addr;
     hci_connection_t * conn;
@@ -2661,6 +3357,12 @@ int hci_send_cmd_packet(uint8_t *packet, int size){
 
     hci_stack->num_cmd_packets--;
 
+    hci_stack->statistics.cmd_packets_sent++;
+    hci_stack->statistics.cmd_packets_pending++;
+    if (hci_stack->statistics.cmd_packets_pending > hci_stack->statistics.cmd_packets_pending_max){
+        hci_stack->statistics.cmd_packets_pending_max = hci_stack->statistics.cmd_packets_pending;
+    }
+
     hci_dump_packet(HCI_COMMAND_DATA_PACKET, 0, packet, size);
     int err = hci_stack->hci_transport->send_packet(HCI_COMMAND_DATA_PACKET, packet, size);
 
@@ -2718,7 +3420,7 @@ int hci_send_cmd(const hci_cmd_t *cmd, ...){
     // log_info("hci_send_cmd: opcode %04x", cmd->opcode);
     hci_stack->last_cmd_opcode = cmd->opcode;
 
-    hci_reserve_packet_buffer();
+    hci_stack->hci_packet_buffer_reserved = 1;
     uint8_t * packet = hci_stack->hci_packet_buffer;
 
     va_list argptr;
@@ -2828,6 +3530,45 @@ void hci_emit_btstack_version(void){
 }
 #endif
 
+// con_handle 0xffff for statistics summed up over all connections
+void hci_emit_hci_statistics(hci_con_handle_t con_handle){
+    hci_statistics_t statistics;
+    uint8_t status = 0;
+    if (con_handle == 0xffff){
+        hci_get_statistics(&statistics);
+    } else {
+        status = hci_get_connection_statistics(con_handle, &statistics);
+        if (status){
+            memset(&statistics, 0, sizeof(hci_statistics_t));
+        }
+    }
+    log_info("BTSTACK_EVENT_HCI_STATISTICS handle 0x%04x, status 0x%02x", con_handle, status);
+    uint8_t event[2 + 1 + 2 + 13 * 4 + 3 * 2];
+    event[0] = BTSTACK_EVENT_HCI_STATISTICS;
+    event[1] = sizeof(event) - 2;
+    event[2] = status;
+    bt_store_16(event, 3, con_handle);
+    int pos = 5;
+    bt_store_32(event, pos, statistics.acl_packets_sent);        pos += 4;
+    bt_store_32(event, pos, statistics.acl_fragments_sent);      pos += 4;
+    bt_store_32(event, pos, statistics.acl_bytes_sent);          pos += 4;
+    bt_store_32(event, pos, statistics.acl_packets_received);    pos += 4;
+    bt_store_32(event, pos, statistics.acl_bytes_received);      pos += 4;
+    bt_store_32(event, pos, statistics.acl_recombination_drops); pos += 4;
+    bt_store_32(event, pos, statistics.acl_buffers_full);        pos += 4;
+    bt_store_32(event, pos, statistics.acl_no_free_slots_ms);    pos += 4;
+    bt_store_32(event, pos, statistics.sco_packets_sent);        pos += 4;
+    bt_store_32(event, pos, statistics.sco_bytes_sent);          pos += 4;
+    bt_store_32(event, pos, statistics.sco_packets_received);    pos += 4;
+    bt_store_32(event, pos, statistics.sco_bytes_received);      pos += 4;
+    bt_store_32(event, pos, statistics.cmd_packets_sent);        pos += 4;
+    bt_store_16(event, pos, statistics.acl_packets_queued);      pos += 2;
+    bt_store_16(event, pos, statistics.cmd_packets_pending);     pos += 2;
+    bt_store_16(event, pos, statistics.cmd_packets_pending_max);
+    hci_dump_packet( HCI_EVENT_PACKET, 0, event, sizeof(event));
+    hci_stack->packet_handler(HCI_EVENT_PACKET, event, sizeof(event));
+}
+
 void hci_emit_system_bluetooth_enabled(uint8_t enabled){
     log_info("BTSTACK_EVENT_SYSTEM_BLUETOOTH_ENABLED %u", enabled);
     uint8_t event[3];
@@ -3108,8 +3849,7 @@ le_command_status_t le_central_connect_cancel(void){
         case SEND_CREATE_CONNECTION:
             // skip sending create connection and emit event instead
             hci_emit_le_connection_complete(conn->address_type, conn->address, 0, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
-            linked_list_remove(&hci_stack->connections, (linked_item_t *) conn);
-            btstack_memory_hci_connection_free( conn );
+            hci_connection_free(conn);
             break;            
         case SENT_CREATE_CONNECTION:
             // request to send cancel connection
@@ -52,6 +52,7 @@
 #include "hci_transport.h"
 #include "bt_control.h"
 #include "remote_device_db.h"
+#include "controller_info_db.h"
 
 #include <stdint.h>
 #include <stdlib.h>
@@ -117,6 +118,49 @@ extern "C" {
 // additional pre-buffer space for packets to Bluetooth module, for now, used for HCI Transport H4 DMA
 #define HCI_OUTGOING_PRE_BUFFER_SIZE 1
 
+// priorities for outgoing ACL scheduler, used as weight in deficit round robin
+#define HCI_ACL_PRIORITY_LOW      1
+#define HCI_ACL_PRIORITY_DEFAULT  2
+#define HCI_ACL_PRIORITY_HIGH     8
+
+// number of ACL recombination buffers shared by all connections, can be defined in config.h
+#if !defined(MAX_NO_HCI_ACL_RECOMBINATION_BUFFERS) && defined(MAX_NO_HCI_CONNECTIONS)
+    #define MAX_NO_HCI_ACL_RECOMBINATION_BUFFERS MAX_NO_HCI_CONNECTIONS
+#endif
+
+// number of buckets for connection lookup by handle and address, power of 2, can be defined in config.h
+#ifndef HCI_CONNECTION_HASH_SIZE
+    #define HCI_CONNECTION_HASH_SIZE 8
+#endif
+#if HCI_CONNECTION_HASH_SIZE & (HCI_CONNECTION_HASH_SIZE - 1)
+    #error HCI_CONNECTION_HASH_SIZE must be a power of 2
+#endif
+
+// number of outgoing ACL/SCO packet buffers, can be defined in config.h
+#ifndef HCI_OUTGOING_ACL_BUFFERS
+    #define HCI_OUTGOING_ACL_BUFFERS 1
+#endif
+#if HCI_OUTGOING_ACL_BUFFERS < 1
+    #error HCI_OUTGOING_ACL_BUFFERS must be at least 1
+#endif
+
+// controller to host flow control for ACL packets, enabled by ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL in config.h
+// number of ACL packets the controller may send before BTstack reports them as completed, can be defined in config.h
+#ifndef HCI_HOST_ACL_PACKET_NUM
+    #define HCI_HOST_ACL_PACKET_NUM 8
+#endif
+#ifndef HCI_HOST_ACL_PACKET_LEN
+    #define HCI_HOST_ACL_PACKET_LEN HCI_ACL_PAYLOAD_SIZE
+#endif
+
+// ACL latency histograms, enabled by ENABLE_HCI_ACL_LATENCY_HISTOGRAMS in config.h
+// number of sent ACL packets per connection that are tracked until completed, can be defined in config.h
+#ifndef HCI_ACL_LATENCY_FIFO_SIZE
+    #define HCI_ACL_LATENCY_FIFO_SIZE 16
+#endif
+// bucket 0: 0 ms, bucket i: 2^(i-1) to 2^i - 1 ms, last bucket: everything above
+#define HCI_LATENCY_HISTOGRAM_BUCKETS 12
+
 // BNEP may uncompress the IP Header by 16 bytes
 #ifdef HAVE_BNEP
 #define HCI_INCOMING_PRE_BUFFER_SIZE (16 - HCI_ACL_HEADER_SIZE - 4)
@@ -161,6 +205,9 @@ extern "C" {
 // set global Bluetooth state
 #define BTSTACK_SET_BLUETOOTH_ENABLED                      0x08
 
+// get HCI statistics: @param handle(16), 0xffff for all connections
+#define BTSTACK_GET_HCI_STATISTICS                         0x09
+
 // create l2cap channel: @param bd_addr(48), psm (16)
 #define L2CAP_CREATE_CHANNEL                               0x20
 
@@ -485,9 +532,93 @@ typedef struct sm_connection {
     int                      sm_le_db_index;
 } sm_connection_t;
 
+/**
+ * outgoing ACL/SCO packet buffer
+ */
+typedef struct {
+    // linked list - assert: first field
+    linked_item_t item;
+
+    // size of ACL packet and start of next fragment
+    uint16_t size;
+    uint16_t fragmentation_pos;
+
+#ifdef ENABLE_HCI_ACL_LATENCY_HISTOGRAMS
+    // time packet was queued by L2CAP
+    uint32_t queued_ms;
+#endif
+
+    // additional prebuffer for H4 drivers + packet
+    uint8_t  prefix[HCI_OUTGOING_PRE_BUFFER_SIZE];
+    uint8_t  buffer[HCI_PACKET_BUFFER_SIZE];
+} hci_acl_buffer_t;
+
+/**
+ * buffer for ACL packet recombination
+ */
+typedef struct {
+    // PRE_BUFFER + ACL Header + ACL payload
+    uint8_t buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 4 + HCI_ACL_BUFFER_SIZE];
+} hci_acl_recombination_buffer_t;
+
+/**
+ * HCI traffic statistics, for a single connection or summed up over all connections
+ */
+typedef struct {
+    uint32_t acl_packets_sent;          // ACL packets queued by L2CAP
+    uint32_t acl_fragments_sent;        // HCI ACL packets sent to controller
+    uint32_t acl_bytes_sent;            // ACL payload
+    uint32_t acl_packets_received;      // HCI ACL packets received from controller
+    uint32_t acl_bytes_received;        // ACL payload
+    uint32_t acl_recombination_drops;   // fragments dropped during recombination
+    uint32_t acl_buffers_full;          // ACL send requests rejected with BTSTACK_ACL_BUFFERS_FULL
+    uint32_t acl_no_free_slots_ms;      // time with queued packets but no free controller buffer
+    uint32_t sco_packets_sent;
+    uint32_t sco_bytes_sent;
+    uint32_t sco_packets_received;
+    uint32_t sco_bytes_received;
+    uint32_t cmd_packets_sent;          // only global
+    uint16_t acl_packets_queued;        // current length of outgoing ACL queue
+    uint16_t cmd_packets_pending;       // only global: commands not completed by controller yet
+    uint16_t cmd_packets_pending_max;   // only global
+} hci_statistics_t;
+
+/**
+ * latency histogram in ms
+ */
+typedef struct {
+    uint32_t count;
+    uint32_t sum_ms;
+    uint32_t max_ms;
+    uint32_t buckets[HCI_LATENCY_HISTOGRAM_BUCKETS];
+} hci_latency_histogram_t;
+
+/**
+ * ACL latency: from sending a fragment until the controller reports it as completed,
+ * and from queuing a packet in L2CAP until its last fragment is completed
+ */
 typedef struct {
+    hci_latency_histogram_t fragment_completion;
+    hci_latency_histogram_t packet_completion;
+} hci_acl_latency_t;
+
+#ifdef ENABLE_HCI_ACL_LATENCY_HISTOGRAMS
+// sent ACL fragment waiting for Number Of Completed Packets
+typedef struct {
+    uint32_t sent_ms;
+    uint32_t queued_ms;
+    uint16_t untracked_before;      // fragments sent before this one while the fifo was full
+    uint8_t  last_fragment;
+} hci_acl_latency_entry_t;
+#endif
+
+typedef struct hci_connection {
     // linked list - assert: first field
     linked_item_t    item;
+
+    // hash table chains for lookup by handle and address
+    struct hci_connection * next_for_handle;
+    struct hci_connection * next_for_address;
     
     // remote side
     bd_addr_t address;
@@ -518,23 +649,44 @@ typedef struct {
 
     timer_source_t timeout;
     
-#ifdef HAVE_TIME
-    // timer
-    struct timeval timestamp;
-#endif
-#ifdef HAVE_TICK
-    uint32_t timestamp; // timeout in system ticks
-#endif
+    // time of last ACL packet, see run_loop_get_time_ms
+    uint32_t timestamp_ms;
     
-    // ACL packet recombination - PRE_BUFFER + ACL Header + ACL payload
-    uint8_t  acl_recombination_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 4 + HCI_ACL_BUFFER_SIZE];
+    // ACL packet recombination - buffer only allocated while L2CAP packet is fragmented
+    hci_acl_recombination_buffer_t * acl_recombination_buffer;
     uint16_t acl_recombination_pos;
     uint16_t acl_recombination_length;
     
+    // outgoing ACL packets waiting for free controller buffers
+    linked_list_t acl_buffers_queued;
+
+    // outgoing ACL scheduler: weight and deficit in bytes
+    uint8_t  acl_priority;
+    uint32_t acl_deficit;
+
     // number packets sent to controller
     uint8_t num_acl_packets_sent;
     uint8_t num_sco_packets_sent;
 
+#ifdef ENABLE_HCI_ACL_LATENCY_HISTOGRAMS
+    // sent fragments in order. fragments sent while the fifo was full are not tracked, only counted
+    hci_acl_latency_entry_t acl_latency_fifo[HCI_ACL_LATENCY_FIFO_SIZE];
+    uint8_t  acl_latency_fifo_head;
+    uint8_t  acl_latency_fifo_count;
+    uint16_t acl_latency_untracked;     // untracked fragments sent after last tracked one
+    hci_acl_latency_t acl_latency;
+#endif
+
+    // traffic statistics, start of current wait for free controller buffers
+    hci_statistics_t statistics;
+    uint32_t acl_no_free_slots_start_ms;
+    uint8_t  acl_no_free_slots;
+
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+    // number of received packets processed but not reported to controller yet
+    uint16_t host_num_completed_packets;
+#endif
+
     // LE Connection parameter update
     le_con_parameter_update_state_t le_con_parameter_update_state;
     uint8_t  le_con_param_update_identifier;
@@ -582,6 +734,10 @@ typedef enum hci_init_state{
     HCI_INIT_W4_READ_BUFFER_SIZE,
     HCI_INIT_READ_LOCAL_SUPPORTED_FEATUES,
     HCI_INIT_W4_READ_LOCAL_SUPPORTED_FEATUES,
+    HCI_INIT_HOST_BUFFER_SIZE,
+    HCI_INIT_W4_HOST_BUFFER_SIZE,
+    HCI_INIT_SET_CONTROLLER_TO_HOST_FLOW_CONTROL,
+    HCI_INIT_W4_SET_CONTROLLER_TO_HOST_FLOW_CONTROL,
     HCI_INIT_SET_EVENT_MASK,
     HCI_INIT_W4_SET_EVENT_MASK,
     HCI_INIT_WRITE_SIMPLE_PAIRING_MODE,
@@ -659,13 +815,24 @@ typedef struct {
     
     // list of existing baseband connections
     linked_list_t     connections;
+    hci_connection_t * connections_for_handle[HCI_CONNECTION_HASH_SIZE];
+    hci_connection_t * connections_for_address[HCI_CONNECTION_HASH_SIZE];
 
-    // single buffer for HCI packet assembly + additional prebuffer for H4 drivers
+    // buffer for HCI command assembly + additional prebuffer for H4 drivers
     uint8_t   hci_packet_buffer_prefix[HCI_OUTGOING_PRE_BUFFER_SIZE];
-    uint8_t   hci_packet_buffer[HCI_PACKET_BUFFER_SIZE]; // opcode (16), len(8)
+    uint8_t   hci_packet_buffer[HCI_CMD_BUFFER_SIZE]; // opcode (16), len(8)
     uint8_t   hci_packet_buffer_reserved;
-    uint16_t  acl_fragmentation_pos;
-    uint16_t  acl_fragmentation_total_size;
+
+    // pool of outgoing ACL/SCO packet buffers
+    hci_acl_buffer_t   acl_buffers[HCI_OUTGOING_ACL_BUFFERS];
+    linked_list_t      acl_buffers_free;
+    // buffer handed out by hci_reserve_packet_buffer
+    hci_acl_buffer_t * acl_buffer_reserved;
+    // buffers owned by asynchronous transport until DAEMON_EVENT_HCI_PACKET_SENT
+    hci_acl_buffer_t * acl_buffer_sending;
+    hci_acl_buffer_t * sco_buffer_sending;
+    // outgoing ACL scheduler continues after this connection
+    hci_con_handle_t   acl_last_scheduled_con_handle;
      
     /* host to controller flow control */
     uint8_t  num_cmd_packets;
@@ -677,6 +844,22 @@ typedef struct {
     uint8_t  le_acl_packets_total_num;
     uint16_t le_data_packets_length;
 
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+    /* controller to host flow control */
+    uint8_t  host_flow_control_enabled;
+    uint16_t host_num_completed_packets;
+#endif
+
+    /* outgoing packets not completed by controller yet, sum over all connections */
+    uint16_t acl_packets_sent_classic;
+    uint16_t acl_packets_sent_le;
+    uint16_t sco_packets_sent;
+
+    /* traffic statistics, number of connections waiting for free controller ACL buffers since start */
+    hci_statistics_t statistics;
+    uint32_t acl_no_free_slots_start_ms;
+    uint8_t  acl_no_free_slots;
+
     /* local supported features */
     uint8_t local_supported_features[8];
 
@@ -703,6 +886,21 @@ typedef struct {
 
     /* remote device db */
     remote_device_db_t const*remote_device_db;
+
+    /* controller info db, allows to skip reading controller capabilities during init */
+    controller_info_db_t const * controller_info_db;
+    controller_info_t controller_info;
+    uint8_t  controller_info_cached;
+
+    /* duration of last HCI init, from power on to HCI_STATE_WORKING */
+    uint32_t init_start_ms;
+    uint32_t init_duration_ms;
+
+    /* chipset init script: commands sent and not completed yet, upload duration */
+    uint16_t init_script_cmds_sent;
+    uint8_t  init_script_cmds_pending;
+    uint32_t init_script_start_ms;
+    uint32_t init_script_duration_ms;
     
     /* hci state machine */
     HCI_STATE      state;
@@ -783,7 +981,9 @@ uint16_t hci_create_cmd_internal(uint8_t *hci_cmd_buffer, const hci_cmd_t *cmd,
  */
 void hci_run(void);
 
-// send ACL packet prepared in hci packet buffer
+// queue ACL packet prepared in hci packet buffer and send it when controller has free buffers
+// @returns 0 if queued or error of transport when sending queued fragments. BTSTACK_ACL_BUFFERS_FULL is not
+//          returned, as packets stay queued until the controller has free buffers
 int hci_send_acl_packet_buffer(int size);
 
 // send SCO packet prepared in hci packet buffer
@@ -795,16 +995,19 @@ int hci_can_send_prepared_acl_packet_now(hci_con_handle_t con_handle);
 int hci_can_send_sco_packet_now(hci_con_handle_t con_handle);
 int hci_can_send_prepared_sco_packet_now(hci_con_handle_t con_handle);
 
-// reserves outgoing packet buffer. @returns 1 if successful
+// reserves outgoing packet buffer from pool of HCI_OUTGOING_ACL_BUFFERS. @returns 1 if successful
 int  hci_reserve_packet_buffer(void);
 void hci_release_packet_buffer(void);
 
 // used for internal checks in l2cap[-le].c
 int hci_is_packet_buffer_reserved(void);
 
-// get point to packet buffer
+// get pointer to reserved packet buffer, NULL if not reserved
 uint8_t* hci_get_outgoing_packet_buffer(void);
 
+// used by l2cap[-le].c to count send requests rejected with BTSTACK_ACL_BUFFERS_FULL
+void hci_statistics_count_acl_buffers_full(hci_con_handle_t con_handle);
+
 
 hci_connection_t * hci_connection_for_handle(hci_con_handle_t con_handle);
 hci_connection_t * hci_connection_for_bd_addr_and_type(bd_addr_t addr, bd_addr_type_t addr_type);
@@ -829,6 +1032,7 @@ void hci_emit_btstack_version(void);
 void hci_emit_system_bluetooth_enabled(uint8_t enabled);
 void hci_emit_remote_name_cached(bd_addr_t addr, device_name_t *name);
 void hci_emit_discoverable_enabled(uint8_t enabled);
+void hci_emit_hci_statistics(hci_con_handle_t con_handle);
 void hci_emit_security_level(hci_con_handle_t con_handle, gap_security_level_t level);
 void hci_emit_dedicated_bonding_result(bd_addr_t address, uint8_t status);
 
@@ -874,6 +1078,15 @@ void hci_close(void);
  * @note New functions replacing: hci_can_send_packet_now[_using_packet_buffer]
  */
 int hci_can_send_command_packet_now(void);
+
+/**
+ * @brief Sets priority of connection for outgoing ACL packets. Fragments of queued packets from all connections
+ * are interleaved, a connection with priority n gets n times the share of a connection with HCI_ACL_PRIORITY_LOW.
+ * @param con_handle
+ * @param priority HCI_ACL_PRIORITY_LOW, HCI_ACL_PRIORITY_DEFAULT, HCI_ACL_PRIORITY_HIGH or custom weight
+ * @returns 0 if ok, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER if connection does not exist
+ */
+int hci_set_acl_priority(hci_con_handle_t con_handle, uint8_t priority);
     
 /**
  * @brief Gets local address.
@@ -895,6 +1108,59 @@ void hci_set_class_of_device(uint32_t class_of_device);
  */
 void hci_set_bd_addr(bd_addr_t addr);
 
+/**
+ * @brief Set controller info db. If the controller reports the same identity and BD ADDR as last time,
+ *        the stored capabilities are used instead of reading them again during Bluetooth init.
+ */
+void hci_set_controller_info_db(controller_info_db_t const * controller_info_db);
+
+/**
+ * @brief Get duration of last Bluetooth init
+ * @returns time from power on until HCI_STATE_WORKING in ms, 0 if init did not complete yet
+ */
+uint32_t hci_get_init_duration_ms(void);
+
+/**
+ * @brief Get duration of chipset init script upload during last Bluetooth init
+ * @returns time from first to last completed init script command in ms, 0 if no init script was used
+ */
+uint32_t hci_get_init_script_duration_ms(void);
+
+/**
+ * @brief Get time the HCI packet currently being processed was received by the HCI transport
+ * @note Valid in all packet handlers called for an incoming event, ACL or SCO packet, including
+ *       L2CAP, RFCOMM, and ATT handlers. For L2CAP PDUs spread over several ACL packets, it is the
+ *       time of the last fragment. Use differences only, the time base is not related to wall-clock time.
+ * @returns monotonic time in us, 0 if not supported by HCI transport
+ */
+uint32_t hci_get_packet_receive_timestamp_us(void);
+
+/**
+ * @brief Get HCI traffic statistics for a connection
+ * @param con_handle
+ * @param statistics
+ * @returns 0 if ok, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER if connection does not exist
+ */
+int hci_get_connection_statistics(hci_con_handle_t con_handle, hci_statistics_t * statistics);
+
+/**
+ * @brief Get HCI traffic statistics summed up over all connections since power on or last reset
+ */
+void hci_get_statistics(hci_statistics_t * statistics);
+
+/**
+ * @brief Reset HCI traffic statistics and ACL latency histograms for all connections
+ */
+void hci_reset_statistics(void);
+
+/**
+ * @brief Get ACL latency histograms for a connection. Requires ENABLE_HCI_ACL_LATENCY_HISTOGRAMS
+ * @param con_handle
+ * @param latency
+ * @returns 0 if ok, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER if connection does not exist
+ */
+int hci_get_acl_latency(hci_con_handle_t con_handle, hci_acl_latency_t * latency);
+
 /**
  * @brief Registers a packet handler. Used if L2CAP is not used (rarely). 
  */
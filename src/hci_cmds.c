@@ -623,6 +623,13 @@ const hci_cmd_t hci_write_synchronous_flow_control_enable = {
 OPCODE(OGF_CONTROLLER_BASEBAND, 0x2f), "1"
 };
 
+/**
+ * @param flow_control_enable - 0: off, 1: ACL only, 2: SCO only, 3: ACL and SCO
+ */
+const hci_cmd_t hci_set_controller_to_host_flow_control = {
+OPCODE(OGF_CONTROLLER_BASEBAND, 0x31), "1"
+};
+
 /**
  * @param host_acl_data_packet_length
  * @param host_synchronous_data_packet_length
@@ -633,6 +640,15 @@ const hci_cmd_t hci_host_buffer_size = {
 OPCODE(OGF_CONTROLLER_BASEBAND, 0x33), "2122"
 };
 
+/**
+ * @param number_of_handles - only 1 supported
+ * @param handle
+ * @param host_num_of_completed_packets
+ */
+const hci_cmd_t hci_host_number_of_completed_packets = {
+OPCODE(OGF_CONTROLLER_BASEBAND, 0x35), "1H2"
+};
+
 /**
  * @param handle
  */
@@ -1058,6 +1074,13 @@ const hci_cmd_t btstack_set_bluetooth_enabled = {
 OPCODE(OGF_BTSTACK, BTSTACK_SET_BLUETOOTH_ENABLED), "1"
 };
 
+/**
+ * @param handle (0xffff for all connections)
+ */
+const hci_cmd_t btstack_get_hci_statistics = {
+OPCODE(OGF_BTSTACK, BTSTACK_GET_HCI_STATISTICS), "H"
+};
+
 /**
  * @param bd_addr (48)
  * @param psm (16)
@@ -66,6 +66,8 @@ typedef struct {
     int    (*set_baudrate)(uint32_t baudrate);
     // support async transport layers, e.g. IRQ driven without buffers
     int    (*can_send_packet_now)(uint8_t packet_type);
+    // monotonic time in us when the packet passed to the packet handler was received, NULL if not supported
+    uint32_t (*get_packet_receive_timestamp_us)(void);
 } hci_transport_t;
 
 typedef struct {
@@ -75,6 +77,17 @@ typedef struct {
     int   flowcontrol; // 
 } hci_uart_config_t;
 
+typedef struct {
+    const char * peer_path;             // UNIX socket shared with the peer controller
+    uint8_t  bd_addr[6];                // public address of the virtual controller
+    uint16_t acl_data_packet_length;    // = 0: use defaults for the buffer model
+    uint16_t acl_packets_total_num;
+    uint16_t le_data_packets_length;
+    uint8_t  le_acl_packets_total_num;
+    uint16_t latency_ms;                // delay until an ACL packet is delivered to the peer
+    uint16_t loss_per_mille;            // probability that an ACL packet needs to be retransmitted
+} hci_transport_virtual_config_t;
+
 
 // inline various hci_transport_X.h files
 
@@ -103,10 +116,18 @@ extern hci_transport_t * hci_transport_h5_instance(void);
  */
 extern hci_transport_t * hci_transport_usb_instance(void);
 
+/*
+ * @brief
+ */
+extern hci_transport_t * hci_transport_virtual_instance(void);
+
 /* API_END */
 
 // support for "enforece wake device" in h4 - used by iOS power management
 extern void hci_transport_h4_iphone_set_enforce_wake_device(char *path);
+
+// number of concurrent USB transfers per incoming endpoint and for outgoing ACL/SCO, call before transport is opened
+extern void hci_transport_usb_set_num_transfers(int in_transfers, int out_transfers);
     
 #if defined __cplusplus
 }
@@ -43,6 +43,7 @@
  *  Created by Matthias Ringwald on 4/29/09.
  */
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -119,6 +120,7 @@ static hci_transport_h4_t hci_transport_h4_dma = {
   /*  .transport.get_transport_name            = */  h4_get_transport_name,
   /*  .transport.set_baudrate                  = */  h4_set_baudrate,
   /*  .transport.can_send_packet_now           = */  h4_can_send_packet_now,
+  /*  .transport.get_packet_receive_timestamp_us = */  NULL,
     },
   /*  .ds                                      = */  &hci_transport_h4_dma_ds
 };
@@ -277,7 +279,7 @@ static int h4_send_packet(uint8_t packet_type, uint8_t *packet, int size){
 }
 
 static int h4_set_baudrate(uint32_t baudrate){
-    log_info("h4_set_baudrate - set baud %lu", baudrate);
+    log_info("h4_set_baudrate - set baud %"PRIu32, baudrate);
     return hal_uart_dma_set_baud(baudrate);
 }
 
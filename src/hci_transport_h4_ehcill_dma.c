@@ -48,6 +48,7 @@
 
 #include "btstack-config.h"
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -162,6 +163,7 @@ static const hci_transport_h4_t hci_transport_h4_ehcill_dma = {
   /*  .transport.get_transport_name            = */  h4_get_transport_name,
   /*  .transport.set_baudrate                  = */  h4_set_baudrate,
   /*  .transport.can_send_packet_now           = */  h4_can_send_packet_now,
+  /*  .transport.get_packet_receive_timestamp_us = */  NULL,
     },
   /*  .ds                                      = */  &hci_transport_h4_dma_ds
 };
@@ -209,7 +211,7 @@ static int h4_open(void *transport_config){
 }
 
 static int h4_set_baudrate(uint32_t baudrate){
-    log_info("h4_set_baudrate - set baud %lu", baudrate);
+    log_info("h4_set_baudrate - set baud %"PRIu32, baudrate);
     return hal_uart_dma_set_baud(baudrate);
 }
 
@@ -334,6 +334,7 @@ static int l2cap_send_signaling_packet(hci_con_handle_t handle, L2CAP_SIGNALING_
 
     if (!hci_can_send_acl_packet_now(handle)){
         log_info("l2cap_send_signaling_packet, cannot send");
+        hci_statistics_count_acl_buffers_full(handle);
         return BTSTACK_ACL_BUFFERS_FULL;
     }
     
@@ -353,6 +354,7 @@ static int l2cap_send_le_signaling_packet(hci_con_handle_t handle, L2CAP_SIGNALI
 
     if (!hci_can_send_acl_packet_now(handle)){
         log_info("l2cap_send_signaling_packet, cannot send");
+        hci_statistics_count_acl_buffers_full(handle);
         return BTSTACK_ACL_BUFFERS_FULL;
     }
     
@@ -401,6 +403,7 @@ int l2cap_send_prepared(uint16_t local_cid, uint16_t len){
 
     if (!hci_can_send_prepared_acl_packet_now(channel->handle)){
         log_info("l2cap_send_prepared cid 0x%02x, cannot send", local_cid);
+        hci_statistics_count_acl_buffers_full(channel->handle);
         return BTSTACK_ACL_BUFFERS_FULL;
     }
     
@@ -438,6 +441,7 @@ int l2cap_send_prepared_connectionless(uint16_t handle, uint16_t cid, uint16_t l
 
     if (!hci_can_send_prepared_acl_packet_now(handle)){
         log_info("l2cap_send_prepared_connectionless handle 0x%02x, cid 0x%02x, cannot send", handle, cid);
+        hci_statistics_count_acl_buffers_full(handle);
         return BTSTACK_ACL_BUFFERS_FULL;
     }
     
@@ -478,6 +482,7 @@ int l2cap_send_internal(uint16_t local_cid, uint8_t *data, uint16_t len){
 
     if (!hci_can_send_acl_packet_now(channel->handle)){
         log_info("l2cap_send_internal cid 0x%02x, cannot send", local_cid);
+        hci_statistics_count_acl_buffers_full(channel->handle);
         return BTSTACK_ACL_BUFFERS_FULL;
     }
 
@@ -493,6 +498,7 @@ int l2cap_send_connectionless(uint16_t handle, uint16_t cid, uint8_t *data, uint
     
     if (!hci_can_send_acl_packet_now(handle)){
         log_info("l2cap_send_internal cid 0x%02x, cannot send", cid);
+        hci_statistics_count_acl_buffers_full(handle);
         return BTSTACK_ACL_BUFFERS_FULL;
     }
     
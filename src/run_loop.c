@@ -44,7 +44,8 @@
 #include <btstack/run_loop.h>
 
 #include <stdio.h>
-#include <stdlib.h>  // exit()
+#include <stdlib.h>  // exit(), realloc()
+#include <string.h>  // memset()
 
 #include "run_loop_private.h"
 
@@ -59,10 +60,72 @@ extern const run_loop_t run_loop_embedded;
 extern run_loop_t run_loop_posix;
 #endif
 
+#ifdef USE_EPOLL_RUN_LOOP
+extern run_loop_t run_loop_epoll;
+#endif
+
 #ifdef USE_COCOA_RUN_LOOP
 extern run_loop_t run_loop_cocoa;
 #endif
 
+#if defined(HAVE_TIME) || defined(HAVE_TICK) || defined(HAVE_TIME_MS)
+#define TIMER_HEAP
+
+// max number of active timers without malloc, can be defined in config.h
+// default: one per hci connection, l2cap channel, rfcomm multiplexer, bnep channel and gatt client
+// plus 16 for stack, transport and application timers
+#if !defined(MAX_NO_RUN_LOOP_TIMERS) && !defined(HAVE_MALLOC)
+#ifdef MAX_NO_HCI_CONNECTIONS
+#define RUN_LOOP_TIMERS_HCI MAX_NO_HCI_CONNECTIONS
+#else
+#define RUN_LOOP_TIMERS_HCI 0
+#endif
+#ifdef MAX_NO_L2CAP_CHANNELS
+#define RUN_LOOP_TIMERS_L2CAP MAX_NO_L2CAP_CHANNELS
+#else
+#define RUN_LOOP_TIMERS_L2CAP 0
+#endif
+#ifdef MAX_NO_RFCOMM_MULTIPLEXERS
+#define RUN_LOOP_TIMERS_RFCOMM MAX_NO_RFCOMM_MULTIPLEXERS
+#else
+#define RUN_LOOP_TIMERS_RFCOMM 0
+#endif
+#ifdef MAX_NO_BNEP_CHANNELS
+#define RUN_LOOP_TIMERS_BNEP MAX_NO_BNEP_CHANNELS
+#else
+#define RUN_LOOP_TIMERS_BNEP 0
+#endif
+#ifdef MAX_NO_GATT_CLIENTS
+#define RUN_LOOP_TIMERS_GATT MAX_NO_GATT_CLIENTS
+#else
+#define RUN_LOOP_TIMERS_GATT 0
+#endif
+#define MAX_NO_RUN_LOOP_TIMERS (RUN_LOOP_TIMERS_HCI + RUN_LOOP_TIMERS_L2CAP + RUN_LOOP_TIMERS_RFCOMM + RUN_LOOP_TIMERS_BNEP + RUN_LOOP_TIMERS_GATT + 16)
+#endif
+
+// binary min-heap of active timers, each timer knows its position to allow O(log n) removal
+#ifdef MAX_NO_RUN_LOOP_TIMERS
+static timer_source_t * timer_heap[MAX_NO_RUN_LOOP_TIMERS];
+#else
+static timer_source_t ** timer_heap;
+static int timer_heap_capacity;
+#endif
+static int timer_heap_count;
+static uint32_t timer_heap_seq;
+static int (*timer_heap_compare)(timer_source_t *a, timer_source_t *b);
+#endif
+
+#ifdef ENABLE_RUN_LOOP_PROFILING
+// number of different data source and timer handlers that are profiled, can be defined in config.h
+#ifndef RUN_LOOP_PROFILING_MAX_HANDLERS
+#define RUN_LOOP_PROFILING_MAX_HANDLERS 32
+#endif
+
+static run_loop_handler_profile_t run_loop_profiles[RUN_LOOP_PROFILING_MAX_HANDLERS];
+static int      run_loop_profiles_count;
+static uint32_t run_loop_slow_handler_threshold_us = 10000;
+#endif
+
 // assert run loop initialized
 static void run_loop_assert(void){
 #ifndef EMBEDDED
@@ -86,9 +149,10 @@ void run_loop_set_data_source_handler(data_source_t *ds, int (*process)(data_sou
 /**
  * Add data_source to run_loop
  */
-void run_loop_add_data_source(data_source_t *ds){
+int run_loop_add_data_source(data_source_t *ds){
     run_loop_assert();
-    the_run_loop->add_data_source(ds);
+    ds->write_enabled = 0;
+    return the_run_loop->add_data_source(ds);
 }
 
 /**
@@ -99,6 +163,14 @@ int run_loop_remove_data_source(data_source_t *ds){
     return the_run_loop->remove_data_source(ds);
 }
 
+/**
+ * Enable/Disable write callback for data_source
+ */
+void run_loop_enable_data_source_write(data_source_t *ds, int enabled){
+    run_loop_assert();
+    the_run_loop->enable_data_source_write(ds, enabled);
+}
+
 void run_loop_set_timer(timer_source_t *a, uint32_t timeout_in_ms){
     run_loop_assert();
     the_run_loop->set_timer(a, timeout_in_ms);
@@ -107,9 +179,9 @@ void run_loop_set_timer(timer_source_t *a, uint32_t timeout_in_ms){
 /**
  * Add timer to run_loop (keep list sorted)
  */
-void run_loop_add_timer(timer_source_t *ts){
+int run_loop_add_timer(timer_source_t *ts){
     run_loop_assert();
-    the_run_loop->add_timer(ts);
+    return the_run_loop->add_timer(ts);
 }
 
 /**
@@ -129,6 +201,194 @@ uint32_t run_loop_get_time_ms(void){
 }
 
 
+#ifdef TIMER_HEAP
+
+static void run_loop_timer_heap_set(int index, timer_source_t *ts){
+    timer_heap[index] = ts;
+    ts->heap_index = index;
+}
+
+// timers with same timeout are ordered by insertion, seq comparison handles wrap-around
+static int run_loop_timer_heap_less(timer_source_t *a, timer_source_t *b){
+    int res = timer_heap_compare(a, b);
+    if (res) return res < 0;
+    return (int32_t) (a->heap_seq - b->heap_seq) < 0;
+}
+
+static void run_loop_timer_heap_sift_up(int index){
+    timer_source_t *ts = timer_heap[index];
+    while (index > 0){
+        int parent = (index - 1) / 2;
+        if (!run_loop_timer_heap_less(ts, timer_heap[parent])) break;
+        run_loop_timer_heap_set(index, timer_heap[parent]);
+        index = parent;
+    }
+    run_loop_timer_heap_set(index, ts);
+}
+
+static void run_loop_timer_heap_sift_down(int index){
+    timer_source_t *ts = timer_heap[index];
+    while (1){
+        int child = 2 * index + 1;
+        if (child >= timer_heap_count) break;
+        if (child + 1 < timer_heap_count && run_loop_timer_heap_less(timer_heap[child + 1], timer_heap[child])){
+            child++;
+        }
+        if (!run_loop_timer_heap_less(timer_heap[child], ts)) break;
+        run_loop_timer_heap_set(index, timer_heap[child]);
+        index = child;
+    }
+    run_loop_timer_heap_set(index, ts);
+}
+
+// heap_index is not initialized for timers that have never been added
+static int run_loop_timer_heap_contains(timer_source_t *ts){
+    return ts->heap_index >= 0 && ts->heap_index < timer_heap_count && timer_heap[ts->heap_index] == ts;
+}
+
+void run_loop_timer_heap_init(int (*compare)(timer_source_t *a, timer_source_t *b)){
+    timer_heap_compare = compare;
+    timer_heap_count = 0;
+}
+
+int run_loop_timer_heap_add(timer_source_t *ts){
+    if (run_loop_timer_heap_contains(ts)){
+        log_error( "run_loop_timer_add error: timer to add already in list!");
+        return -1;
+    }
+#ifdef MAX_NO_RUN_LOOP_TIMERS
+    if (timer_heap_count == MAX_NO_RUN_LOOP_TIMERS){
+        log_error("run_loop_timer_add error: more than MAX_NO_RUN_LOOP_TIMERS active timers");
+        return -1;
+    }
+#else
+    if (timer_heap_count == timer_heap_capacity){
+        int capacity = timer_heap_capacity ? 2 * timer_heap_capacity : 16;
+        timer_source_t ** heap = (timer_source_t **) realloc(timer_heap, capacity * sizeof(timer_source_t *));
+        if (!heap){
+            log_error("run_loop_timer_add error: cannot grow timer heap");
+            return -1;
+        }
+        timer_heap = heap;
+        timer_heap_capacity = capacity;
+    }
+#endif
+    ts->heap_seq = timer_heap_seq++;
+    timer_heap[timer_heap_count] = ts;
+    timer_heap_count++;
+    run_loop_timer_heap_sift_up(timer_heap_count - 1);
+    return 0;
+}
+
+int run_loop_timer_heap_remove(timer_source_t *ts){
+    if (!run_loop_timer_heap_contains(ts)) return -1;
+    int index = ts->heap_index;
+    ts->heap_index = -1;
+    timer_heap_count--;
+    if (index == timer_heap_count) return 0;
+    // move last timer into the gap and restore heap order
+    run_loop_timer_heap_set(index, timer_heap[timer_heap_count]);
+    if (index > 0 && run_loop_timer_heap_less(timer_heap[index], timer_heap[(index - 1) / 2])){
+        run_loop_timer_heap_sift_up(index);
+    } else {
+        run_loop_timer_heap_sift_down(index);
+    }
+    return 0;
+}
+
+timer_source_t * run_loop_timer_heap_first(void){
+    if (!timer_heap_count) return NULL;
+    return timer_heap[0];
+}
+
+int run_loop_timer_heap_size(void){
+    return timer_heap_count;
+}
+
+timer_source_t * run_loop_timer_heap_get(int index){
+    return timer_heap[index];
+}
+
+#endif
+
+#ifdef ENABLE_RUN_LOOP_PROFILING
+
+static void run_loop_histogram_add(run_loop_histogram_t * histogram, uint32_t value_us){
+    int bucket = 0;
+    while ((value_us >> bucket) && bucket < RUN_LOOP_PROFILING_HISTOGRAM_BUCKETS - 1){
+        bucket++;
+    }
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->sum_us += value_us;
+    if (value_us > histogram->max_us){
+        histogram->max_us = value_us;
+    }
+}
+
+static void run_loop_histogram_dump(const char * name, run_loop_histogram_t * histogram){
+    if (!histogram->count) return;
+    log_info("  %s: count %u, avg %u us, max %u us", name, (unsigned int) histogram->count,
+        (unsigned int) (histogram->sum_us / histogram->count), (unsigned int) histogram->max_us);
+    int i;
+    for (i = 0; i < RUN_LOOP_PROFILING_HISTOGRAM_BUCKETS; i++){
+        if (!histogram->buckets[i]) continue;
+        log_info("    < %7lu us: %u", 1UL << i, (unsigned int) histogram->buckets[i]);
+    }
+}
+
+void run_loop_profiling_handler_executed(void (*handler)(void), int is_timer, uint32_t execution_us, uint32_t lateness_us){
+    run_loop_handler_profile_t * profile = NULL;
+    int i;
+    for (i = 0; i < run_loop_profiles_count; i++){
+        if (run_loop_profiles[i].handler == handler && run_loop_profiles[i].is_timer == is_timer){
+            profile = &run_loop_profiles[i];
+            break;
+        }
+    }
+    if (!profile){
+        if (run_loop_profiles_count == RUN_LOOP_PROFILING_MAX_HANDLERS) return;
+        profile = &run_loop_profiles[run_loop_profiles_count++];
+        memset(profile, 0, sizeof(run_loop_handler_profile_t));
+        profile->handler  = handler;
+        profile->is_timer = is_timer;
+    }
+    run_loop_histogram_add(&profile->execution, execution_us);
+    if (is_timer){
+        run_loop_histogram_add(&profile->lateness, lateness_us);
+    }
+    if (execution_us >= run_loop_slow_handler_threshold_us){
+        profile->slow_count++;
+        log_error("run_loop: %s handler %p took %u us", is_timer ? "timer" : "data source", (void *) handler, (unsigned int) execution_us);
+    }
+}
+
+void run_loop_profiling_set_slow_handler_threshold_us(uint32_t threshold_us){
+    run_loop_slow_handler_threshold_us = threshold_us;
+}
+
+int run_loop_profiling_get_handler_profiles(const run_loop_handler_profile_t ** profiles){
+    *profiles = run_loop_profiles;
+    return run_loop_profiles_count;
+}
+
+void run_loop_profiling_reset(void){
+    run_loop_profiles_count = 0;
+}
+
+void run_loop_profiling_dump(void){
+    int i;
+    for (i = 0; i < run_loop_profiles_count; i++){
+        run_loop_handler_profile_t * profile = &run_loop_profiles[i];
+        log_info("%s handler %p, slow %u", profile->is_timer ? "timer" : "data source", (void *) profile->handler,
+            (unsigned int) profile->slow_count);
+        run_loop_histogram_dump("execution", &profile->execution);
+        run_loop_histogram_dump("lateness", &profile->lateness);
+    }
+}
+
+#endif
+
 void run_loop_timer_dump(void){
     run_loop_assert();
     the_run_loop->dump_timer();
@@ -142,6 +402,18 @@ void run_loop_execute(void){
     the_run_loop->execute();
 }
 
+/**
+ * Execute callback on run loop thread
+ */
+void run_loop_execute_on_main_thread(run_loop_callback_t *callback_registration){
+    run_loop_assert();
+    if (!the_run_loop->execute_on_main_thread){
+        log_error("ERROR: run_loop_execute_on_main_thread not supported by run loop!");
+        return;
+    }
+    the_run_loop->execute_on_main_thread(callback_registration);
+}
+
 // init must be called before any other run_loop call
 void run_loop_init(RUN_LOOP_TYPE type){
 #ifndef EMBEDDED
@@ -161,6 +433,11 @@ void run_loop_init(RUN_LOOP_TYPE type){
             the_run_loop = &run_loop_posix;
             break;
 #endif
+#ifdef USE_EPOLL_RUN_LOOP
+        case RUN_LOOP_EPOLL:
+            the_run_loop = &run_loop_epoll;
+            break;
+#endif
 #ifdef USE_COCOA_RUN_LOOP
         case RUN_LOOP_COCOA:
             the_run_loop = &run_loop_cocoa;
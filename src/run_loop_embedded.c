@@ -78,21 +78,25 @@
 // the run loop
 static linked_list_t data_sources;
 
-#ifdef TIMER_SUPPORT
-static linked_list_t timers;
-#endif
-
 #ifdef HAVE_TICK
 static volatile uint32_t system_ticks;
 #endif
 
 static int trigger_event_received = 0;
 
+#ifdef ENABLE_RUN_LOOP_PROFILING
+static uint32_t embedded_get_time_ms(void);
+#endif
+
+// callbacks added by interrupt handlers, most recent first
+static run_loop_callback_t * volatile callbacks;
+
 /**
  * Add data_source to run_loop
  */
-static void embedded_add_data_source(data_source_t *ds){
+static int embedded_add_data_source(data_source_t *ds){
     linked_list_add(&data_sources, (linked_item_t *) ds);
+    return 0;
 }
 
 /**
@@ -102,6 +106,13 @@ static int embedded_remove_data_source(data_source_t *ds){
     return linked_list_remove(&data_sources, (linked_item_t *) ds);
 }
 
+/**
+ * Enable/Disable write callback - data sources are polled on every iteration anyway
+ */
+static void embedded_enable_data_source_write(data_source_t *ds, int enabled){
+    ds->write_enabled = enabled;
+}
+
 // set timer
 static void embedded_set_timer(timer_source_t *ts, uint32_t timeout_in_ms){
 #ifdef HAVE_TICK
@@ -115,24 +126,22 @@ static void embedded_set_timer(timer_source_t *ts, uint32_t timeout_in_ms){
 #endif
 }
 
+#ifdef TIMER_SUPPORT
+static int embedded_timer_compare(timer_source_t *a, timer_source_t *b){
+    if (a->timeout < b->timeout) return -1;
+    if (a->timeout > b->timeout) return 1;
+    return 0;
+}
+#endif
+
 /**
- * Add timer to run_loop (keep list sorted)
+ * Add timer to run_loop (keep heap ordered)
  */
-static void embedded_add_timer(timer_source_t *ts){
+static int embedded_add_timer(timer_source_t *ts){
 #ifdef TIMER_SUPPORT
-    linked_item_t *it;
-    for (it = (linked_item_t *) &timers; it->next ; it = it->next){
-        // don't add timer that's already in there
-        if ((timer_source_t *) it->next == ts){
-            log_error( "run_loop_timer_add error: timer to add already in list!");
-            return;
-        }
-        if (ts->timeout < ((timer_source_t *) it->next)->timeout) {
-            break;
-        }
-    }
-    ts->item.next = it->next;
-    it->next = (linked_item_t *) ts;
+    return run_loop_timer_heap_add(ts);
+#else
+    return 0;
 #endif
 }
 
@@ -141,7 +150,7 @@ static void embedded_add_timer(timer_source_t *ts){
  */
 static int embedded_remove_timer(timer_source_t *ts){
 #ifdef TIMER_SUPPORT
-    return linked_list_remove(&timers, (linked_item_t *) ts);
+    return run_loop_timer_heap_remove(ts);
 #else
     return 0;
 #endif
@@ -150,27 +159,101 @@ static int embedded_remove_timer(timer_source_t *ts){
 static void embedded_dump_timer(void){
 #ifdef TIMER_SUPPORT
 #ifdef ENABLE_LOG_INFO 
-    linked_item_t *it;
-    int i = 0;
-    for (it = (linked_item_t *) timers; it ; it = it->next){
-        timer_source_t *ts = (timer_source_t*) it;
+    int i;
+    for (i = 0; i < run_loop_timer_heap_size(); i++){
+        timer_source_t *ts = run_loop_timer_heap_get(i);
         log_info("timer %u, timeout %u\n", i, (unsigned int) ts->timeout);
     }
 #endif
 #endif
 }
 
+/**
+ * Execute callback on main thread, can be called from interrupt handlers that don't interrupt each other
+ */
+static void embedded_execute_on_main_thread(run_loop_callback_t * callback_registration){
+    callback_registration->next = callbacks;
+    callbacks = callback_registration;
+    trigger_event_received = 1;
+}
+
+static void embedded_process_callbacks(void){
+    if (!callbacks) return;
+
+    // take all callbacks at once
+    hal_cpu_disable_irqs();
+    run_loop_callback_t * list = callbacks;
+    callbacks = NULL;
+    hal_cpu_enable_irqs();
+
+    // restore order
+    run_loop_callback_t * ordered = NULL;
+    while (list){
+        run_loop_callback_t * next = list->next;
+        list->next = ordered;
+        ordered = list;
+        list = next;
+    }
+
+    while (ordered){
+        run_loop_callback_t * callback_registration = ordered;
+        ordered = ordered->next;
+        callback_registration->callback(callback_registration->context);
+    }
+}
+
+/**
+ * Call data source handler, execution time is measured with resolution of system ticks or ms
+ */
+static void embedded_process_data_source(data_source_t *ds){
+#ifdef ENABLE_RUN_LOOP_PROFILING
+    // handler might re-use data source
+    int (*process)(data_source_t *ds) = ds->process;
+    uint32_t start_ms = embedded_get_time_ms();
+    process(ds);
+    run_loop_profiling_handler_executed((void (*)(void)) process, 0, (embedded_get_time_ms() - start_ms) * 1000, 0);
+#else
+    ds->process(ds);
+#endif
+}
+
+#ifdef TIMER_SUPPORT
+/**
+ * Call timer handler
+ */
+static void embedded_process_timer(timer_source_t *ts){
+#ifdef ENABLE_RUN_LOOP_PROFILING
+    // handler might re-use timer
+    void (*process)(timer_source_t *ts) = ts->process;
+#ifdef HAVE_TICK
+    uint32_t timeout_ms = ts->timeout * hal_tick_get_tick_period_in_ms();
+#endif
+#ifdef HAVE_TIME_MS
+    uint32_t timeout_ms = ts->timeout;
+#endif
+    uint32_t start_ms = embedded_get_time_ms();
+    process(ts);
+    run_loop_profiling_handler_executed((void (*)(void)) process, 1, (embedded_get_time_ms() - start_ms) * 1000, (start_ms - timeout_ms) * 1000);
+#else
+    ts->process(ts);
+#endif
+}
+#endif
+
 /**
  * Execute run_loop once
  */
 void embedded_execute_once(void) {
     data_source_t *ds;
 
+    // process callbacks from interrupt handlers
+    embedded_process_callbacks();
+
     // process data sources
     data_source_t *next;
     for (ds = (data_source_t *) data_sources; ds != NULL ; ds = next){
         next = (data_source_t *) ds->item.next; // cache pointer to next data_source to allow data source to remove itself
-        ds->process(ds);
+        embedded_process_data_source(ds);
     }
     
 #ifdef HAVE_TICK
@@ -181,11 +264,11 @@ void embedded_execute_once(void) {
 #endif
 #ifdef TIMER_SUPPORT
     // process timers
-    while (timers) {
-        timer_source_t *ts = (timer_source_t *) timers;
+    timer_source_t *ts;
+    while ((ts = run_loop_timer_heap_first()) != NULL) {
         if (ts->timeout > now) break;
         run_loop_remove_timer(ts);
-        ts->process(ts);
+        embedded_process_timer(ts);
     }
 #endif
     
@@ -248,9 +331,10 @@ void embedded_trigger(void){
 static void embedded_init(void){
 
     data_sources = NULL;
+    callbacks = NULL;
 
 #ifdef TIMER_SUPPORT
-    timers = NULL;
+    run_loop_timer_heap_init(&embedded_timer_compare);
 #endif
 
 #ifdef HAVE_TICK
@@ -270,4 +354,6 @@ const run_loop_t run_loop_embedded = {
     &embedded_execute,
     &embedded_dump_timer,
     &embedded_get_time_ms,
+    &embedded_enable_data_source_write,
+    &embedded_execute_on_main_thread,
 };
@@ -57,17 +57,33 @@ extern "C" {
 // 
 void run_loop_timer_dump(void);
 
+#ifdef ENABLE_RUN_LOOP_PROFILING
+// called by run loop implementations after a data source or timer was processed
+void run_loop_profiling_handler_executed(void (*handler)(void), int is_timer, uint32_t execution_us, uint32_t lateness_us);
+#endif
+
+// timer heap used by run loop implementations, compare returns < 0 if timer a expires before b
+void             run_loop_timer_heap_init(int (*compare)(timer_source_t *a, timer_source_t *b));
+int              run_loop_timer_heap_add(timer_source_t *ts);
+int              run_loop_timer_heap_remove(timer_source_t *ts);
+timer_source_t * run_loop_timer_heap_first(void);
+// timers in heap order, for debugging
+int              run_loop_timer_heap_size(void);
+timer_source_t * run_loop_timer_heap_get(int index);
+
 // internal use only
 typedef struct {
 	void (*init)(void);
-	void (*add_data_source)(data_source_t *dataSource);
+	int  (*add_data_source)(data_source_t *dataSource);
 	int  (*remove_data_source)(data_source_t *dataSource);
 	void (*set_timer)(timer_source_t * timer, uint32_t timeout_in_ms);
-	void (*add_timer)(timer_source_t *timer);
+	int  (*add_timer)(timer_source_t *timer);
 	int  (*remove_timer)(timer_source_t *timer); 
 	void (*execute)(void);
 	void (*dump_timer)(void);
 	uint32_t (*get_time_ms)(void);
+	void (*enable_data_source_write)(data_source_t *dataSource, int enabled);
+	void (*execute_on_main_thread)(run_loop_callback_t *callback_registration);
 } run_loop_t;
 
 #if defined __cplusplus
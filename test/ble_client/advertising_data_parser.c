@@ -108,6 +108,7 @@ static hci_transport_t dummy_transport = {
   /*  .transport.get_transport_name            = */  NULL,
   /*  .transport.set_baudrate                  = */  NULL,
   /*  .transport.can_send_packet_now           = */  NULL,
+  /*  .transport.get_packet_receive_timestamp_us = */  NULL,
 };
 
 
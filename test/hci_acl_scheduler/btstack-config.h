@@ -0,0 +1,20 @@
+// config for hci acl scheduler test with two connections and a pool of outgoing packet buffers
+
+#define HAVE_TIME
+#define HAVE_BLE
+#define HAVE_MALLOC
+
+#define ENABLE_LOG_INFO 
+#define ENABLE_LOG_ERROR
+#define HAVE_HCI_DUMP
+
+#define USE_POSIX_RUN_LOOP
+
+#define HCI_ACL_PAYLOAD_SIZE 52
+#define HCI_OUTGOING_ACL_BUFFERS 24
+
+#define MAX_NO_HCI_CONNECTIONS 2
+
+// fewer tracked fragments than controller buffers
+#define ENABLE_HCI_ACL_LATENCY_HISTOGRAMS
+#define HCI_ACL_LATENCY_FIFO_SIZE 2
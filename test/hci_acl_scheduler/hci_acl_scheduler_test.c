@@ -0,0 +1,243 @@
+// *****************************************************************************
+//
+// hci acl scheduler tests
+//
+// *****************************************************************************
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <btstack/run_loop.h>
+#include <btstack/utils.h>
+#include "hci.h"
+#include "hci_transport.h"
+#include "btstack_memory.h"
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#define CONTROLLER_ACL_PACKET_LENGTH 20
+
+static const hci_con_handle_t handle_a = 0x0001;
+static const hci_con_handle_t handle_b = 0x0002;
+
+static void (*hci_packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
+
+// con handles and sizes of ACL fragments sent to the controller
+static hci_con_handle_t fragments_handle[100];
+static int              fragments_size[100];
+static int              fragments_count;
+
+static void dummy_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    hci_packet_handler = handler;
+}
+
+static int dummy_send_packet(uint8_t packet_type, uint8_t *packet, int size){
+    if (packet_type != HCI_ACL_DATA_PACKET) return 0;
+    fragments_handle[fragments_count] = READ_ACL_CONNECTION_HANDLE(packet);
+    fragments_size[fragments_count]   = READ_ACL_LENGTH(packet);
+    fragments_count++;
+    return 0;
+}
+
+static hci_transport_t dummy_transport = {
+    NULL,
+    NULL,
+    &dummy_send_packet,
+    &dummy_register_packet_handler,
+    NULL,
+    NULL,
+    NULL,   // synchronous transport
+    NULL,
+};
+
+static void controller_read_buffer_size(uint16_t acl_packets_total_num){
+    uint8_t event[] = { HCI_EVENT_COMMAND_COMPLETE, 11, 1, 0x05, 0x10, 0,
+        CONTROLLER_ACL_PACKET_LENGTH, 0, 64, (uint8_t) acl_packets_total_num, 0, 1, 0 };
+    hci_packet_handler(HCI_EVENT_PACKET, event, sizeof(event));
+}
+
+static void controller_connect(hci_con_handle_t handle){
+    bd_addr_t addr = { 0x11, 0x22, 0x33, 0x44, 0x55, (uint8_t) handle };
+    uint8_t request[12] = { HCI_EVENT_CONNECTION_REQUEST, 10 };
+    bt_flip_addr(&request[2], addr);
+    request[11] = 1;    // ACL
+    hci_packet_handler(HCI_EVENT_PACKET, request, sizeof(request));
+    uint8_t complete[13] = { HCI_EVENT_CONNECTION_COMPLETE, 11, 0 };
+    bt_store_16(complete, 3, handle);
+    bt_flip_addr(&complete[5], addr);
+    complete[11] = 1;   // ACL
+    hci_packet_handler(HCI_EVENT_PACKET, complete, sizeof(complete));
+}
+
+static void controller_packets_completed(hci_con_handle_t handle, uint16_t num_packets){
+    uint8_t event[] = { HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS, 5, 1, 0, 0, 0, 0 };
+    bt_store_16(event, 3, handle);
+    bt_store_16(event, 5, num_packets);
+    hci_packet_handler(HCI_EVENT_PACKET, event, sizeof(event));
+}
+
+static void send_l2cap_packet(hci_con_handle_t handle, uint16_t len){
+    CHECK(hci_reserve_packet_buffer());
+    uint8_t * buffer = hci_get_outgoing_packet_buffer();
+    bt_store_16(buffer, 0, handle | (2 << 12));     // first automatically flushable packet
+    bt_store_16(buffer, 2, len);
+    memset(&buffer[4], 0, len);
+    hci_send_acl_packet_buffer(4 + len);
+}
+
+static int fragments_for_handle(int start, int end, hci_con_handle_t handle){
+    int count = 0;
+    int i;
+    for (i = start; i < end; i++){
+        if (fragments_handle[i] == handle) count++;
+    }
+    return count;
+}
+
+TEST_GROUP(HCIACLScheduler){
+    void setup(void){
+        fragments_count = 0;
+        hci_init(&dummy_transport, NULL, NULL, NULL);
+        controller_read_buffer_size(4);
+        controller_connect(handle_a);
+        controller_connect(handle_b);
+    }
+    void teardown(void){
+        hci_close();
+    }
+};
+
+TEST(HCIACLScheduler, SendsImmediatelyWithFreeControllerBuffers){
+    send_l2cap_packet(handle_a, CONTROLLER_ACL_PACKET_LENGTH);
+    CHECK_EQUAL(1, fragments_count);
+    CHECK_EQUAL(handle_a, fragments_handle[0]);
+    CHECK_EQUAL(CONTROLLER_ACL_PACKET_LENGTH, fragments_size[0]);
+}
+
+TEST(HCIACLScheduler, FragmentsOfEqualPriorityConnectionsAlternate){
+    // fill controller buffers
+    int i;
+    for (i = 0; i < 4; i++){
+        send_l2cap_packet(handle_a, CONTROLLER_ACL_PACKET_LENGTH);
+    }
+    CHECK_EQUAL(4, fragments_count);
+
+    // queue two packets of two fragments each on both connections
+    for (i = 0; i < 2; i++){
+        send_l2cap_packet(handle_a, 2 * CONTROLLER_ACL_PACKET_LENGTH);
+        send_l2cap_packet(handle_b, 2 * CONTROLLER_ACL_PACKET_LENGTH);
+    }
+    CHECK_EQUAL(4, fragments_count);
+
+    // controller frees one buffer at a time
+    for (i = 0; i < 8; i++){
+        controller_packets_completed(fragments_handle[i], 1);
+        CHECK_EQUAL(5 + i, fragments_count);
+    }
+    // last scheduled connection was a, so b starts
+    for (i = 4; i < 12; i++){
+        CHECK_EQUAL(i & 1 ? handle_a : handle_b, fragments_handle[i]);
+    }
+}
+
+TEST(HCIACLScheduler, FreedBuffersAreSharedEqually){
+    int i;
+    for (i = 0; i < 4; i++){
+        send_l2cap_packet(handle_a, CONTROLLER_ACL_PACKET_LENGTH);
+    }
+    for (i = 0; i < 4; i++){
+        send_l2cap_packet(handle_a, CONTROLLER_ACL_PACKET_LENGTH);
+        send_l2cap_packet(handle_b, CONTROLLER_ACL_PACKET_LENGTH);
+    }
+    controller_packets_completed(handle_a, 4);
+    CHECK_EQUAL(8, fragments_count);
+    CHECK_EQUAL(2, fragments_for_handle(4, 8, handle_a));
+    CHECK_EQUAL(2, fragments_for_handle(4, 8, handle_b));
+}
+
+TEST(HCIACLScheduler, PriorityWeightsShareOfFreedBuffers){
+    hci_close();
+    fragments_count = 0;
+    hci_init(&dummy_transport, NULL, NULL, NULL);
+    controller_read_buffer_size(9);
+    controller_connect(handle_a);
+    controller_connect(handle_b);
+    CHECK_EQUAL(0, hci_set_acl_priority(handle_a, HCI_ACL_PRIORITY_HIGH));
+    CHECK_EQUAL(0, hci_set_acl_priority(handle_b, HCI_ACL_PRIORITY_LOW));
+
+    int i;
+    for (i = 0; i < 9; i++){
+        send_l2cap_packet(handle_a, CONTROLLER_ACL_PACKET_LENGTH);
+    }
+    for (i = 0; i < 9; i++){
+        send_l2cap_packet(handle_a, CONTROLLER_ACL_PACKET_LENGTH);
+    }
+    for (i = 0; i < 5; i++){
+        send_l2cap_packet(handle_b, CONTROLLER_ACL_PACKET_LENGTH);
+    }
+    CHECK_EQUAL(9, fragments_count);
+
+    // a gets HCI_ACL_PRIORITY_HIGH times the share of b
+    controller_packets_completed(handle_a, 9);
+    CHECK_EQUAL(18, fragments_count);
+    CHECK_EQUAL(HCI_ACL_PRIORITY_HIGH, fragments_for_handle(9, 18, handle_a));
+    CHECK_EQUAL(HCI_ACL_PRIORITY_LOW,  fragments_for_handle(9, 18, handle_b));
+}
+
+TEST(HCIACLScheduler, BulkSenderLeavesBufferForOtherConnections){
+    // send on a as long as possible, more than fits into the pool
+    int sent = 0;
+    while (sent < 100 && hci_can_send_acl_packet_now(handle_a)){
+        send_l2cap_packet(handle_a, CONTROLLER_ACL_PACKET_LENGTH);
+        sent++;
+    }
+    // 4 sent to controller, all but one pool buffer queued
+    CHECK_EQUAL(4 + HCI_OUTGOING_ACL_BUFFERS - 1, sent);
+    CHECK_EQUAL(4, fragments_count);
+
+    // b can still send and is served with the next free controller buffer
+    CHECK(hci_can_send_acl_packet_now(handle_b));
+    send_l2cap_packet(handle_b, CONTROLLER_ACL_PACKET_LENGTH);
+    CHECK(!hci_can_send_acl_packet_now(handle_b));
+    controller_packets_completed(handle_a, 1);
+    CHECK_EQUAL(5, fragments_count);
+    CHECK_EQUAL(handle_b, fragments_handle[4]);
+
+    // freed buffer is again only available to b
+    CHECK(hci_can_send_acl_packet_now(handle_b));
+    CHECK(!hci_can_send_acl_packet_now(handle_a));
+}
+
+TEST(HCIACLScheduler, LatencyTrackingResumesUnderSustainedLoad){
+    // controller holds 4 fragments, only 2 are tracked
+    int i;
+    for (i = 0; i < 4; i++){
+        send_l2cap_packet(handle_a, CONTROLLER_ACL_PACKET_LENGTH);
+    }
+    // keep controller buffers full
+    for (i = 0; i < 20; i++){
+        controller_packets_completed(handle_a, 1);
+        send_l2cap_packet(handle_a, CONTROLLER_ACL_PACKET_LENGTH);
+    }
+    controller_packets_completed(handle_a, 4);
+    CHECK_EQUAL(24, fragments_count);
+
+    hci_acl_latency_t latency;
+    CHECK_EQUAL(0, hci_get_acl_latency(handle_a, &latency));
+    CHECK(latency.fragment_completion.count > 2);
+    CHECK(latency.fragment_completion.count < 24);
+    CHECK_EQUAL(latency.fragment_completion.count, latency.packet_completion.count);
+}
+
+TEST(HCIACLScheduler, UnknownConnectionForPriority){
+    CHECK_EQUAL(ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER, hci_set_acl_priority(0x0003, HCI_ACL_PRIORITY_HIGH));
+}
+
+int main (int argc, const char * argv[]){
+    btstack_memory_init();
+    run_loop_init(RUN_LOOP_POSIX);
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
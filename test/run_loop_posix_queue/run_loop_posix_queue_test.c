@@ -0,0 +1,205 @@
+// *****************************************************************************
+//
+// run loop posix queue tests
+//
+// *****************************************************************************
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <btstack/run_loop.h>
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#define NUM_PRODUCERS           4
+#define ITEMS_PER_PRODUCER  10000
+
+typedef struct {
+    run_loop_posix_queue_item_t item;   // <-- must be first
+    int producer;
+    int value;
+} test_item_t;
+
+static run_loop_posix_queue_t queue;
+static int queue_open;
+
+static int processed_values[100];
+static int processed_count;
+
+static void test_process(run_loop_posix_queue_t * q, run_loop_posix_queue_item_t * item){
+    test_item_t * test_item = (test_item_t *) item;
+    processed_values[processed_count++] = test_item->value;
+}
+
+static int wakeup_fd_readable(void){
+    struct pollfd pfd = { queue.ds.fd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+// drains wakeup fd and returns number of writes by producers
+static int wakeup_writes(void){
+#ifdef __linux__
+    uint64_t value = 0;
+    if (read(queue.ds.fd, &value, sizeof(value)) != sizeof(value)) return 0;
+    return (int) value;
+#else
+    uint8_t buffer[16];
+    int res = read(queue.ds.fd, buffer, sizeof(buffer));
+    return res < 0 ? 0 : res;
+#endif
+}
+
+// what the run loop does when the wakeup fd becomes readable
+static void run_loop_process_queue(void){
+    queue.ds.process(&queue.ds);
+}
+
+TEST_GROUP(RunLoopPosixQueue){
+    test_item_t items[10];
+    void setup(void){
+        int i;
+        for (i = 0; i < 10; i++){
+            items[i].value = i;
+        }
+        processed_count = 0;
+        CHECK_EQUAL(0, run_loop_posix_queue_open(&queue, &test_process));
+        queue_open = 1;
+    }
+    void teardown(void){
+        if (queue_open){
+            run_loop_posix_queue_close(&queue);
+        }
+    }
+};
+
+TEST(RunLoopPosixQueue, EmptyQueueDoesNotWakeUp){
+    CHECK(!wakeup_fd_readable());
+    run_loop_process_queue();
+    CHECK_EQUAL(0, processed_count);
+}
+
+TEST(RunLoopPosixQueue, ItemsProcessedInOrder){
+    int i;
+    for (i = 0; i < 10; i++){
+        run_loop_posix_queue_add(&queue, &items[i].item);
+    }
+    CHECK_EQUAL(0, processed_count);
+    run_loop_process_queue();
+    CHECK_EQUAL(10, processed_count);
+    for (i = 0; i < 10; i++){
+        CHECK_EQUAL(i, processed_values[i]);
+    }
+    CHECK(!wakeup_fd_readable());
+}
+
+TEST(RunLoopPosixQueue, ItemCanBeAddedAgainAfterProcessing){
+    run_loop_posix_queue_add(&queue, &items[0].item);
+    run_loop_process_queue();
+    run_loop_posix_queue_add(&queue, &items[0].item);
+    run_loop_posix_queue_add(&queue, &items[1].item);
+    run_loop_process_queue();
+    CHECK_EQUAL(3, processed_count);
+    CHECK_EQUAL(0, processed_values[0]);
+    CHECK_EQUAL(0, processed_values[1]);
+    CHECK_EQUAL(1, processed_values[2]);
+}
+
+TEST(RunLoopPosixQueue, WakeupsCoalesceUntilRunLoopTakesItems){
+    int i;
+    for (i = 0; i < 5; i++){
+        run_loop_posix_queue_add(&queue, &items[i].item);
+    }
+    CHECK_EQUAL(1, queue.wakeup_pending);
+    CHECK_EQUAL(1, wakeup_writes());
+
+    run_loop_process_queue();
+    CHECK_EQUAL(0, queue.wakeup_pending);
+    CHECK_EQUAL(5, processed_count);
+
+    // first item after run loop took items signals again
+    run_loop_posix_queue_add(&queue, &items[5].item);
+    run_loop_posix_queue_add(&queue, &items[6].item);
+    CHECK(wakeup_fd_readable());
+    run_loop_process_queue();
+    CHECK(!wakeup_fd_readable());
+    CHECK_EQUAL(7, processed_count);
+}
+
+TEST(RunLoopPosixQueue, CloseProcessesRemainingItems){
+    run_loop_posix_queue_add(&queue, &items[0].item);
+    run_loop_posix_queue_add(&queue, &items[1].item);
+    run_loop_posix_queue_close(&queue);
+    queue_open = 0;
+    CHECK_EQUAL(2, processed_count);
+    CHECK_EQUAL(0, processed_values[0]);
+    CHECK_EQUAL(1, processed_values[1]);
+    CHECK_EQUAL(-1, queue.ds.fd);
+}
+
+// items from each producer thread arrive in the order they were added
+
+static test_item_t producer_items[NUM_PRODUCERS][ITEMS_PER_PRODUCER];
+static int producer_next_value[NUM_PRODUCERS];
+static int producer_items_out_of_order;
+static int producer_items_processed;
+
+static void producer_process(run_loop_posix_queue_t * q, run_loop_posix_queue_item_t * item){
+    test_item_t * test_item = (test_item_t *) item;
+    if (test_item->value != producer_next_value[test_item->producer]){
+        producer_items_out_of_order++;
+    }
+    producer_next_value[test_item->producer] = test_item->value + 1;
+    producer_items_processed++;
+}
+
+static void * producer_thread(void * context){
+    test_item_t * thread_items = (test_item_t *) context;
+    int i;
+    for (i = 0; i < ITEMS_PER_PRODUCER; i++){
+        run_loop_posix_queue_add(&queue, &thread_items[i].item);
+    }
+    return NULL;
+}
+
+TEST(RunLoopPosixQueue, ProducerThreadsKeepOrder){
+    run_loop_posix_queue_close(&queue);
+    CHECK_EQUAL(0, run_loop_posix_queue_open(&queue, &producer_process));
+
+    pthread_t threads[NUM_PRODUCERS];
+    int p, i;
+    for (p = 0; p < NUM_PRODUCERS; p++){
+        producer_next_value[p] = 0;
+        for (i = 0; i < ITEMS_PER_PRODUCER; i++){
+            producer_items[p][i].producer = p;
+            producer_items[p][i].value = i;
+        }
+    }
+    producer_items_out_of_order = 0;
+    producer_items_processed = 0;
+    for (p = 0; p < NUM_PRODUCERS; p++){
+        CHECK_EQUAL(0, pthread_create(&threads[p], NULL, &producer_thread, producer_items[p]));
+    }
+
+    // wait for wakeups like the run loop does
+    while (producer_items_processed < NUM_PRODUCERS * ITEMS_PER_PRODUCER){
+        struct pollfd pfd = { queue.ds.fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 1000) != 1) break;
+        run_loop_process_queue();
+    }
+    for (p = 0; p < NUM_PRODUCERS; p++){
+        pthread_join(threads[p], NULL);
+    }
+    CHECK_EQUAL(NUM_PRODUCERS * ITEMS_PER_PRODUCER, producer_items_processed);
+    CHECK_EQUAL(0, producer_items_out_of_order);
+}
+
+int main (int argc, const char * argv[]){
+    run_loop_init(RUN_LOOP_POSIX);
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
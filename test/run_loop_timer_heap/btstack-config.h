@@ -0,0 +1,12 @@
+// config for run loop timer heap test, no malloc to test fixed heap size
+
+#define HAVE_TIME
+
+#define ENABLE_LOG_INFO
+#define ENABLE_LOG_ERROR
+
+#define USE_POSIX_RUN_LOOP
+
+#define HCI_ACL_PAYLOAD_SIZE 52
+
+#define MAX_NO_RUN_LOOP_TIMERS 8
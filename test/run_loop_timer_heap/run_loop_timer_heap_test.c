@@ -0,0 +1,161 @@
+// *****************************************************************************
+//
+// run loop timer heap tests
+//
+// *****************************************************************************
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <btstack/run_loop.h>
+#include "run_loop_private.h"
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#define NUM_TIMERS 8
+
+static timer_source_t timers[NUM_TIMERS];
+static timer_source_t extra_timer;
+
+static void timer_handler(timer_source_t *ts){
+}
+
+static void set_timeout(timer_source_t *ts, int timeout_sec){
+    ts->timeout.tv_sec  = timeout_sec;
+    ts->timeout.tv_usec = 0;
+    ts->process = &timer_handler;
+}
+
+// takes timers in expiration order like the run loop and returns their indices
+static int take_all(int * indices){
+    int count = 0;
+    timer_source_t * ts;
+    while ((ts = run_loop_timer_heap_first()) != NULL){
+        indices[count++] = ts - timers;
+        run_loop_remove_timer(ts);
+    }
+    return count;
+}
+
+TEST_GROUP(RunLoopTimerHeap){
+    void setup(void){
+        int i;
+        memset(timers, 0, sizeof(timers));
+        for (i = 0; i < NUM_TIMERS; i++){
+            timers[i].heap_index = -1;
+        }
+        memset(&extra_timer, 0, sizeof(extra_timer));
+        extra_timer.heap_index = -1;
+    }
+    void teardown(void){
+        timer_source_t * ts;
+        while ((ts = run_loop_timer_heap_first()) != NULL){
+            run_loop_remove_timer(ts);
+        }
+    }
+};
+
+TEST(RunLoopTimerHeap, AddKeepsEarliestFirst){
+    int timeouts[] = { 50, 20, 70, 10, 60, 30, 40 };
+    int i;
+    for (i = 0; i < 7; i++){
+        set_timeout(&timers[i], timeouts[i]);
+        CHECK_EQUAL(0, run_loop_add_timer(&timers[i]));
+        CHECK_EQUAL(i + 1, run_loop_timer_heap_size());
+    }
+    POINTERS_EQUAL(&timers[3], run_loop_timer_heap_first());
+
+    int expected[] = { 3, 1, 5, 6, 0, 4, 2 };
+    int indices[NUM_TIMERS];
+    CHECK_EQUAL(7, take_all(indices));
+    for (i = 0; i < 7; i++){
+        CHECK_EQUAL(expected[i], indices[i]);
+    }
+}
+
+TEST(RunLoopTimerHeap, RemoveFromMiddle){
+    int i;
+    for (i = 0; i < 7; i++){
+        set_timeout(&timers[i], 10 * (i + 1));
+        CHECK_EQUAL(0, run_loop_add_timer(&timers[i]));
+    }
+    // neither first nor last in heap
+    CHECK_EQUAL(0, run_loop_remove_timer(&timers[3]));
+    CHECK_EQUAL(6, run_loop_timer_heap_size());
+    CHECK_EQUAL(-1, run_loop_remove_timer(&timers[3]));
+
+    int expected[] = { 0, 1, 2, 4, 5, 6 };
+    int indices[NUM_TIMERS];
+    CHECK_EQUAL(6, take_all(indices));
+    for (i = 0; i < 6; i++){
+        CHECK_EQUAL(expected[i], indices[i]);
+    }
+}
+
+TEST(RunLoopTimerHeap, ReAddQueuedTimerFails){
+    set_timeout(&timers[0], 10);
+    set_timeout(&timers[1], 20);
+    CHECK_EQUAL(0, run_loop_add_timer(&timers[0]));
+    CHECK_EQUAL(0, run_loop_add_timer(&timers[1]));
+    CHECK_EQUAL(-1, run_loop_add_timer(&timers[1]));
+    CHECK_EQUAL(2, run_loop_timer_heap_size());
+
+    // re-add after remove with new timeout
+    CHECK_EQUAL(0, run_loop_remove_timer(&timers[0]));
+    set_timeout(&timers[0], 30);
+    CHECK_EQUAL(0, run_loop_add_timer(&timers[0]));
+    POINTERS_EQUAL(&timers[1], run_loop_timer_heap_first());
+}
+
+TEST(RunLoopTimerHeap, EqualTimeoutsExpireInOrderOfAdding){
+    int i;
+    for (i = 0; i < 6; i++){
+        set_timeout(&timers[i], 10);
+    }
+    int order[] = { 4, 1, 5, 0, 3, 2 };
+    for (i = 0; i < 6; i++){
+        CHECK_EQUAL(0, run_loop_add_timer(&timers[order[i]]));
+    }
+    // earlier timer is not affected
+    set_timeout(&timers[6], 5);
+    CHECK_EQUAL(0, run_loop_add_timer(&timers[6]));
+
+    int indices[NUM_TIMERS];
+    CHECK_EQUAL(7, take_all(indices));
+    CHECK_EQUAL(6, indices[0]);
+    for (i = 0; i < 6; i++){
+        CHECK_EQUAL(order[i], indices[i + 1]);
+    }
+}
+
+TEST(RunLoopTimerHeap, RemoveNeverAddedTimer){
+    timer_source_t ts;
+    memset(&ts, 0x55, sizeof(ts));
+    CHECK_EQUAL(-1, run_loop_remove_timer(&ts));
+    CHECK_EQUAL(0, run_loop_timer_heap_size());
+}
+
+TEST(RunLoopTimerHeap, FullHeapReportsError){
+    set_timeout(&extra_timer, 5);
+
+    int i;
+    for (i = 0; i < NUM_TIMERS; i++){
+        set_timeout(&timers[i], 10 + i);
+        CHECK_EQUAL(0, run_loop_add_timer(&timers[i]));
+    }
+    CHECK_EQUAL(-1, run_loop_add_timer(&extra_timer));
+    CHECK_EQUAL(NUM_TIMERS, run_loop_timer_heap_size());
+    POINTERS_EQUAL(&timers[0], run_loop_timer_heap_first());
+
+    CHECK_EQUAL(0, run_loop_remove_timer(&timers[4]));
+    CHECK_EQUAL(0, run_loop_add_timer(&extra_timer));
+    POINTERS_EQUAL(&extra_timer, run_loop_timer_heap_first());
+}
+
+int main (int argc, const char * argv[]){
+    run_loop_init(RUN_LOOP_POSIX);
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}